@@ -124,6 +124,11 @@ read_chunk(struct rucb_conn *c, int offset, char *to, int maxsize)
 static void
 timedout(struct rucb_conn *c)
 {
+  if(downloading) {
+    shell_output_str(&download_command, "download: transfer broken off", "");
+    downloading = 0;
+    process_poll(&shell_download_process);
+  }
 }
 /*---------------------------------------------------------------------------*/
 static const struct rucb_callbacks rucb_call = { write_chunk, read_chunk, timedout };
@@ -0,0 +1,114 @@
+/**
+ * \file
+ *         Contiki shell commands for the counters kept by subnet and pubsub
+ *
+ *         "subnet" prints the counters, "subnet-dump" outputs them in the
+ *         binary format of pubsub_dump_counters(), which subnet/stats/counters
+ *         reads (e.g. after "subnet-dump | bin2hex").
+ */
+
+#include "contiki.h"
+#include "shell.h"
+#include "lib/pubsub.h"
+
+#include <stdio.h>
+
+/*---------------------------------------------------------------------------*/
+PROCESS(shell_subnet_process, "subnet");
+SHELL_COMMAND(subnet_command,
+	      "subnet",
+	      "subnet: print subnet and pubsub counters",
+	      &shell_subnet_process);
+PROCESS(shell_subnet_dump_process, "subnet-dump");
+SHELL_COMMAND(subnet_dump_command,
+	      "subnet-dump",
+	      "subnet-dump: output subnet and pubsub counters in binary",
+	      &shell_subnet_dump_process);
+/*---------------------------------------------------------------------------*/
+static const char *types[SUBNET_COUNTED_TYPES] = {
+  "subscribe", "publish", "unsubscribe", "leaving", "reply", "ask", "invalidate"
+};
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(shell_subnet_process, ev, data)
+{
+  const struct subnet_counters *c;
+  const struct pubsub_counters *p;
+  char buf[80];
+  uint8_t i;
+
+  PROCESS_BEGIN();
+
+  c = pubsub_subnet_counters();
+  p = pubsub_counters();
+  if(c == NULL || p == NULL) {
+    shell_output_str(&subnet_command, "subnet: counters not enabled", "");
+    PROCESS_EXIT();
+  }
+
+  for(i = 0; i < SUBNET_COUNTED_TYPES; i++) {
+    snprintf(buf, sizeof(buf), "%s: sent %lu (%lu bytes) received %lu (%lu bytes)",
+	     types[i],
+	     c->sent[i].packets, c->sent[i].bytes,
+	     c->received[i].packets, c->received[i].bytes);
+    shell_output_str(&subnet_command, buf, "");
+  }
+
+  snprintf(buf, sizeof(buf), "fragments: added %lu merged %lu dropped %lu resurrected %lu",
+	   c->added, c->merged, c->dropped, c->resurrections);
+  shell_output_str(&subnet_command, buf, "");
+
+  snprintf(buf, sizeof(buf), "failovers %lu, buffer high-water %u bytes, queue high-water %u",
+	   c->failovers, c->buffer_hwm, c->queue_hwm);
+  shell_output_str(&subnet_command, buf, "");
+
+  snprintf(buf, sizeof(buf), "route repair: solicited %lu repaired %lu",
+	   c->solicits, c->repairs);
+  shell_output_str(&subnet_command, buf, "");
+
+  snprintf(buf, sizeof(buf), "queue flushes: timer %lu urgent %lu full %lu nobuf %lu",
+	   c->flushes[SUBNET_FLUSH_TIMER], c->flushes[SUBNET_FLUSH_URGENT],
+	   c->flushes[SUBNET_FLUSH_FULL], c->flushes[SUBNET_FLUSH_NOBUF]);
+  shell_output_str(&subnet_command, buf, "");
+
+  snprintf(buf, sizeof(buf), "subscriptions: learned %lu revoked %lu",
+	   p->subscriptions, p->unsubscriptions);
+  shell_output_str(&subnet_command, buf, "");
+
+  snprintf(buf, sizeof(buf), "readings: delivered %lu forwarded %lu",
+	   p->delivered, p->forwarded);
+  shell_output_str(&subnet_command, buf, "");
+
+  snprintf(buf, sizeof(buf), "buffer flushes: timer %lu full %lu half %lu",
+	   p->flushes[PUBSUB_FLUSH_TIMER], p->flushes[PUBSUB_FLUSH_FULL],
+	   p->flushes[PUBSUB_FLUSH_HALF]);
+  shell_output_str(&subnet_command, buf, "");
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(shell_subnet_dump_process, ev, data)
+{
+#if SUBNET_COUNTERS
+  static uint8_t buf[PUBSUB_COUNTERS_DUMP_SIZE];
+  uint8_t len;
+#endif
+
+  PROCESS_BEGIN();
+
+#if SUBNET_COUNTERS
+  len = pubsub_dump_counters(buf, sizeof(buf));
+  shell_output(&subnet_dump_command, buf, len, "", 0);
+#else
+  shell_output_str(&subnet_dump_command, "subnet-dump: counters not enabled", "");
+#endif
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+shell_subnet_init(void)
+{
+  shell_register_command(&subnet_command);
+  shell_register_command(&subnet_dump_command);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,13 @@
+/**
+ * \file
+ *         Header file for the Contiki shell commands for subnet counters
+ */
+
+#ifndef __SHELL_SUBNET_H__
+#define __SHELL_SUBNET_H__
+
+#include "shell.h"
+
+void shell_subnet_init(void);
+
+#endif /* __SHELL_SUBNET_H__ */
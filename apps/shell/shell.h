@@ -406,6 +406,7 @@ struct shell_input {
 #include "shell-sendtest.h"
 #include "shell-sensortweet.h"
 #include "shell-sky.h"
+#include "shell-subnet.h"
 #include "shell-tcpsend.h"
 #include "shell-text.h"
 #include "shell-time.h"
@@ -0,0 +1,248 @@
+/**
+ * \file
+ *         Fixed-point forward FFT of real samples, and spectral features
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "lib/fft.h"
+
+/*---------------------------------------------------------------------------*/
+/* sin(2 * pi * i / FFT_MAX_SIZE) in Q15 for the first quarter of a period.
+ * The rest of the period follows from symmetry */
+static const int16_t SIN_TAB[FFT_MAX_SIZE / 4 + 1] = {
+  0, 201, 402, 603, 804, 1005, 1206, 1407, 1608, 1809,
+  2009, 2210, 2411, 2611, 2811, 3012, 3212, 3412, 3612, 3812,
+  4011, 4211, 4410, 4609, 4808, 5007, 5205, 5404, 5602, 5800,
+  5998, 6195, 6393, 6590, 6787, 6983, 7180, 7376, 7571, 7767,
+  7962, 8157, 8351, 8546, 8740, 8933, 9127, 9319, 9512, 9704,
+  9896, 10088, 10279, 10469, 10660, 10850, 11039, 11228, 11417, 11605,
+  11793, 11980, 12167, 12354, 12540, 12725, 12910, 13095, 13279, 13463,
+  13646, 13828, 14010, 14192, 14373, 14553, 14733, 14912, 15091, 15269,
+  15447, 15624, 15800, 15976, 16151, 16326, 16500, 16673, 16846, 17018,
+  17190, 17361, 17531, 17700, 17869, 18037, 18205, 18372, 18538, 18703,
+  18868, 19032, 19195, 19358, 19520, 19681, 19841, 20001, 20160, 20318,
+  20475, 20632, 20788, 20943, 21097, 21251, 21403, 21555, 21706, 21856,
+  22006, 22154, 22302, 22449, 22595, 22740, 22884, 23028, 23170, 23312,
+  23453, 23593, 23732, 23870, 24008, 24144, 24279, 24414, 24548, 24680,
+  24812, 24943, 25073, 25202, 25330, 25457, 25583, 25708, 25833, 25956,
+  26078, 26199, 26320, 26439, 26557, 26674, 26791, 26906, 27020, 27133,
+  27246, 27357, 27467, 27576, 27684, 27791, 27897, 28002, 28106, 28209,
+  28311, 28411, 28511, 28610, 28707, 28803, 28899, 28993, 29086, 29178,
+  29269, 29359, 29448, 29535, 29622, 29707, 29792, 29875, 29957, 30038,
+  30118, 30196, 30274, 30350, 30425, 30499, 30572, 30644, 30715, 30784,
+  30853, 30920, 30986, 31050, 31114, 31177, 31238, 31298, 31357, 31415,
+  31471, 31527, 31581, 31634, 31686, 31737, 31786, 31834, 31881, 31927,
+  31972, 32015, 32058, 32099, 32138, 32177, 32214, 32251, 32286, 32319,
+  32352, 32383, 32413, 32442, 32470, 32496, 32522, 32546, 32568, 32590,
+  32610, 32629, 32647, 32664, 32679, 32693, 32706, 32718, 32729, 32738,
+  32746, 32753, 32758, 32762, 32766, 32767, 32767
+};
+
+/* adding this before shifting a Q15 product rounds it to nearest */
+#define ROUND (1L << 14)
+
+/* butterflies grow each part by at most a factor 1 + sqrt(2), so values below
+ * this cannot overflow in the next stage */
+#define HEADROOM 8192
+/*---------------------------------------------------------------------------*/
+static int16_t sin_q15(uint16_t i) {
+  i &= FFT_MAX_SIZE - 1;
+  if (i < FFT_MAX_SIZE / 4) {
+    return SIN_TAB[i];
+  } else if (i < FFT_MAX_SIZE / 2) {
+    return SIN_TAB[FFT_MAX_SIZE / 2 - i];
+  } else if (i < 3 * FFT_MAX_SIZE / 4) {
+    return -SIN_TAB[i - FFT_MAX_SIZE / 2];
+  }
+  return -SIN_TAB[FFT_MAX_SIZE - i];
+}
+
+static int16_t cos_q15(uint16_t i) {
+  return sin_q15(i + FFT_MAX_SIZE / 4);
+}
+
+/* halves all n values until there is enough headroom for another stage, and
+ * returns how many times they were halved */
+static uint8_t normalize(int16_t x[], uint16_t n) {
+  int16_t max = 0;
+  uint8_t shift = 0;
+  uint16_t i;
+
+  for (i = 0; i < n; i++) {
+    if (x[i] > max) {
+      max = x[i];
+    } else if (-x[i] > max) {
+      max = -x[i];
+    }
+  }
+
+  /* -32768 stays negative when negated */
+  if (max < 0) {
+    max = 32767;
+  }
+
+  while ((max >> shift) >= HEADROOM) {
+    shift++;
+  }
+
+  if (shift > 0) {
+    for (i = 0; i < n; i++) {
+      x[i] >>= shift;
+    }
+  }
+
+  return shift;
+}
+
+/* in-place radix-2 FFT of n complex values stored as (re, im) pairs */
+static uint8_t fft_complex(int16_t x[], uint16_t n) {
+  uint16_t i, j, k, size, half, step;
+  int32_t tr, ti;
+  int16_t c, s, t;
+  uint8_t exp = 0;
+
+  /* bit-reversed order */
+  for (i = 1, j = 0; i < n; i++) {
+    for (k = n >> 1; j & k; k >>= 1) {
+      j ^= k;
+    }
+    j |= k;
+    if (i < j) {
+      t = x[2*i]; x[2*i] = x[2*j]; x[2*j] = t;
+      t = x[2*i+1]; x[2*i+1] = x[2*j+1]; x[2*j+1] = t;
+    }
+  }
+
+  for (size = 2; size <= n; size <<= 1) {
+    exp += normalize(x, 2*n);
+
+    half = size >> 1;
+    step = FFT_MAX_SIZE / size;
+    for (j = 0; j < half; j++) {
+      /* w = e^(-2 pi i j / size) = c - is */
+      c = cos_q15(j * step);
+      s = sin_q15(j * step);
+      for (i = j; i < n; i += size) {
+        k = i + half;
+        tr = ((int32_t)c * x[2*k] + (int32_t)s * x[2*k+1] + ROUND) >> 15;
+        ti = ((int32_t)c * x[2*k+1] - (int32_t)s * x[2*k] + ROUND) >> 15;
+        x[2*k] = x[2*i] - tr;
+        x[2*k+1] = x[2*i+1] - ti;
+        x[2*i] += tr;
+        x[2*i+1] += ti;
+      }
+    }
+  }
+
+  return exp;
+}
+/*---------------------------------------------------------------------------*/
+void fft_hann(int16_t x[], uint16_t n) {
+  uint16_t step = FFT_MAX_SIZE / n;
+  uint16_t i;
+  int32_t w;
+
+  for (i = 0; i < n; i++) {
+    /* (1 - cos(2 pi i / n)) / 2 in Q15 */
+    w = (32768L - cos_q15(i * step)) >> 1;
+    x[i] = ((int32_t)x[i] * w + ROUND) >> 15;
+  }
+}
+
+uint8_t fft_real(int16_t x[], uint16_t n) {
+  uint16_t half = n >> 1;
+  uint16_t k, m;
+  int16_t c, s;
+  int32_t er, ei, odr, odi, tr, ti;
+  uint8_t exp;
+
+  /* the even samples are the real parts and the odd samples the imaginary
+   * parts of a complex sequence of half the length */
+  exp = fft_complex(x, half);
+  exp += normalize(x, n);
+
+  /* untangle the transforms of the even and the odd samples. Bins k and
+   * half - k are computed from the same two complex values */
+  for (k = 1; k <= half / 2; k++) {
+    m = half - k;
+    er = ((int32_t)x[2*k] + x[2*m]) >> 1;
+    ei = ((int32_t)x[2*k+1] - x[2*m+1]) >> 1;
+    odr = ((int32_t)x[2*k+1] + x[2*m+1]) >> 1;
+    odi = ((int32_t)x[2*m] - x[2*k]) >> 1;
+
+    c = cos_q15(k * (FFT_MAX_SIZE / n));
+    s = sin_q15(k * (FFT_MAX_SIZE / n));
+    tr = ((int32_t)c * odr + (int32_t)s * odi + ROUND) >> 15;
+    ti = ((int32_t)c * odi - (int32_t)s * odr + ROUND) >> 15;
+
+    x[2*k] = er + tr;
+    x[2*k+1] = ei + ti;
+    if (m != k) {
+      x[2*m] = er - tr;
+      x[2*m+1] = ti - ei;
+    }
+  }
+
+  /* DC and Nyquist are both real, so they share bin 0 */
+  tr = x[0];
+  x[0] = tr + x[1];
+  x[1] = tr - x[1];
+
+  return exp;
+}
+
+uint16_t fft_bands(const int16_t x[], uint16_t n, uint32_t energy[], uint8_t bands) {
+  uint16_t half = n >> 1;
+  uint16_t k, peak = 0;
+  uint32_t p, max = 0;
+  uint8_t b;
+
+  for (b = 0; b < bands; b++) {
+    energy[b] = 0;
+  }
+
+  for (k = 1; k <= half; k++) {
+    if (k == half) {
+      p = (int32_t)x[1] * x[1];
+    } else {
+      p = (int32_t)x[2*k] * x[2*k] + (uint32_t)((int32_t)x[2*k+1] * x[2*k+1]);
+    }
+
+    if (p > max) {
+      max = p;
+      peak = k;
+    }
+
+    b = (uint32_t)(k - 1) * bands / half;
+    if (energy[b] + p < energy[b]) {
+      energy[b] = UINT32_MAX;
+    } else {
+      energy[b] += p;
+    }
+  }
+
+  return peak;
+}
+
+uint8_t fft_level(uint32_t power, uint8_t exp) {
+  uint16_t level;
+  uint8_t log = 31;
+
+  if (power == 0) {
+    return 0;
+  }
+
+  while (!(power & (1UL << log))) {
+    log--;
+  }
+
+  /* two bits after the leading one give the fraction. Close enough to the
+   * logarithm for telling levels apart */
+  level = log * 4;
+  level += (log >= 2 ? power >> (log - 2) : power << (2 - log)) & 3;
+  level += 8 * exp;
+
+  return level > 255 ? 255 : level;
+}
+/*---------------------------------------------------------------------------*/
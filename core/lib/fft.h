@@ -0,0 +1,68 @@
+/**
+ * \file
+ *         Fixed-point forward FFT of real samples, and spectral features
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ *
+ * Unlike ifft.c, which is meant for small windows of 8-bit values, this
+ * handles full 16-bit samples. Every stage checks whether it has room to grow,
+ * and halves all values if it does not (block floating point), so quiet
+ * signals keep their precision and loud ones do not overflow. The number of
+ * halvings is returned so that levels can still be compared across windows.
+ *
+ * A window of samples is usually turned into a handful of bytes with
+ *
+ *   fft_hann(x, n);
+ *   exp = fft_real(x, n);
+ *   peak = fft_bands(x, n, energy, bands);
+ *   level[b] = fft_level(energy[b], exp);
+ */
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include "contiki-conf.h"
+
+/* largest number of samples that can be transformed, given by the size of
+ * the sine table */
+#define FFT_MAX_SIZE 1024
+
+/**
+ * \brief Multiply samples by a Hann window, to keep a window that does not
+ *        cover a whole number of periods from leaking into every bin
+ * \param x Samples
+ * \param n Number of samples, a power of two no larger than FFT_MAX_SIZE
+ */
+void fft_hann(int16_t x[], uint16_t n);
+
+/**
+ * \brief Forward FFT of real samples, in place
+ * \param x n samples. Replaced by bins 0 to n/2 - 1 as (re, im) pairs,
+ *        except that x[1] holds the real part of bin n/2, as the imaginary
+ *        parts of both bin 0 and bin n/2 are zero
+ * \param n Number of samples, a power of two between 4 and FFT_MAX_SIZE
+ * \return exp such that the bins are the transform divided by 2^exp
+ */
+uint8_t fft_real(int16_t x[], uint16_t n);
+
+/**
+ * \brief Sum the power of the bins given by fft_real in bands of equal width
+ * \param x Output of fft_real
+ * \param n Number of samples given to fft_real
+ * \param energy Set to the power in each band. Bins 1 to n/2 are split
+ *        evenly over the bands, leaving out DC. Saturates rather than wraps
+ * \param bands Number of bands, at most n/2
+ * \return The bin with the most power, or 0 if all bins are empty
+ */
+uint16_t fft_bands(const int16_t x[], uint16_t n, uint32_t energy[], uint8_t bands);
+
+/**
+ * \brief Turn a power into a level that fits in a byte
+ * \param power Power as given by fft_bands
+ * \param exp As returned by fft_real for the same samples
+ * \return 4 * log2(power * 4^exp), approximately, saturating at 255. A
+ *         difference of 4 is a factor 2 in power, or about 3 dB. Fits the
+ *         power of any band of a full scale 1024 sample window
+ */
+uint8_t fft_level(uint32_t power, uint8_t exp);
+
+#endif /* __FFT_H__ */
@@ -93,6 +93,9 @@
 struct hdr {
   uint8_t id;
   uint8_t len;
+#if CONTIKIMAC_CONF_ADAPTIVE
+  uint8_t period;
+#endif /* CONTIKIMAC_CONF_ADAPTIVE */
 };
 #endif /* WITH_CONTIKIMAC_HEADER */
 
@@ -170,10 +173,75 @@ static int is_receiver_awake = 0;
 
 
 
+/* With CONTIKIMAC_CONF_ADAPTIVE, the channel is only checked every
+   ADAPTIVE_MAX_SKIP cycles on nodes that report no load through
+   contikimac_set_load(), and every ADAPTIVE_MAX_SKIP / 2 cycles on nodes
+   with little load. Busy nodes check every cycle and once more halfway
+   through it. Checks are always done on the same cycle grid, so the phases
+   neighbors have recorded for us stay valid. After we send anything or
+   receive a frame for us, every cycle is checked for ADAPTIVE_HOLD so that
+   replies and follow-ups are not delayed.
+
+   Every frame carries the sender's check period in the ContikiMAC header,
+   and neighbors that do not check every cycle are remembered. Broadcasts
+   are strobed long enough for the slowest of them, and unicasts for as
+   long as the receiver needs, so only the receivers that skip checks cost
+   longer strobes. A node only checks less often, or halfway through the
+   cycle, once it has announced it in a broadcast. Neighbors that missed
+   that learn it from the next frame the node sends, and until then a
+   receiver that does not ack is assumed to skip as many cycles as it
+   may. Broadcasts do not wait for such receivers, which are often just
+   gone.
+
+   A skipped check saves well under a millisecond of radio time, while
+   each frame to a node that skips costs its sender up to a cycle of
+   strobing per skipped cycle, so this only pays off on nodes that are
+   rarely sent to. */
+#ifdef CONTIKIMAC_CONF_ADAPTIVE
+#define ADAPTIVE                           CONTIKIMAC_CONF_ADAPTIVE
+#else
+#define ADAPTIVE                           0
+#endif
+
+#ifdef CONTIKIMAC_CONF_ADAPTIVE_MAX_SKIP
+#define ADAPTIVE_MAX_SKIP                  CONTIKIMAC_CONF_ADAPTIVE_MAX_SKIP
+#else
+#define ADAPTIVE_MAX_SKIP                  4
+#endif
+
+/* Packets relayed per minute for a node to count as busy */
+#ifdef CONTIKIMAC_CONF_ADAPTIVE_BUSY
+#define ADAPTIVE_BUSY                      CONTIKIMAC_CONF_ADAPTIVE_BUSY
+#else
+#define ADAPTIVE_BUSY                      30
+#endif
+
+#define ADAPTIVE_HOLD                      (2 * CLOCK_SECOND)
+
+/* Neighbors whose check period is not one cycle that we remember */
+#ifdef CONTIKIMAC_CONF_ADAPTIVE_NEIGHBORS
+#define ADAPTIVE_NEIGHBORS                 CONTIKIMAC_CONF_ADAPTIVE_NEIGHBORS
+#else
+#define ADAPTIVE_NEIGHBORS                 16
+#endif
+
+/* Check periods, in half cycles */
+#define ADAPTIVE_PERIOD_BUSY               1
+#define ADAPTIVE_PERIOD_CYCLE              2
+#define ADAPTIVE_PERIOD_MAX                (2 * ADAPTIVE_MAX_SKIP)
+
+#if ADAPTIVE && !WITH_CONTIKIMAC_HEADER
+#error "CONTIKIMAC_CONF_ADAPTIVE needs the ContikiMAC header to announce check periods"
+#endif
+
 /* STROBE_TIME is the maximum amount of time a transmitted packet
    should be repeatedly transmitted as part of a transmission. */
 #define STROBE_TIME                        (CYCLE_TIME + 2 * CHECK_TIME)
 
+/* ADAPTIVE_STROBE_TIME is STROBE_TIME for a receiver that checks the
+   channel every period half cycles. */
+#define ADAPTIVE_STROBE_TIME(period)       ((period) * (CYCLE_TIME / 2) + 2 * CHECK_TIME)
+
 /* GUARD_TIME is the time before the expected phase of a neighbor that
    a transmitted should begin transmitting packets. */
 #define GUARD_TIME                         10 * CHECK_TIME + CHECK_TIME_TX
@@ -269,6 +337,28 @@ static struct timer broadcast_rate_timer;
 static int broadcast_rate_counter;
 #endif /* CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT */
 
+#if ADAPTIVE
+/* The check period our load calls for, and the one we last broadcast */
+static uint8_t adaptive_period = ADAPTIVE_PERIOD_CYCLE;
+static uint8_t adaptive_announced = ADAPTIVE_PERIOD_CYCLE;
+static uint8_t adaptive_skipped;
+/* Whether the next check is the one halfway through the cycle */
+static uint8_t adaptive_midcycle;
+/* Every cycle is checked until this expires */
+static struct timer adaptive_hold;
+
+struct adaptive_neighbor {
+  rimeaddr_t addr;
+  uint8_t period;
+  /* Whether the period was assumed after a missing ack, not announced */
+  uint8_t assumed;
+};
+/* Neighbors not listed check every cycle. Unused entries have period 0 */
+static struct adaptive_neighbor adaptive_neighbors[ADAPTIVE_NEIGHBORS];
+#else /* ADAPTIVE */
+#define adaptive_midcycle 0
+#endif /* ADAPTIVE */
+
 /*---------------------------------------------------------------------------*/
 static void
 on(void)
@@ -289,6 +379,122 @@ off(void)
   }
 }
 /*---------------------------------------------------------------------------*/
+#if ADAPTIVE
+/* The check period neighbors should assume for us. Raising it waits for
+   a broadcast, since until then neighbors strobe for the old one. */
+static uint8_t
+adaptive_announcement(void)
+{
+  if(adaptive_period == ADAPTIVE_PERIOD_BUSY) {
+    /* Until then we do not check halfway through the cycle either */
+    return adaptive_announced == ADAPTIVE_PERIOD_BUSY ?
+      ADAPTIVE_PERIOD_BUSY : ADAPTIVE_PERIOD_CYCLE;
+  }
+  return adaptive_period;
+}
+/*---------------------------------------------------------------------------*/
+/* The check period we run at now */
+static uint8_t
+adaptive_current(void)
+{
+  uint8_t period = adaptive_announcement();
+
+  if(period != ADAPTIVE_PERIOD_BUSY) {
+    period = MIN(period, adaptive_announced);
+    if(period < ADAPTIVE_PERIOD_CYCLE) {
+      period = ADAPTIVE_PERIOD_CYCLE;
+    }
+  }
+  if(!timer_expired(&adaptive_hold)) {
+    period = MIN(period, ADAPTIVE_PERIOD_CYCLE);
+  }
+  return period;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+adaptive_checks(void)
+{
+  if(++adaptive_skipped >= adaptive_current() / 2) {
+    adaptive_skipped = 0;
+    return CCA_COUNT_MAX;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static struct adaptive_neighbor *
+adaptive_neighbor(const rimeaddr_t *addr)
+{
+  int i;
+
+  for(i = 0; i < ADAPTIVE_NEIGHBORS; i++) {
+    if(adaptive_neighbors[i].period != 0 &&
+       rimeaddr_cmp(&adaptive_neighbors[i].addr, addr)) {
+      return &adaptive_neighbors[i];
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+adaptive_period_of(const rimeaddr_t *addr)
+{
+  struct adaptive_neighbor *n = adaptive_neighbor(addr);
+
+  return n != NULL ? n->period : ADAPTIVE_PERIOD_CYCLE;
+}
+/*---------------------------------------------------------------------------*/
+static void
+adaptive_learn(const rimeaddr_t *addr, uint8_t period, uint8_t assumed)
+{
+  struct adaptive_neighbor *n = adaptive_neighbor(addr);
+  int i;
+
+  if(period < ADAPTIVE_PERIOD_BUSY || period > ADAPTIVE_PERIOD_MAX) {
+    return;
+  }
+  if(n == NULL) {
+    if(period == ADAPTIVE_PERIOD_CYCLE) {
+      return;
+    }
+    /* When full, forget the neighbor with the shortest period, since
+       assuming that it checks every cycle costs the least */
+    n = &adaptive_neighbors[0];
+    for(i = 1; i < ADAPTIVE_NEIGHBORS && n->period != 0; i++) {
+      if(adaptive_neighbors[i].period < n->period) {
+        n = &adaptive_neighbors[i];
+      }
+    }
+    if(n->period > period) {
+      return;
+    }
+    rimeaddr_copy(&n->addr, addr);
+  }
+  n->period = period == ADAPTIVE_PERIOD_CYCLE ? 0 : period;
+  n->assumed = assumed;
+}
+/*---------------------------------------------------------------------------*/
+/* A broadcast has to reach the neighbor that checks least often */
+static uint8_t
+adaptive_broadcast_period(void)
+{
+  uint8_t period = ADAPTIVE_PERIOD_CYCLE;
+  int i;
+
+  for(i = 0; i < ADAPTIVE_NEIGHBORS; i++) {
+    if(!adaptive_neighbors[i].assumed && adaptive_neighbors[i].period > period) {
+      period = adaptive_neighbors[i].period;
+    }
+  }
+  return period;
+}
+/*---------------------------------------------------------------------------*/
+static void
+adaptive_activity(void)
+{
+  timer_set(&adaptive_hold, ADAPTIVE_HOLD);
+}
+#endif /* ADAPTIVE */
+/*---------------------------------------------------------------------------*/
 static volatile rtimer_clock_t cycle_start;
 static char powercycle(struct rtimer *t, void *ptr);
 static void
@@ -374,27 +580,38 @@ powercycle(struct rtimer *t, void *ptr)
     static uint8_t packet_seen;
     static rtimer_clock_t t0;
     static uint8_t count;
+    static uint8_t checks;
 
+    /* A check halfway through the cycle does not start a new one */
+    if(!adaptive_midcycle) {
 #if SYNC_CYCLE_STARTS
-    /* Compute cycle start when RTIMER_ARCH_SECOND is not a multiple of CHANNEL_CHECK_RATE */
-    if (sync_cycle_phase++ == NETSTACK_RDC_CHANNEL_CHECK_RATE) {
-       sync_cycle_phase = 0;
-       sync_cycle_start += RTIMER_ARCH_SECOND;
-       cycle_start = sync_cycle_start;
-    } else {
+      /* Compute cycle start when RTIMER_ARCH_SECOND is not a multiple of CHANNEL_CHECK_RATE */
+      if (sync_cycle_phase++ == NETSTACK_RDC_CHANNEL_CHECK_RATE) {
+         sync_cycle_phase = 0;
+         sync_cycle_start += RTIMER_ARCH_SECOND;
+         cycle_start = sync_cycle_start;
+      } else {
 #if (RTIMER_ARCH_SECOND * NETSTACK_RDC_CHANNEL_CHECK_RATE) > 65535
-       cycle_start = sync_cycle_start + ((unsigned long)(sync_cycle_phase*RTIMER_ARCH_SECOND))/NETSTACK_RDC_CHANNEL_CHECK_RATE;
+         cycle_start = sync_cycle_start + ((unsigned long)(sync_cycle_phase*RTIMER_ARCH_SECOND))/NETSTACK_RDC_CHANNEL_CHECK_RATE;
 #else
-       cycle_start = sync_cycle_start + (sync_cycle_phase*RTIMER_ARCH_SECOND)/NETSTACK_RDC_CHANNEL_CHECK_RATE;
+         cycle_start = sync_cycle_start + (sync_cycle_phase*RTIMER_ARCH_SECOND)/NETSTACK_RDC_CHANNEL_CHECK_RATE;
 #endif
-    }
+      }
 #else
-    cycle_start += CYCLE_TIME;
+      cycle_start += CYCLE_TIME;
 #endif
+    }
 
     packet_seen = 0;
 
-    for(count = 0; count < CCA_COUNT_MAX; ++count) {
+#if ADAPTIVE
+    /* Skipped cycles still advance cycle_start, keeping us on the grid */
+    checks = adaptive_midcycle ? CCA_COUNT_MAX : adaptive_checks();
+#else /* ADAPTIVE */
+    checks = CCA_COUNT_MAX;
+#endif /* ADAPTIVE */
+
+    for(count = 0; count < checks; ++count) {
       t0 = RTIMER_NOW();
       if(we_are_sending == 0 && we_are_receiving_burst == 0) {
         powercycle_turn_radio_on();
@@ -473,6 +690,18 @@ powercycle(struct rtimer *t, void *ptr)
       }
     }
 
+#if ADAPTIVE
+    /* Busy nodes check again halfway through the cycle */
+    if(!adaptive_midcycle && adaptive_current() == ADAPTIVE_PERIOD_BUSY &&
+       RTIMER_CLOCK_LT(RTIMER_NOW() - cycle_start, CYCLE_TIME / 2 - CHECK_TIME * 4)) {
+      adaptive_midcycle = 1;
+      schedule_powercycle_fixed(t, CYCLE_TIME / 2 + cycle_start);
+      PT_YIELD(&pt);
+      continue;
+    }
+    adaptive_midcycle = 0;
+#endif /* ADAPTIVE */
+
     if(RTIMER_CLOCK_LT(RTIMER_NOW() - cycle_start, CYCLE_TIME - CHECK_TIME * 4)) {
 	     /* Schedule the next powercycle interrupt, or sleep the mcu until then.
                 Sleeping will not exit from this interrupt, so ensure an occasional wake cycle
@@ -528,11 +757,16 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
   uint8_t is_broadcast = 0;
   uint8_t is_reliable = 0;
   uint8_t is_known_receiver = 0;
+  uint8_t is_phase_locked;
   uint8_t collisions;
   int transmit_len;
   int ret;
   uint8_t contikimac_was_on;
   uint8_t seqno;
+  rtimer_clock_t strobe_time;
+#if ADAPTIVE
+  uint8_t receiver_period;
+#endif /* ADAPTIVE */
 #if WITH_CONTIKIMAC_HEADER
   struct hdr *chdr;
 #endif /* WITH_CONTIKIMAC_HEADER */
@@ -548,6 +782,10 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
     return MAC_TX_ERR_FATAL;
   }
 
+#if ADAPTIVE
+  adaptive_activity();
+#endif /* ADAPTIVE */
+
   packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &rimeaddr_node_addr);
   if(rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &rimeaddr_null)) {
     is_broadcast = 1;
@@ -576,6 +814,17 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
   is_reliable = packetbuf_attr(PACKETBUF_ATTR_RELIABLE) ||
     packetbuf_attr(PACKETBUF_ATTR_ERELIABLE);
 
+#if ADAPTIVE
+  if(is_broadcast) {
+    receiver_period = adaptive_broadcast_period();
+  } else {
+    receiver_period = adaptive_period_of(packetbuf_addr(PACKETBUF_ADDR_RECEIVER));
+  }
+  strobe_time = ADAPTIVE_STROBE_TIME(receiver_period);
+#else /* ADAPTIVE */
+  strobe_time = STROBE_TIME;
+#endif /* ADAPTIVE */
+
   packetbuf_set_attr(PACKETBUF_ATTR_MAC_ACK, 1);
 
 #if WITH_CONTIKIMAC_HEADER
@@ -588,6 +837,11 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
   chdr = packetbuf_hdrptr();
   chdr->id = CONTIKIMAC_ID;
   chdr->len = hdrlen;
+#if ADAPTIVE
+  /* A broadcast announces the period we want, and we switch to it once
+     the broadcast is out */
+  chdr->period = is_broadcast ? adaptive_period : adaptive_announcement();
+#endif /* ADAPTIVE */
   
   /* Create the MAC header for the data packet. */
   hdrlen = NETSTACK_FRAMER.create();
@@ -643,6 +897,12 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
     }
 #endif /* WITH_PHASE_OPTIMIZATION */ 
   }
+#if ADAPTIVE
+  /* A receiver whose phase we know may be skipping this cycle */
+  is_phase_locked = is_known_receiver && receiver_period <= ADAPTIVE_PERIOD_CYCLE;
+#else /* ADAPTIVE */
+  is_phase_locked = is_known_receiver;
+#endif /* ADAPTIVE */
   
 
 
@@ -724,11 +984,12 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
   seqno = packetbuf_attr(PACKETBUF_ATTR_MAC_SEQNO);
   for(strobes = 0, collisions = 0;
       got_strobe_ack == 0 && collisions == 0 &&
-      RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + STROBE_TIME); strobes++) {
+      RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + strobe_time); strobes++) {
 
     watchdog_periodic();
 
-    if((is_receiver_awake || is_known_receiver) && !RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + MAX_PHASE_STROBE_TIME)) {
+    if((is_receiver_awake || is_phase_locked) &&
+       !RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + MAX_PHASE_STROBE_TIME)) {
       PRINTF("miss to %d\n", packetbuf_addr(PACKETBUF_ADDR_RECEIVER)->u8[0]);
       break;
     }
@@ -821,6 +1082,15 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
     ret = MAC_TX_OK;
   }
 
+#if ADAPTIVE
+  if(is_broadcast && ret == MAC_TX_OK) {
+    adaptive_announced = adaptive_period;
+  } else if(ret == MAC_TX_NOACK && !is_receiver_awake) {
+    /* It may have announced a longer period in a broadcast we missed */
+    adaptive_learn(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), ADAPTIVE_PERIOD_MAX, 1);
+  }
+#endif /* ADAPTIVE */
+
 #if WITH_PHASE_OPTIMIZATION
 
   if(is_known_receiver && got_strobe_ack) {
@@ -829,6 +1099,13 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr, struct rdc_buf_
   }
 
   if(!is_broadcast) {
+#if ADAPTIVE
+    /* A busy receiver may have acked from its check halfway through the
+       cycle, which is not its phase */
+    if(receiver_period == ADAPTIVE_PERIOD_BUSY) {
+      return ret;
+    }
+#endif /* ADAPTIVE */
     if(collisions == 0 && is_receiver_awake == 0) {
       phase_update(&phase_list, packetbuf_addr(PACKETBUF_ADDR_RECEIVER), encounter_time,
                    ret);
@@ -926,6 +1203,9 @@ input_packet(void)
     }
     packetbuf_hdrreduce(sizeof(struct hdr));
     packetbuf_set_datalen(chdr->len);
+#if ADAPTIVE
+    adaptive_learn(packetbuf_addr(PACKETBUF_ADDR_SENDER), chdr->period, 0);
+#endif /* ADAPTIVE */
 #endif /* WITH_CONTIKIMAC_HEADER */
 
     if(packetbuf_datalen() > 0 &&
@@ -980,6 +1260,14 @@ input_packet(void)
       compower_clear(&current_packet);
 #endif /* CONTIKIMAC_CONF_COMPOWER */
 
+#if ADAPTIVE
+      /* Frames for others are not followed by anything for us */
+      if(rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &rimeaddr_node_addr) ||
+         rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &rimeaddr_null)) {
+        adaptive_activity();
+      }
+#endif /* ADAPTIVE */
+
       PRINTDEBUG("contikimac: data (%u)\n", packetbuf_datalen());
       NETSTACK_MAC.input();
       return;
@@ -991,6 +1279,23 @@ input_packet(void)
   }
 }
 /*---------------------------------------------------------------------------*/
+void
+contikimac_set_load(uint16_t relayed, uint8_t flows)
+{
+#if ADAPTIVE
+  if(relayed >= ADAPTIVE_BUSY) {
+    adaptive_period = ADAPTIVE_PERIOD_BUSY;
+  } else if(relayed > 0 || flows > 0) {
+    adaptive_period = ADAPTIVE_MAX_SKIP > 1 ? 2 * (ADAPTIVE_MAX_SKIP / 2) :
+      ADAPTIVE_PERIOD_CYCLE;
+  } else {
+    adaptive_period = ADAPTIVE_PERIOD_MAX;
+  }
+  PRINTF("contikimac: load %u/%u, checking every %u half cycles\n",
+         relayed, flows, adaptive_period);
+#endif /* ADAPTIVE */
+}
+/*---------------------------------------------------------------------------*/
 static void
 init(void)
 {
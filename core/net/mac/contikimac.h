@@ -47,4 +47,15 @@
 
 extern const struct rdc_driver contikimac_driver;
 
+/**
+ * \brief Tell ContikiMAC how busy the upper layers are
+ * \param relayed Number of packets relayed during the last minute
+ * \param flows Number of data flows this node takes part in
+ *
+ * Only has an effect with CONTIKIMAC_CONF_ADAPTIVE, in which case nodes with
+ * less load check the channel less often, and busy nodes more often. The
+ * check period is announced to neighbors, which strobe for as long as it.
+ */
+void contikimac_set_load(uint16_t relayed, uint8_t flows);
+
 #endif /* CONTIKIMAC_H */
@@ -357,6 +357,7 @@ enum {
   PACKETBUF_ATTR_MAX_REXMIT,
   PACKETBUF_ATTR_NUM_REXMIT,
   PACKETBUF_ATTR_PENDING,
+  PACKETBUF_ATTR_ENERGY,
   
   /* Scope 2 attributes: used between end-to-end nodes. */
   PACKETBUF_ATTR_HOPS,
@@ -365,6 +366,7 @@ enum {
   PACKETBUF_ATTR_EPACKET_TYPE,
   PACKETBUF_ATTR_ERELIABLE,
   PACKETBUF_ATTR_EFRAGMENTS,
+  PACKETBUF_ATTR_EEPOCH,
 
   /* These must be last */
   PACKETBUF_ADDR_SENDER,
@@ -56,6 +56,17 @@
 #define QUEUEBUF_REF_NUM 2
 #endif
 
+/* With QUEUEBUF_COMPACT, queuebufs in RAM are stored in a byte pool
+   that holds only the packet itself and the attributes that are set,
+   instead of in fixed size struct queuebuf_data. Most packets are
+   much shorter than PACKETBUF_SIZE and have few attributes set, so
+   the same RAM holds several times as many of them. */
+#ifdef QUEUEBUF_CONF_COMPACT
+#define QUEUEBUF_COMPACT QUEUEBUF_CONF_COMPACT
+#else
+#define QUEUEBUF_COMPACT 0
+#endif
+
 /* Structure pointing to a buffer either stored
    in RAM or swapped in CFS */
 struct queuebuf {
@@ -69,7 +80,11 @@ struct queuebuf {
   enum {IN_RAM, IN_CFS} location;
   union {
 #endif
+#if QUEUEBUF_COMPACT
+    uint8_t *ram_ptr;
+#else
     struct queuebuf_data *ram_ptr;
+#endif
 #if WITH_SWAP
     int swap_id;
   };
@@ -93,7 +108,43 @@ struct queuebuf_ref {
 
 MEMB(bufmem, struct queuebuf, QUEUEBUF_NUM);
 MEMB(refbufmem, struct queuebuf_ref, QUEUEBUF_REF_NUM);
+
+#if QUEUEBUF_COMPACT
+
+/* The pool defaults to the RAM that QUEUEBUFRAM_NUM struct
+   queuebuf_data would take. Raise QUEUEBUF_CONF_NUM to make use of
+   the room this leaves. */
+#ifdef QUEUEBUF_CONF_POOL_SIZE
+#define QUEUEBUF_POOL_SIZE QUEUEBUF_CONF_POOL_SIZE
+#else
+#define QUEUEBUF_POOL_SIZE (QUEUEBUFRAM_NUM * sizeof(struct queuebuf_data))
+#endif
+
+/* Every record in the pool is laid out as
+
+     len (2 bytes) | attrs | addrs | packet | attr... | addr...
+
+   where each attribute is its type followed by its value and each
+   address is its type followed by the address. Records are packed
+   back to back and freeing one moves the ones after it down, so the
+   pool does not fragment. Pointers into a queuebuf are therefore only
+   valid until the next queuebuf is freed. */
+#define COMPACT_HDR  4
+#define COMPACT_ATTR (1 + sizeof(packetbuf_attr_t))
+#define COMPACT_ADDR (1 + sizeof(rimeaddr_t))
+
+static uint8_t pool[QUEUEBUF_POOL_SIZE];
+static uint16_t pool_used;
+
+#if WITH_SWAP
+#define IN_POOL(b) ((b)->location == IN_RAM)
+#else
+#define IN_POOL(b) 1
+#endif
+
+#else /* QUEUEBUF_COMPACT */
 MEMB(buframmem, struct queuebuf_data, QUEUEBUFRAM_NUM);
+#endif /* QUEUEBUF_COMPACT */
 
 #if WITH_SWAP
 
@@ -112,10 +163,27 @@ struct qbuf_file {
   int renewable;
 };
 
-/* A statically allocated queuebuf used as a cache for swapped qbufs */
-static struct queuebuf_data tmpdata;
-/* A pointer to the qbuf associated to the data in tmpdata */
-static struct queuebuf *tmpdata_qbuf = NULL;
+/* Swapped qbufs are written back through a cache of
+   QUEUEBUF_SWAP_CACHE slots, where the swap id of a qbuf decides its
+   slot. Swap ids are handed out in order, so a queue that is swapped
+   out fills the slots in order: a qbuf that is freed before its slot
+   is needed again never reaches CFS, dirty slots are written back a
+   run of consecutive ids at a time, and a miss reads ahead the qbufs
+   that follow it, which a FIFO queue asks for next.
+   QUEUEBUF_SWAP_CACHE must be a power of two no larger than
+   NQBUF_PER_FILE. */
+#ifdef QUEUEBUF_CONF_SWAP_CACHE
+#define QUEUEBUF_SWAP_CACHE QUEUEBUF_CONF_SWAP_CACHE
+#else
+#define QUEUEBUF_SWAP_CACHE 4
+#endif
+#define CACHE_SLOT(swap_id) ((swap_id) & (QUEUEBUF_SWAP_CACHE - 1))
+
+static struct queuebuf_data cache[QUEUEBUF_SWAP_CACHE];
+/* The swap id of the qbuf in each slot, or -1 */
+static int cache_id[QUEUEBUF_SWAP_CACHE];
+/* Whether the slot has changed since it was read or written */
+static uint8_t cache_dirty[QUEUEBUF_SWAP_CACHE];
 /* The swap id counter */
 static int next_swap_id = 0;
 /* The swap files */
@@ -148,6 +216,138 @@ LIST(queuebuf_list);
 uint8_t queuebuf_len, queuebuf_ref_len, queuebuf_max_len;
 #endif /* QUEUEBUF_STATS */
 
+#if QUEUEBUF_COMPACT
+/*---------------------------------------------------------------------------*/
+static uint16_t
+compact_len(const uint8_t *r)
+{
+  return r[0] | (r[1] << 8);
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t *
+compact_attrs(uint8_t *r)
+{
+  return r + COMPACT_HDR + compact_len(r);
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+compact_attrs_size(const uint8_t *r)
+{
+  return r[2] * COMPACT_ATTR + r[3] * COMPACT_ADDR;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+compact_size(const uint8_t *r)
+{
+  return COMPACT_HDR + compact_len(r) + compact_attrs_size(r);
+}
+/*---------------------------------------------------------------------------*/
+/* The number of bytes the attributes that are set in the packetbuf
+   take in a record */
+static uint16_t
+packetbuf_attrs_size(void)
+{
+  uint8_t type;
+  uint16_t size = 0;
+
+  for(type = 0; type < PACKETBUF_NUM_ATTRS; ++type) {
+    if(packetbuf_attr(type) != 0) {
+      size += COMPACT_ATTR;
+    }
+  }
+  for(type = PACKETBUF_ADDR_FIRST;
+      type < PACKETBUF_ADDR_FIRST + PACKETBUF_NUM_ADDRS; ++type) {
+    if(!rimeaddr_cmp(packetbuf_addr(type), &rimeaddr_null)) {
+      size += COMPACT_ADDR;
+    }
+  }
+  return size;
+}
+/*---------------------------------------------------------------------------*/
+/* Write the attributes that are set in the packetbuf to a record.
+   There must be room for packetbuf_attrs_size() bytes after the
+   packet. */
+static void
+compact_attrs_from_packetbuf(uint8_t *r)
+{
+  uint8_t *p = compact_attrs(r);
+  packetbuf_attr_t val;
+  uint8_t type;
+
+  r[2] = r[3] = 0;
+  for(type = 0; type < PACKETBUF_NUM_ATTRS; ++type) {
+    val = packetbuf_attr(type);
+    if(val != 0) {
+      *p++ = type;
+      memcpy(p, &val, sizeof(val));
+      p += sizeof(val);
+      r[2]++;
+    }
+  }
+  for(type = PACKETBUF_ADDR_FIRST;
+      type < PACKETBUF_ADDR_FIRST + PACKETBUF_NUM_ADDRS; ++type) {
+    if(!rimeaddr_cmp(packetbuf_addr(type), &rimeaddr_null)) {
+      *p++ = type;
+      rimeaddr_copy((rimeaddr_t *)p, packetbuf_addr(type));
+      p += sizeof(rimeaddr_t);
+      r[3]++;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Find an attribute or address in a record, or return NULL if it is
+   not set */
+static uint8_t *
+compact_find(uint8_t *r, uint8_t type)
+{
+  uint8_t *p = compact_attrs(r);
+  uint8_t i;
+
+  for(i = 0; i < r[2]; ++i, p += COMPACT_ATTR) {
+    if(*p == type) {
+      return p + 1;
+    }
+  }
+  for(i = 0; i < r[3]; ++i, p += COMPACT_ADDR) {
+    if(*p == type) {
+      return p + 1;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t *
+pool_alloc(uint16_t size)
+{
+  uint8_t *r;
+  if(size > QUEUEBUF_POOL_SIZE - pool_used) {
+    return NULL;
+  }
+  r = &pool[pool_used];
+  pool_used += size;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+/* Move everything in the pool from the given pointer and up by delta
+   bytes, and update the queuebufs that point there */
+static void
+pool_shift(uint8_t *from, int delta)
+{
+  struct queuebuf *b;
+  int i;
+
+  memmove(from + delta, from, &pool[pool_used] - from);
+  pool_used += delta;
+
+  for(i = 0; i < bufmem.num; ++i) {
+    b = (struct queuebuf *)bufmem.mem + i;
+    if(bufmem.count[i] != 0 && IN_POOL(b) && b->ram_ptr >= from) {
+      b->ram_ptr += delta;
+    }
+  }
+}
+#endif /* QUEUEBUF_COMPACT */
+
 #if WITH_SWAP
 /*---------------------------------------------------------------------------*/
 static void
@@ -198,8 +398,10 @@ queuebuf_remove_from_file(int swap_id)
       ctimer_set(&renew_timer, 0, qbuf_renew_all, NULL);
     }
 
-    if(tmpdata_qbuf->swap_id == swap_id) {
-      tmpdata_qbuf->swap_id = -1;
+    /* Its data does not need to be written back any more */
+    if(cache_id[CACHE_SLOT(swap_id)] == swap_id) {
+      cache_id[CACHE_SLOT(swap_id)] = -1;
+      cache_dirty[CACHE_SLOT(swap_id)] = 0;
     }
   }
 }
@@ -223,70 +425,120 @@ get_new_swap_id(void)
   return swap_id;
 }
 /*---------------------------------------------------------------------------*/
-/* Flush tmpdata to CFS */
+/* Seek to a qbuf in its swap file, and return the file descriptor */
 static int
-queuebuf_flush_tmpdata(void)
+queuebuf_seek(int swap_id)
 {
-  int fileid, fd, ret;
+  int fd;
   cfs_offset_t offset;
-  if(tmpdata_qbuf) {
-    queuebuf_remove_from_file(tmpdata_qbuf->swap_id);
-    tmpdata_qbuf->swap_id = get_new_swap_id();
-    if(tmpdata_qbuf->swap_id == -1) {
-      return -1;
+  fd = qbuf_files[swap_id / NQBUF_PER_FILE].fd;
+  offset = (swap_id % NQBUF_PER_FILE) * sizeof(struct queuebuf_data);
+  if(cfs_seek(fd, offset, CFS_SEEK_SET) == -1) {
+    PRINTF("queuebuf_seek: cfs seek error\n");
+    return -1;
+  }
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+/* Write every dirty slot back to CFS. Slots holding consecutive swap
+   ids are next to each other, and are written with a single write. */
+static int
+queuebuf_flush_cache(void)
+{
+  int i, n, fd, len, ret = 0;
+  for(i = 0; i < QUEUEBUF_SWAP_CACHE; i += n) {
+    n = 1;
+    if(!cache_dirty[i]) {
+      continue;
     }
-    fileid = tmpdata_qbuf->swap_id / NQBUF_PER_FILE;
-    offset = (tmpdata_qbuf->swap_id % NQBUF_PER_FILE) * sizeof(struct queuebuf_data);
-    fd = qbuf_files[fileid].fd;
-    ret = cfs_seek(fd, offset, CFS_SEEK_SET);
-    if(ret == -1) {
-      PRINTF("queuebuf_flush_tmpdata: cfs seek error\n");
-      return -1;
+    while(i + n < QUEUEBUF_SWAP_CACHE && cache_dirty[i + n] &&
+          cache_id[i + n] == cache_id[i] + n) {
+      n++;
     }
-    ret = cfs_write(fd, &tmpdata, sizeof(struct queuebuf_data));
-    if(ret == -1) {
-      PRINTF("queuebuf_flush_tmpdata: cfs write error\n");
-      return -1;
+    len = n * sizeof(struct queuebuf_data);
+    fd = queuebuf_seek(cache_id[i]);
+    if(fd == -1 || cfs_write(fd, &cache[i], len) != len) {
+      PRINTF("queuebuf_flush_cache: cfs write error\n");
+      ret = -1;
+      continue;
     }
+    memset(&cache_dirty[i], 0, n);
   }
-  return 0;
+  return ret;
 }
 /*---------------------------------------------------------------------------*/
-/* If the queuebuf is in CFS, load it to tmpdata */
+/* Give a qbuf a new swap id, and return the slot its data goes in */
+static struct queuebuf_data *
+queuebuf_swap_slot(struct queuebuf *b)
+{
+  int swap_id, slot;
+  swap_id = get_new_swap_id();
+  if(swap_id == -1) {
+    return NULL;
+  }
+  slot = CACHE_SLOT(swap_id);
+  /* The ids before this one fill the slots from slot 0 up, so writing
+     them back as the first slot is reused writes them in one go */
+  if((slot == 0 || cache_dirty[slot]) && queuebuf_flush_cache() == -1) {
+    queuebuf_remove_from_file(swap_id);
+    return NULL;
+  }
+  b->swap_id = swap_id;
+  cache_id[slot] = swap_id;
+  cache_dirty[slot] = 1;
+  return &cache[slot];
+}
+/*---------------------------------------------------------------------------*/
+/* If the queuebuf is in CFS, load it to the cache */
 static struct queuebuf_data *
 queuebuf_load_to_ram(struct queuebuf *b)
 {
-  int fileid, fd, ret;
-  cfs_offset_t offset;
+  int slot, n, fd, ret, i;
+#if !QUEUEBUF_COMPACT
   if(b->location == IN_RAM) { /* the qbuf is loacted in RAM */
     return b->ram_ptr;
-  } else { /* the qbuf is located in CFS */
-    if(tmpdata_qbuf && tmpdata_qbuf->swap_id == b->swap_id) { /* the qbuf is already in tmpdata */
-      return &tmpdata;
-    } else { /* the qbuf needs to be loaded from CFS */
-      tmpdata_qbuf = b;
-      /* read the qbuf from CFS */
-      fileid = b->swap_id / NQBUF_PER_FILE;
-      offset = (b->swap_id % NQBUF_PER_FILE) * sizeof(struct queuebuf_data);
-      fd = qbuf_files[fileid].fd;
-      ret = cfs_seek(fd, offset, CFS_SEEK_SET);
-      if(ret == -1) {
-        PRINTF("queuebuf_load_to_ram: cfs seek error\n");
-      }
-      ret = cfs_read(fd, &tmpdata, sizeof(struct queuebuf_data));
-      if(ret == -1) {
-        PRINTF("queuebuf_load_to_ram: cfs read error\n");
-      }
-      return &tmpdata;
+  }
+#endif /* !QUEUEBUF_COMPACT */
+  slot = CACHE_SLOT(b->swap_id);
+  if(cache_id[slot] == b->swap_id) { /* the qbuf is already in the cache */
+    return &cache[slot];
+  }
+
+  /* Read the qbuf along with the ones after it, up to the last slot.
+     The slots are a power of two that divides NQBUF_PER_FILE, so these
+     are all in the same file. */
+  n = QUEUEBUF_SWAP_CACHE - slot;
+  for(i = slot; i < QUEUEBUF_SWAP_CACHE; i++) {
+    if(cache_dirty[i]) {
+      queuebuf_flush_cache();
+      break;
     }
   }
+  fd = queuebuf_seek(b->swap_id);
+  ret = fd == -1 ? -1 : cfs_read(fd, &cache[slot], n * sizeof(struct queuebuf_data));
+  if(ret < (int)sizeof(struct queuebuf_data)) {
+    PRINTF("queuebuf_load_to_ram: cfs read error\n");
+  }
+  for(i = 0; i < n; i++) {
+    /* only slots that were read completely hold the qbuf */
+    cache_id[slot + i] = (i + 1) * (int)sizeof(struct queuebuf_data) <= ret ?
+      b->swap_id + i : -1;
+    cache_dirty[slot + i] = 0;
+  }
+  cache_id[slot] = b->swap_id;
+  return &cache[slot];
 }
 #else /* WITH_SWAP */
 /*---------------------------------------------------------------------------*/
 static struct queuebuf_data *
 queuebuf_load_to_ram(struct queuebuf *b)
 {
+#if QUEUEBUF_COMPACT
+  /* Without swapping, every queuebuf is in the pool */
+  return NULL;
+#else
   return b->ram_ptr;
+#endif
 }
 #endif /* WITH_SWAP */
 /*---------------------------------------------------------------------------*/
@@ -299,8 +551,16 @@ queuebuf_init(void)
     qbuf_files[i].renewable = 1;
     qbuf_renew_file(i);
   }
+  for(i = 0; i < QUEUEBUF_SWAP_CACHE; i++) {
+    cache_id[i] = -1;
+    cache_dirty[i] = 0;
+  }
 #endif
+#if QUEUEBUF_COMPACT
+  pool_used = 0;
+#else
   memb_init(&buframmem);
+#endif
   memb_init(&bufmem);
   memb_init(&refbufmem);
 #if QUEUEBUF_STATS
@@ -333,7 +593,14 @@ queuebuf_new_from_packetbuf(void)
     }
     return (struct queuebuf *)rbuf;
   } else {
+#if !QUEUEBUF_COMPACT || WITH_SWAP
     struct queuebuf_data *buframptr;
+#endif
+#if QUEUEBUF_COMPACT
+    if(packetbuf_totlen() > PACKETBUF_SIZE) {
+      return NULL;
+    }
+#endif
     buf = memb_alloc(&bufmem);
     if(buf != NULL) {
 #if QUEUEBUF_DEBUG
@@ -342,38 +609,62 @@ queuebuf_new_from_packetbuf(void)
       buf->line = line;
       buf->time = clock_time();
 #endif /* QUEUEBUF_DEBUG */
+#if QUEUEBUF_COMPACT
+      buf->ram_ptr = pool_alloc(COMPACT_HDR + packetbuf_totlen() +
+                                packetbuf_attrs_size());
+#else
       buf->ram_ptr = memb_alloc(&buframmem);
+#endif
 #if WITH_SWAP
       /* If the allocation failed, store the qbuf in swap files */
       if(buf->ram_ptr != NULL) {
         buf->location = IN_RAM;
+#if !QUEUEBUF_COMPACT
         buframptr = buf->ram_ptr;
+#endif
       } else {
         buf->location = IN_CFS;
-        buf->swap_id = -1;
-        tmpdata_qbuf = buf;
-        buframptr = &tmpdata;
+        buframptr = queuebuf_swap_slot(buf);
+        if(buframptr == NULL) {
+          /* We were unable to make room for the data in the swap */
+#if QUEUEBUF_DEBUG
+          list_remove(queuebuf_list, buf);
+#endif /* QUEUEBUF_DEBUG */
+          memb_free(&bufmem, buf);
+          return NULL;
+        }
       }
 #else
       if(buf->ram_ptr == NULL) {
         PRINTF("queuebuf_new_from_packetbuf: could not queuebuf data\n");
+#if QUEUEBUF_DEBUG
+        list_remove(queuebuf_list, buf);
+#endif /* QUEUEBUF_DEBUG */
+        memb_free(&bufmem, buf);
         return NULL;
       }
+#if !QUEUEBUF_COMPACT
       buframptr = buf->ram_ptr;
 #endif
+#endif
 
-      buframptr->len = packetbuf_copyto(buframptr->data);
-      packetbuf_attr_copyto(buframptr->attrs, buframptr->addrs);
-
+#if QUEUEBUF_COMPACT
+      if(IN_POOL(buf)) {
+        buf->ram_ptr[0] = packetbuf_totlen() & 0xff;
+        buf->ram_ptr[1] = packetbuf_totlen() >> 8;
+        packetbuf_copyto(buf->ram_ptr + COMPACT_HDR);
+        compact_attrs_from_packetbuf(buf->ram_ptr);
+      }
 #if WITH_SWAP
-      if(buf->location == IN_CFS) {
-        if(queuebuf_flush_tmpdata() == -1) {
-          /* We were unable to write the data in the swap */
-          memb_free(&bufmem, buf);
-          return NULL;
-        }
+      else {
+        buframptr->len = packetbuf_copyto(buframptr->data);
+        packetbuf_attr_copyto(buframptr->attrs, buframptr->addrs);
       }
 #endif
+#else /* QUEUEBUF_COMPACT */
+      buframptr->len = packetbuf_copyto(buframptr->data);
+      packetbuf_attr_copyto(buframptr->attrs, buframptr->addrs);
+#endif /* QUEUEBUF_COMPACT */
 
 #if QUEUEBUF_STATS
       ++queuebuf_len;
@@ -396,11 +687,42 @@ queuebuf_new_from_packetbuf(void)
 void
 queuebuf_update_attr_from_packetbuf(struct queuebuf *buf)
 {
-  struct queuebuf_data *buframptr = queuebuf_load_to_ram(buf);
+  struct queuebuf_data *buframptr;
+#if QUEUEBUF_COMPACT
+  int delta;
+
+  if(IN_POOL(buf)) {
+    delta = packetbuf_attrs_size() - compact_attrs_size(buf->ram_ptr);
+    if(delta > (int)(QUEUEBUF_POOL_SIZE - pool_used)) {
+#if WITH_SWAP
+      /* Move the qbuf to the swap instead */
+      uint8_t *r = buf->ram_ptr;
+      buframptr = queuebuf_swap_slot(buf);
+      if(buframptr != NULL) {
+        buf->location = IN_CFS;
+        buframptr->len = compact_len(r);
+        memcpy(buframptr->data, r + COMPACT_HDR, buframptr->len);
+        packetbuf_attr_copyto(buframptr->attrs, buframptr->addrs);
+        pool_shift(r + compact_size(r), -compact_size(r));
+        return;
+      }
+#endif /* WITH_SWAP */
+      PRINTF("queuebuf_update_attr_from_packetbuf: no room for attributes\n");
+      return;
+    }
+    if(delta != 0) {
+      pool_shift(buf->ram_ptr + compact_size(buf->ram_ptr), delta);
+    }
+    compact_attrs_from_packetbuf(buf->ram_ptr);
+    return;
+  }
+#endif /* QUEUEBUF_COMPACT */
+  buframptr = queuebuf_load_to_ram(buf);
   packetbuf_attr_copyto(buframptr->attrs, buframptr->addrs);
 #if WITH_SWAP
   if(buf->location == IN_CFS) {
-    queuebuf_flush_tmpdata();
+    /* written back in place when its slot is needed */
+    cache_dirty[CACHE_SLOT(buf->swap_id)] = 1;
   }
 #endif
 }
@@ -409,7 +731,17 @@ void
 queuebuf_free(struct queuebuf *buf)
 {
   if(memb_inmemb(&bufmem, buf)) {
+#if QUEUEBUF_COMPACT
+    if(IN_POOL(buf)) {
+      pool_shift(buf->ram_ptr + compact_size(buf->ram_ptr),
+                 -compact_size(buf->ram_ptr));
+    }
 #if WITH_SWAP
+    else {
+      queuebuf_remove_from_file(buf->swap_id);
+    }
+#endif
+#elif WITH_SWAP
     if(buf->location == IN_RAM) {
       memb_free(&buframmem, buf->ram_ptr);
     } else {
@@ -439,7 +771,26 @@ queuebuf_to_packetbuf(struct queuebuf *b)
 {
   struct queuebuf_ref *r;
   if(memb_inmemb(&bufmem, b)) {
-    struct queuebuf_data *buframptr = queuebuf_load_to_ram(b);
+    struct queuebuf_data *buframptr;
+#if QUEUEBUF_COMPACT
+    if(IN_POOL(b)) {
+      uint8_t *p = compact_attrs(b->ram_ptr);
+      packetbuf_attr_t val;
+      uint8_t i;
+
+      /* packetbuf_copyfrom() clears the attributes that are not set */
+      packetbuf_copyfrom(b->ram_ptr + COMPACT_HDR, compact_len(b->ram_ptr));
+      for(i = 0; i < b->ram_ptr[2]; ++i, p += COMPACT_ATTR) {
+        memcpy(&val, p + 1, sizeof(val));
+        packetbuf_set_attr(*p, val);
+      }
+      for(i = 0; i < b->ram_ptr[3]; ++i, p += COMPACT_ADDR) {
+        packetbuf_set_addr(*p, (rimeaddr_t *)(p + 1));
+      }
+      return;
+    }
+#endif /* QUEUEBUF_COMPACT */
+    buframptr = queuebuf_load_to_ram(b);
     packetbuf_copyfrom(buframptr->data, buframptr->len);
     packetbuf_attr_copyfrom(buframptr->attrs, buframptr->addrs);
   } else if(memb_inmemb(&refbufmem, b)) {
@@ -457,7 +808,13 @@ queuebuf_dataptr(struct queuebuf *b)
   struct queuebuf_ref *r;
 
   if(memb_inmemb(&bufmem, b)) {
-    struct queuebuf_data *buframptr = queuebuf_load_to_ram(b);
+    struct queuebuf_data *buframptr;
+#if QUEUEBUF_COMPACT
+    if(IN_POOL(b)) {
+      return b->ram_ptr + COMPACT_HDR;
+    }
+#endif /* QUEUEBUF_COMPACT */
+    buframptr = queuebuf_load_to_ram(b);
     return buframptr->data;
   } else if(memb_inmemb(&refbufmem, b)) {
     r = (struct queuebuf_ref *)b;
@@ -469,21 +826,45 @@ queuebuf_dataptr(struct queuebuf *b)
 int
 queuebuf_datalen(struct queuebuf *b)
 {
-  struct queuebuf_data *buframptr = queuebuf_load_to_ram(b);
+  struct queuebuf_data *buframptr;
+#if QUEUEBUF_COMPACT
+  if(IN_POOL(b)) {
+    return compact_len(b->ram_ptr);
+  }
+#endif /* QUEUEBUF_COMPACT */
+  buframptr = queuebuf_load_to_ram(b);
   return buframptr->len;
 }
 /*---------------------------------------------------------------------------*/
 rimeaddr_t *
 queuebuf_addr(struct queuebuf *b, uint8_t type)
 {
-  struct queuebuf_data *buframptr = queuebuf_load_to_ram(b);
+  struct queuebuf_data *buframptr;
+#if QUEUEBUF_COMPACT
+  if(IN_POOL(b)) {
+    uint8_t *p = compact_find(b->ram_ptr, type);
+    return p != NULL ? (rimeaddr_t *)p : (rimeaddr_t *)&rimeaddr_null;
+  }
+#endif /* QUEUEBUF_COMPACT */
+  buframptr = queuebuf_load_to_ram(b);
   return &buframptr->addrs[type - PACKETBUF_ADDR_FIRST].addr;
 }
 /*---------------------------------------------------------------------------*/
 packetbuf_attr_t
 queuebuf_attr(struct queuebuf *b, uint8_t type)
 {
-  struct queuebuf_data *buframptr = queuebuf_load_to_ram(b);
+  struct queuebuf_data *buframptr;
+#if QUEUEBUF_COMPACT
+  if(IN_POOL(b)) {
+    uint8_t *p = compact_find(b->ram_ptr, type);
+    packetbuf_attr_t val = 0;
+    if(p != NULL) {
+      memcpy(&val, p, sizeof(val));
+    }
+    return val;
+  }
+#endif /* QUEUEBUF_COMPACT */
+  buframptr = queuebuf_load_to_ram(b);
   return buframptr->attrs[type].val;
 }
 /*---------------------------------------------------------------------------*/
@@ -66,6 +66,7 @@
 #include "net/rime/runicast.h"
 #include "net/rime/timesynch.h"
 #include "net/rime/trickle.h"
+#include "net/rime/wunicast.h"
 
 #include "net/mac/mac.h"
 /**
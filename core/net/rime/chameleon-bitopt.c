@@ -53,10 +53,63 @@
 #define CHAMELEON_WITH_MAC_LINK_ADDRESSES 0
 #endif /* !CHAMELEON_CONF_WITH_MAC_LINK_ADDRESSES */
 
+/* Headers are packed and unpacked according to a plan that is compiled
+   from the attribute list when it is set on a channel, so that sending
+   and receiving a packet does not have to work out where each attribute
+   goes. Plans are kept per attribute list, since most channels share
+   theirs. Lists that do not get a plan are walked attribute by
+   attribute. */
+#ifdef CHAMELEON_BITOPT_CONF_PLANS
+#define CHAMELEON_BITOPT_PLANS CHAMELEON_BITOPT_CONF_PLANS
+#else /* CHAMELEON_BITOPT_CONF_PLANS */
+#define CHAMELEON_BITOPT_PLANS 8
+#endif /* CHAMELEON_BITOPT_CONF_PLANS */
+
+#ifdef CHAMELEON_BITOPT_CONF_PLAN_FIELDS
+#define CHAMELEON_BITOPT_PLAN_FIELDS CHAMELEON_BITOPT_CONF_PLAN_FIELDS
+#else /* CHAMELEON_BITOPT_CONF_PLAN_FIELDS */
+#define CHAMELEON_BITOPT_PLAN_FIELDS 12
+#endif /* CHAMELEON_BITOPT_CONF_PLAN_FIELDS */
+
 struct bitopt_hdr {
   uint8_t channel[2];
 };
 
+enum {
+  /* whole bytes starting on a byte boundary, copied as they are */
+  FIELD_BYTES,
+  /* whole bytes not starting on a byte boundary, each of which is
+     split over two header bytes */
+  FIELD_STREAM,
+  /* fewer than eight bits, within the two bytes starting at byte */
+  FIELD_BITS,
+  /* anything else, moved with set_bits() and get_bits() */
+  FIELD_WALK,
+};
+
+struct bitopt_field {
+  uint8_t type;
+  uint8_t op;
+  uint8_t byte;
+  /* FIELD_STREAM, FIELD_BITS: how far a byte or the value is shifted
+     up in the 16 bits starting where it goes. FIELD_WALK: the bit
+     position within byte */
+  uint8_t shift;
+  /* FIELD_BYTES, FIELD_STREAM: number of bytes. FIELD_BITS: mask of the
+     value. FIELD_WALK: number of bits */
+  uint8_t len;
+};
+
+struct bitopt_plan {
+  const struct packetbuf_attrlist *attrlist;
+  uint8_t fields;
+  struct bitopt_field field[CHAMELEON_BITOPT_PLAN_FIELDS];
+};
+
+static struct bitopt_plan plans[CHAMELEON_BITOPT_PLANS];
+static uint8_t num_plans;
+static struct bitopt_plan *last_plan;
+
 static const uint8_t bitmask[9] = { 0x00, 0x80, 0xc0, 0xe0, 0xf0,
 				 0xf8, 0xfc, 0xfe, 0xff };
 
@@ -118,10 +171,87 @@ get_bits(uint8_t *to, uint8_t *from, int bitpos, int vallen)
   }
 }
 /*---------------------------------------------------------------------------*/
+static struct bitopt_plan *
+find_plan(const struct packetbuf_attrlist *a)
+{
+  uint8_t i;
+
+  /* packets tend to come in bursts on the same channel */
+  if(last_plan != NULL && last_plan->attrlist == a) {
+    return last_plan;
+  }
+  for(i = 0; i < num_plans; ++i) {
+    if(plans[i].attrlist == a) {
+      last_plan = &plans[i];
+      return last_plan;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void
+compile_plan(const struct packetbuf_attrlist *a)
+{
+  struct bitopt_plan *p;
+  struct bitopt_field *f;
+  int bitptr, bitpos, len;
+
+  if(find_plan(a) != NULL || num_plans == CHAMELEON_BITOPT_PLANS) {
+    return;
+  }
+
+  p = &plans[num_plans];
+  p->attrlist = a;
+  p->fields = 0;
+
+  bitptr = 0;
+  for(; a->type != PACKETBUF_ATTR_NONE; ++a) {
+#if CHAMELEON_WITH_MAC_LINK_ADDRESSES
+    if(a->type == PACKETBUF_ADDR_SENDER ||
+       a->type == PACKETBUF_ADDR_RECEIVER) {
+      continue;
+    }
+#endif /* CHAMELEON_WITH_MAC_LINK_ADDRESSES */
+    if(p->fields == CHAMELEON_BITOPT_PLAN_FIELDS) {
+      PRINTF("chameleon-bitopt: too many attributes to plan\n");
+      return;
+    }
+    f = &p->field[p->fields++];
+    len = a->len;
+    bitpos = bitptr & 7;
+    f->type = a->type;
+    f->byte = bitptr / 8;
+
+    if((len & 7) == 0 &&
+       (PACKETBUF_IS_ADDR(a->type) ? len == PACKETBUF_ADDRSIZE :
+	len / 8 <= sizeof(packetbuf_attr_t))) {
+      f->op = bitpos == 0 ? FIELD_BYTES : FIELD_STREAM;
+      f->shift = 8 - bitpos;
+      f->len = len / 8;
+    } else if(len < 8 && !PACKETBUF_IS_ADDR(a->type)) {
+      f->op = FIELD_BITS;
+      f->shift = 16 - bitpos - len;
+      f->len = bitmask[len] >> (8 - len);
+    } else {
+      f->op = FIELD_WALK;
+      f->shift = bitpos;
+      f->len = len;
+    }
+    bitptr += len;
+  }
+
+  PRINTF("chameleon-bitopt: planned %d attributes\n", p->fields);
+  ++num_plans;
+}
+/*---------------------------------------------------------------------------*/
 static int
 header_size(const struct packetbuf_attrlist *a)
 {
   int size, len;
+
+  /* This is called whenever a channel gets its attributes, so it is
+     where their plan is made. */
+  compile_plan(a);
   
   /* Compute the total size of the final header by summing the size of
      all attributes that are used on this channel. */
@@ -230,33 +360,14 @@ printhdr(uint8_t *hdr, int len)
 }
 #endif
 /*---------------------------------------------------------------------------*/
-static int
-pack_header(struct channel *c)
+static void
+pack_walk(const struct packetbuf_attrlist *a, uint8_t *hdrptr)
 {
-  const struct packetbuf_attrlist *a;
-  int hdrbytesize;
   int byteptr, bitptr, len;
-  uint8_t *hdrptr;
-  struct bitopt_hdr *hdr;
-  
-  /* Compute the total size of the final header by summing the size of
-     all attributes that are used on this channel. */
 
-  hdrbytesize = c->hdrsize / 8 + ((c->hdrsize & 7) == 0? 0: 1);
-  if(packetbuf_hdralloc(hdrbytesize + sizeof(struct bitopt_hdr)) == 0) {
-    PRINTF("chameleon-bitopt: insufficient space for headers\n");
-    return 0;
-  }
-  hdr = (struct bitopt_hdr *)packetbuf_hdrptr();
-  hdr->channel[0] = c->channelno & 0xff;
-  hdr->channel[1] = (c->channelno >> 8) & 0xff;
-
-  hdrptr = ((uint8_t *)packetbuf_hdrptr()) + sizeof(struct bitopt_hdr);
-  memset(hdrptr, 0, hdrbytesize);
-  
   byteptr = bitptr = 0;
   
-  for(a = c->attrlist; a->type != PACKETBUF_ATTR_NONE; ++a) {
+  for(; a->type != PACKETBUF_ATTR_NONE; ++a) {
 #if CHAMELEON_WITH_MAC_LINK_ADDRESSES
     if(a->type == PACKETBUF_ADDR_SENDER ||
        a->type == PACKETBUF_ADDR_RECEIVER) {
@@ -290,44 +401,99 @@ pack_header(struct channel *c)
     /*    printhdr(hdrptr, hdrbytesize);*/
     bitptr += len;
   }
-  /*  printhdr(hdrptr, hdrbytesize);*/
+}
+/*---------------------------------------------------------------------------*/
+static void
+pack_planned(const struct bitopt_plan *p, uint8_t *hdrptr)
+{
+  const struct bitopt_field *f;
+  packetbuf_attr_t val;
+  const uint8_t *from;
+  uint16_t bits;
+  uint8_t i;
 
-  return 1; /* Send out packet */
+  for(f = p->field; f < p->field + p->fields; ++f) {
+    switch(f->op) {
+    case FIELD_BYTES:
+    case FIELD_STREAM:
+      if(PACKETBUF_IS_ADDR(f->type)) {
+	from = (const uint8_t *)packetbuf_addr(f->type);
+      } else {
+	val = packetbuf_attr(f->type);
+	from = (const uint8_t *)&val;
+      }
+      if(f->op == FIELD_BYTES) {
+	memcpy(&hdrptr[f->byte], from, f->len);
+      } else {
+	for(i = 0; i < f->len; ++i) {
+	  bits = (uint16_t)from[i] << f->shift;
+	  hdrptr[f->byte + i] |= bits >> 8;
+	  hdrptr[f->byte + i + 1] |= bits & 0xff;
+	}
+      }
+      break;
+    case FIELD_BITS:
+      /* Unlike set_bits(), values too large for the field are cut
+	 rather than spilled into the field before it. */
+      bits = (uint16_t)(packetbuf_attr(f->type) & f->len) << f->shift;
+      hdrptr[f->byte] |= bits >> 8;
+      if(f->shift < 8) {
+	hdrptr[f->byte + 1] |= bits & 0xff;
+      }
+      break;
+    default:
+      if(PACKETBUF_IS_ADDR(f->type)) {
+	set_bits(&hdrptr[f->byte], f->shift,
+		 (uint8_t *)packetbuf_addr(f->type), f->len);
+      } else {
+	val = packetbuf_attr(f->type);
+	set_bits(&hdrptr[f->byte], f->shift, (uint8_t *)&val, f->len);
+      }
+    }
+  }
 }
 /*---------------------------------------------------------------------------*/
-static struct channel *
-unpack_header(void)
+static int
+pack_header(struct channel *c)
 {
-  const struct packetbuf_attrlist *a;
-  int byteptr, bitptr, len;
+  const struct bitopt_plan *p;
   int hdrbytesize;
   uint8_t *hdrptr;
   struct bitopt_hdr *hdr;
-  struct channel *c;
   
+  /* Compute the total size of the final header by summing the size of
+     all attributes that are used on this channel. */
 
-  /* The packet has a header that tells us what channel the packet is
-     for. */
-  hdr = (struct bitopt_hdr *)packetbuf_dataptr();
-  if(packetbuf_hdrreduce(sizeof(struct bitopt_hdr)) == 0) {
-    PRINTF("chameleon-bitopt: too short packet\n");
-    return NULL;
-  }
-  c = channel_lookup((hdr->channel[1] << 8) + hdr->channel[0]);
-  if(c == NULL) {
-    PRINTF("chameleon-bitopt: input: channel %u not found\n",
-           (hdr->channel[1] << 8) + hdr->channel[0]);
-    return NULL;
+  hdrbytesize = c->hdrsize / 8 + ((c->hdrsize & 7) == 0? 0: 1);
+  if(packetbuf_hdralloc(hdrbytesize + sizeof(struct bitopt_hdr)) == 0) {
+    PRINTF("chameleon-bitopt: insufficient space for headers\n");
+    return 0;
   }
+  hdr = (struct bitopt_hdr *)packetbuf_hdrptr();
+  hdr->channel[0] = c->channelno & 0xff;
+  hdr->channel[1] = (c->channelno >> 8) & 0xff;
 
-  hdrptr = packetbuf_dataptr();
-  hdrbytesize = c->hdrsize / 8 + ((c->hdrsize & 7) == 0? 0: 1);
-  if(packetbuf_hdrreduce(hdrbytesize) == 0) {
-    PRINTF("chameleon-bitopt: too short packet\n");
-    return NULL;
+  hdrptr = ((uint8_t *)packetbuf_hdrptr()) + sizeof(struct bitopt_hdr);
+  memset(hdrptr, 0, hdrbytesize);
+
+  p = find_plan(c->attrlist);
+  if(p != NULL) {
+    pack_planned(p, hdrptr);
+  } else {
+    pack_walk(c->attrlist, hdrptr);
   }
+  /*  printhdr(hdrptr, hdrbytesize);*/
+
+  return 1; /* Send out packet */
+}
+/*---------------------------------------------------------------------------*/
+static void
+unpack_walk(const struct packetbuf_attrlist *a, uint8_t *hdrptr)
+{
+  int byteptr, bitptr, len;
+
   byteptr = bitptr = 0;
-  for(a = c->attrlist; a->type != PACKETBUF_ATTR_NONE; ++a) {
+  for(; a->type != PACKETBUF_ATTR_NONE; ++a) {
 #if CHAMELEON_WITH_MAC_LINK_ADDRESSES
     if(a->type == PACKETBUF_ADDR_SENDER ||
        a->type == PACKETBUF_ADDR_RECEIVER) {
@@ -360,6 +526,95 @@ unpack_header(void)
     /*    byteptr += len / 8;*/
     bitptr += len;
   }
+}
+/*---------------------------------------------------------------------------*/
+static void
+unpack_planned(const struct bitopt_plan *p, uint8_t *hdrptr)
+{
+  const struct bitopt_field *f;
+  packetbuf_attr_t val;
+  rimeaddr_t addr;
+  uint8_t *to;
+  uint16_t bits;
+  uint8_t i;
+
+  for(f = p->field; f < p->field + p->fields; ++f) {
+    switch(f->op) {
+    case FIELD_BYTES:
+    case FIELD_STREAM:
+      val = 0;
+      to = PACKETBUF_IS_ADDR(f->type) ? addr.u8 : (uint8_t *)&val;
+      if(f->op == FIELD_BYTES) {
+	memcpy(to, &hdrptr[f->byte], f->len);
+      } else {
+	for(i = 0; i < f->len; ++i) {
+	  bits = (hdrptr[f->byte + i] << 8) | hdrptr[f->byte + i + 1];
+	  to[i] = bits >> f->shift;
+	}
+      }
+      if(PACKETBUF_IS_ADDR(f->type)) {
+	packetbuf_set_addr(f->type, &addr);
+      } else {
+	packetbuf_set_attr(f->type, val);
+      }
+      break;
+    case FIELD_BITS:
+      bits = hdrptr[f->byte] << 8;
+      if(f->shift < 8) {
+	bits |= hdrptr[f->byte + 1];
+      }
+      packetbuf_set_attr(f->type, (bits >> f->shift) & f->len);
+      break;
+    default:
+      if(PACKETBUF_IS_ADDR(f->type)) {
+	get_bits((uint8_t *)&addr, &hdrptr[f->byte], f->shift, f->len);
+	packetbuf_set_addr(f->type, &addr);
+      } else {
+	val = 0;
+	get_bits((uint8_t *)&val, &hdrptr[f->byte], f->shift, f->len);
+	packetbuf_set_attr(f->type, val);
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static struct channel *
+unpack_header(void)
+{
+  const struct bitopt_plan *p;
+  int hdrbytesize;
+  uint8_t *hdrptr;
+  struct bitopt_hdr *hdr;
+  struct channel *c;
+  
+
+  /* The packet has a header that tells us what channel the packet is
+     for. */
+  hdr = (struct bitopt_hdr *)packetbuf_dataptr();
+  if(packetbuf_hdrreduce(sizeof(struct bitopt_hdr)) == 0) {
+    PRINTF("chameleon-bitopt: too short packet\n");
+    return NULL;
+  }
+  c = channel_lookup((hdr->channel[1] << 8) + hdr->channel[0]);
+  if(c == NULL) {
+    PRINTF("chameleon-bitopt: input: channel %u not found\n",
+           (hdr->channel[1] << 8) + hdr->channel[0]);
+    return NULL;
+  }
+
+  hdrptr = packetbuf_dataptr();
+  hdrbytesize = c->hdrsize / 8 + ((c->hdrsize & 7) == 0? 0: 1);
+  if(packetbuf_hdrreduce(hdrbytesize) == 0) {
+    PRINTF("chameleon-bitopt: too short packet\n");
+    return NULL;
+  }
+
+  p = find_plan(c->attrlist);
+  if(p != NULL) {
+    unpack_planned(p, hdrptr);
+  } else {
+    unpack_walk(c->attrlist, hdrptr);
+  }
   return c;
 }
 /*---------------------------------------------------------------------------*/
@@ -40,15 +40,34 @@
 
 #include "net/rime/chameleon.h"
 #include "net/rime.h"
+
+#include "net/rime/rimestats.h"
 #include "lib/list.h"
 
-LIST(channel_list);
+/* Open channels are kept in a small hash table on the channel number,
+   so that demultiplexing an incoming packet does not walk every open
+   channel. Each bucket is a list, chained through the channel's next
+   pointer. CHANNEL_HASH_SIZE must be a power of two. */
+#ifdef CHANNEL_CONF_HASH_SIZE
+#define CHANNEL_HASH_SIZE CHANNEL_CONF_HASH_SIZE
+#else
+#define CHANNEL_HASH_SIZE 8
+#endif
+
+static void *channel_table[CHANNEL_HASH_SIZE];
+
+#define BUCKET(channelno) \
+  ((list_t)&channel_table[((channelno) ^ ((channelno) >> 8)) & \
+                          (CHANNEL_HASH_SIZE - 1)])
 
 /*---------------------------------------------------------------------------*/
 void
 channel_init(void)
 {
-  list_init(channel_list);
+  int i;
+  for(i = 0; i < CHANNEL_HASH_SIZE; ++i) {
+    list_init((list_t)&channel_table[i]);
+  }
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -66,25 +85,31 @@ channel_set_attributes(uint16_t channelno,
 void
 channel_open(struct channel *c, uint16_t channelno)
 {
+  /* A channel that is opened again without being closed first is
+     moved, as list_add() would have done with a single list. */
+  list_remove(BUCKET(c->channelno), c);
   c->channelno = channelno;
-  list_add(channel_list, c);
+  list_add(BUCKET(channelno), c);
 }
 /*---------------------------------------------------------------------------*/
 void
 channel_close(struct channel *c)
 {
-  list_remove(channel_list, c);
+  list_remove(BUCKET(c->channelno), c);
 }
 /*---------------------------------------------------------------------------*/
 struct channel *
 channel_lookup(uint16_t channelno)
 {
   struct channel *c;
-  for(c = list_head(channel_list); c != NULL; c = list_item_next(c)) {
+
+  RIMESTATS_ADD(chlookup);
+  for(c = list_head(BUCKET(channelno)); c != NULL; c = list_item_next(c)) {
     if(c->channelno == channelno) {
       return c;
     }
   }
+  RIMESTATS_ADD(chmiss);
   return NULL;
 }
 /*---------------------------------------------------------------------------*/
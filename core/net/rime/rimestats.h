@@ -54,6 +54,9 @@ struct rimestats {
     sendingdrop; /* Packet dropped when we were sending a packet */
 
   unsigned long lltx, llrx;
+
+  /* Channel lookups, and lookups that found no open channel */
+  unsigned long chlookup, chmiss;
 };
 
 extern struct rimestats rimestats;
@@ -67,22 +67,18 @@ read_data(struct rucb_conn *c)
   return len;
 }
 /*---------------------------------------------------------------------------*/
+/* Send chunks until the window is full or the last chunk, which is
+   shorter than RUCB_DATASIZE, has been sent */
 static void
-acked(struct runicast_conn *ruc, const rimeaddr_t *to, uint8_t retransmissions)
+send_chunks(struct rucb_conn *c)
 {
-  struct rucb_conn *c = (struct rucb_conn *)ruc;
   int len;
-  PRINTF("%d.%d: rucb acked\n",
-	 rimeaddr_node_addr.u8[0],rimeaddr_node_addr.u8[1]);
-  c->chunk++;
-  len = read_data(c);
-  if(len == 0 && c->last_size == 0) {
-    /* Nothing more to do */
-    return;
-  }
-
-  if(len >= 0) {
-    runicast_send(&c->c, &c->receiver, MAX_TRANSMISSIONS);
+  while(c->last_size == RUCB_DATASIZE && wunicast_window_free(&c->c) > 0) {
+    len = read_data(c);
+    if(len < 0 || !wunicast_send(&c->c, &c->receiver, MAX_TRANSMISSIONS)) {
+      return;
+    }
+    c->chunk++;
     c->last_size = len;
 
     /*    {
@@ -93,9 +89,18 @@ acked(struct runicast_conn *ruc, const rimeaddr_t *to, uint8_t retransmissions)
 }
 /*---------------------------------------------------------------------------*/
 static void
-timedout(struct runicast_conn *ruc, const rimeaddr_t *to, uint8_t retransmissions)
+acked(struct wunicast_conn *wuc, const rimeaddr_t *to, uint8_t retransmissions)
+{
+  struct rucb_conn *c = (struct rucb_conn *)wuc;
+  PRINTF("%d.%d: rucb acked\n",
+	 rimeaddr_node_addr.u8[0],rimeaddr_node_addr.u8[1]);
+  send_chunks(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+timedout(struct wunicast_conn *wuc, const rimeaddr_t *to, uint8_t retransmissions)
 {
-  struct rucb_conn *c = (struct rucb_conn *)ruc;
+  struct rucb_conn *c = (struct rucb_conn *)wuc;
   PRINTF("%d.%d: rucb timedout\n",
 	 rimeaddr_node_addr.u8[0],rimeaddr_node_addr.u8[1]);
   if(c->u->timedout) {
@@ -104,19 +109,14 @@ timedout(struct runicast_conn *ruc, const rimeaddr_t *to, uint8_t retransmission
 }
 /*---------------------------------------------------------------------------*/
 static void
-recv(struct runicast_conn *ruc, const rimeaddr_t *from, uint8_t seqno)
+recv(struct wunicast_conn *wuc, const rimeaddr_t *from, uint8_t seqno)
 {
-  struct rucb_conn *c = (struct rucb_conn *)ruc;
+  struct rucb_conn *c = (struct rucb_conn *)wuc;
 
   PRINTF("%d.%d: rucb: recv from %d.%d len %d\n",
 	 rimeaddr_node_addr.u8[0],rimeaddr_node_addr.u8[1],
 	 from->u8[0], from->u8[1], packetbuf_totlen());
 
-  if(seqno == c->last_seqno) {
-    return;
-  }
-  c->last_seqno = seqno;
-
   if(rimeaddr_cmp(&c->sender, &rimeaddr_null)) {
     rimeaddr_copy(&c->sender, from);
     c->u->write_chunk(c, 0, RUCB_FLAG_NEWFILE, packetbuf_dataptr(), 0);
@@ -145,33 +145,50 @@ recv(struct runicast_conn *ruc, const rimeaddr_t *from, uint8_t seqno)
   }
 }
 /*---------------------------------------------------------------------------*/
-static const struct runicast_callbacks ruc = {recv, acked, timedout};
+static void
+skipped(struct wunicast_conn *wuc, const rimeaddr_t *from)
+{
+  struct rucb_conn *c = (struct rucb_conn *)wuc;
+  PRINTF("%d.%d: rucb: chunks from %d.%d lost\n",
+	 rimeaddr_node_addr.u8[0],rimeaddr_node_addr.u8[1],
+	 from->u8[0], from->u8[1]);
+
+  /* The sender gave up on the file, so the next chunk starts a new
+     one, and the rest of this one must not be written after it */
+  if(rimeaddr_cmp(&c->sender, from)) {
+    rimeaddr_copy(&c->sender, &rimeaddr_null);
+    if(c->u->timedout) {
+      c->u->timedout(c);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static const struct wunicast_callbacks wuc = {recv, acked, timedout, skipped};
 /*---------------------------------------------------------------------------*/
 void
 rucb_open(struct rucb_conn *c, uint16_t channel,
 	  const struct rucb_callbacks *u)
 {
   rimeaddr_copy(&c->sender, &rimeaddr_null);
-  runicast_open(&c->c, channel, &ruc);
+  wunicast_open(&c->c, channel, &wuc);
   c->u = u;
-  c->last_seqno = -1;
   c->last_size = -1;
 }
 /*---------------------------------------------------------------------------*/
 void
 rucb_close(struct rucb_conn *c)
 {
-  runicast_close(&c->c);
+  wunicast_close(&c->c);
 }
 /*---------------------------------------------------------------------------*/
 int
 rucb_send(struct rucb_conn *c, const rimeaddr_t *receiver)
 {
   c->chunk = 0;
-  read_data(c);
+  c->last_size = RUCB_DATASIZE;
   rimeaddr_copy(&c->receiver, receiver);
   rimeaddr_copy(&c->sender, &rimeaddr_node_addr);
-  runicast_send(&c->c, receiver, MAX_TRANSMISSIONS);
+  send_chunks(c);
   return 0;
 }
 /*---------------------------------------------------------------------------*/
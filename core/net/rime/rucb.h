@@ -41,7 +41,7 @@
 #ifndef __RUCB_H__
 #define __RUCB_H__
 
-#include "net/rime/runicast.h"
+#include "net/rime/wunicast.h"
 
 struct rucb_conn;
 
@@ -56,17 +56,18 @@ struct rucb_callbacks {
 		       char *data, int len);
   int (* read_chunk)(struct rucb_conn *c, int offset, char *to,
 		     int maxsize);
+  /* The file was broken off: the receiver stopped answering, or chunks
+     from the sender were lost */
   void (* timedout)(struct rucb_conn *c);
 };
 
 #define RUCB_DATASIZE 64
 
 struct rucb_conn {
-  struct runicast_conn c;
+  struct wunicast_conn c;
   const struct rucb_callbacks *u;
   rimeaddr_t receiver, sender;
   uint16_t chunk;
-  uint8_t last_seqno;
   int last_size;
 };
 
@@ -0,0 +1,492 @@
+/**
+ * \addtogroup rudolph3
+ * @{
+ */
+
+/**
+ * \file
+ *         Rudolph3: a fountain-coded block data flooding protocol
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include <stddef.h> /* for offsetof */
+#include <string.h>
+
+#include "net/rime.h"
+#include "net/rime/polite.h"
+#include "net/rime/rudolph3.h"
+#include "lib/random.h"
+
+#define SEND_INTERVAL CLOCK_SECOND / 2
+#define STEADY_INTERVAL CLOCK_SECOND * 16
+#define RESEND_INTERVAL SEND_INTERVAL * 4
+#define REQ_TIMEOUT CLOCK_SECOND / 4
+
+/* Encoded chunks sent beyond what a receiver said it needs, as some
+   will be lost or turn out not to be independent */
+#ifdef RUDOLPH3_CONF_EXTRA
+#define EXTRA RUDOLPH3_CONF_EXTRA
+#else
+#define EXTRA 2
+#endif
+
+struct rudolph3_hdr {
+  uint8_t type;
+  uint8_t hops_from_base;
+  uint16_t version;
+  uint16_t size;
+  uint8_t page;
+  /* In a request, the encoded chunks of the page that are needed. In
+     data, the encoded chunks of the page that will follow. */
+  uint8_t count;
+  /* In a request, the chunks there is no row for. In data, the chunks
+     that were XORed together. */
+  uint32_t mask;
+};
+
+/* A packet is only held back if a neighbor as far from the base sends
+   one for the same page. Encoded chunks from farther up, or of other
+   pages, are no substitute for it. */
+#define POLITE_HEADER offsetof(struct rudolph3_hdr, count)
+
+#define HOPS_MAX 64
+
+enum {
+  TYPE_DATA,
+  TYPE_REQ,
+};
+
+#define FLAG_LAST_RECEIVED 0x01
+#define FLAG_IS_STOPPED    0x02
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+#define LT(a, b) ((signed short)((a) - (b)) < 0)
+
+#define BIT(i) ((uint32_t)1 << (i))
+
+static uint8_t chunk[RUDOLPH3_DATASIZE];
+/*---------------------------------------------------------------------------*/
+/* The last chunk is shorter than RUDOLPH3_DATASIZE, and may be empty */
+static uint16_t
+chunks(struct rudolph3_conn *c)
+{
+  return c->size / RUDOLPH3_DATASIZE + 1;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+pages(struct rudolph3_conn *c)
+{
+  return (chunks(c) + RUDOLPH3_PAGE_CHUNKS - 1) / RUDOLPH3_PAGE_CHUNKS;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+page_chunks(struct rudolph3_conn *c, uint8_t page)
+{
+  uint16_t left = chunks(c) - page * RUDOLPH3_PAGE_CHUNKS;
+  return left < RUDOLPH3_PAGE_CHUNKS ? left : RUDOLPH3_PAGE_CHUNKS;
+}
+/*---------------------------------------------------------------------------*/
+/* A mask with a bit for each chunk of the page */
+static uint32_t
+page_mask(struct rudolph3_conn *c, uint8_t page)
+{
+  uint8_t n = page_chunks(c, page);
+  return n < 32 ? BIT(n) - 1 : ~(uint32_t)0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+chunk_len(struct rudolph3_conn *c, uint16_t n)
+{
+  return n + 1 == chunks(c) ? c->size % RUDOLPH3_DATASIZE : RUDOLPH3_DATASIZE;
+}
+/*---------------------------------------------------------------------------*/
+/* Read chunk n, padded with zeroes */
+static int
+read_data(struct rudolph3_conn *c, uint8_t *to, uint16_t n)
+{
+  int len = 0;
+
+  memset(to, 0, RUDOLPH3_DATASIZE);
+  if(c->cb->read_chunk) {
+    len = c->cb->read_chunk(c, n * RUDOLPH3_DATASIZE, to, RUDOLPH3_DATASIZE);
+  }
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_data(struct rudolph3_conn *c, uint16_t n, int flag, uint8_t *data)
+{
+  /* xxx Don't write any data if the application has been stopped. */
+  if(c->flags & FLAG_IS_STOPPED) {
+    return;
+  }
+  c->cb->write_chunk(c, n * RUDOLPH3_DATASIZE, flag, data, chunk_len(c, n));
+}
+/*---------------------------------------------------------------------------*/
+static void
+xor(uint8_t *to, const uint8_t *from)
+{
+  uint8_t i;
+  for(i = 0; i < RUDOLPH3_DATASIZE; i++) {
+    to[i] ^= from[i];
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+format_hdr(struct rudolph3_conn *c, struct rudolph3_hdr *hdr, uint8_t type)
+{
+  hdr->type = type;
+  hdr->hops_from_base = c->hops_from_base;
+  hdr->version = c->version;
+  hdr->size = c->size;
+}
+/*---------------------------------------------------------------------------*/
+/* Put an encoded chunk of the page being sent in the packetbuf */
+static void
+format_data(struct rudolph3_conn *c)
+{
+  struct rudolph3_hdr *hdr;
+  uint8_t *data;
+  uint8_t i, n;
+  uint32_t mask;
+
+  n = page_chunks(c, c->snd_page);
+  if(c->snd_sys != 0) {
+    for(i = 0; (c->snd_sys & BIT(i)) == 0; i++);
+    mask = BIT(i);
+    c->snd_sys &= ~mask;
+  } else {
+    do {
+      mask = (((uint32_t)random_rand() << 16) | random_rand()) &
+	page_mask(c, c->snd_page);
+    } while(mask == 0);
+  }
+
+  packetbuf_clear();
+  hdr = packetbuf_dataptr();
+  format_hdr(c, hdr, TYPE_DATA);
+  hdr->page = c->snd_page;
+  hdr->count = c->snd_left > 0 ? c->snd_left - 1 : 0;
+  hdr->mask = mask;
+  data = (uint8_t *)hdr + sizeof(struct rudolph3_hdr);
+  memset(data, 0, RUDOLPH3_DATASIZE);
+  for(i = 0; i < n; i++) {
+    if(mask & BIT(i)) {
+      read_data(c, chunk, c->snd_page * RUDOLPH3_PAGE_CHUNKS + i);
+      xor(data, chunk);
+    }
+  }
+  packetbuf_set_datalen(sizeof(struct rudolph3_hdr) + RUDOLPH3_DATASIZE);
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_req(struct rudolph3_conn *c)
+{
+  struct rudolph3_hdr *hdr;
+  uint8_t i;
+
+  packetbuf_clear();
+  packetbuf_hdralloc(sizeof(struct rudolph3_hdr));
+  hdr = packetbuf_hdrptr();
+
+  format_hdr(c, hdr, TYPE_REQ);
+  hdr->page = c->rcv_page;
+  hdr->count = page_chunks(c, c->rcv_page) - c->rank;
+  hdr->mask = page_mask(c, c->rcv_page);
+  for(i = 0; i < RUDOLPH3_PAGE_CHUNKS; i++) {
+    if(c->rows[i] != 0) {
+      hdr->mask &= ~BIT(i);
+    }
+  }
+
+  PRINTF("%d.%d: Sending request for %d chunks of page %d\n",
+	 rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+	 hdr->count, hdr->page);
+  polite_send(&c->c, REQ_TIMEOUT, POLITE_HEADER);
+}
+/*---------------------------------------------------------------------------*/
+static void
+timed_send(void *ptr)
+{
+  struct rudolph3_conn *c = (struct rudolph3_conn *)ptr;
+  clock_time_t interval;
+
+  if((c->flags & FLAG_IS_STOPPED) || c->rcv_page == 0) {
+    return;
+  }
+
+  if(c->snd_left > 0) {
+    /* Go on with the pages after the one that was asked for, as
+       whoever asked will need those too */
+    interval = SEND_INTERVAL;
+    format_data(c);
+    if(--c->snd_left == 0 && c->snd_page + 1 < c->rcv_page) {
+      c->snd_page++;
+      c->snd_left = page_chunks(c, c->snd_page) + EXTRA;
+      c->snd_sys = page_mask(c, c->snd_page);
+    }
+  } else {
+    /* Tell neighbors what the newest page is, so that those that are
+       missing it ask for it */
+    interval = STEADY_INTERVAL;
+    c->snd_page = c->rcv_page - 1;
+    c->snd_sys = 0;
+    format_data(c);
+  }
+
+  PRINTF("%d.%d: send_data page %d, %d left, rcv_page %d\n",
+	 rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+	 c->snd_page, c->snd_left, c->rcv_page);
+  polite_send(&c->c, interval, POLITE_HEADER);
+  ctimer_set(&c->t, interval, timed_send, c);
+}
+/*---------------------------------------------------------------------------*/
+/* Solve for the chunks of the page, now that every row is there */
+static void
+decode_page(struct rudolph3_conn *c)
+{
+  uint16_t first = c->rcv_page * RUDOLPH3_PAGE_CHUNKS;
+  uint8_t *data;
+  uint8_t i, j, n;
+
+  n = page_chunks(c, c->rcv_page);
+  packetbuf_clear();
+  data = packetbuf_dataptr();
+  for(i = n - 1; i-- > 0;) {
+    if(c->rows[i] == BIT(i)) {
+      continue;
+    }
+    read_data(c, data, first + i);
+    for(j = i + 1; j < n; j++) {
+      if(c->rows[i] & BIT(j)) {
+        read_data(c, chunk, first + j);
+        xor(data, chunk);
+      }
+    }
+    write_data(c, first + i, RUDOLPH3_FLAG_NONE, data);
+  }
+
+  PRINTF("%d.%d: decoded page %d\n",
+	 rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+	 c->rcv_page);
+  memset(c->rows, 0, sizeof(c->rows));
+  c->rank = 0;
+  c->rcv_page++;
+
+  if(c->rcv_page == pages(c)) {
+    c->flags |= FLAG_LAST_RECEIVED;
+    read_data(c, data, chunks(c) - 1);
+    write_data(c, chunks(c) - 1, RUDOLPH3_FLAG_LASTCHUNK, data);
+  }
+
+  /* The rows were passed on as they came in, so a few more encoded
+     chunks make up for the ones lost on the way */
+  if(c->snd_left == 0) {
+    c->snd_page = c->rcv_page - 1;
+    c->snd_left = EXTRA;
+    c->snd_sys = 0;
+    ctimer_set(&c->t, SEND_INTERVAL, timed_send, c);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Add the encoded chunk in the packetbuf to the page being received.
+   Returns the mask of the row it became, which is what the packetbuf
+   holds then, or 0 if it was not independent of the rows there are. */
+static uint32_t
+add_data(struct rudolph3_conn *c, uint32_t mask)
+{
+  uint16_t first = c->rcv_page * RUDOLPH3_PAGE_CHUNKS;
+  uint8_t *data = packetbuf_dataptr();
+  uint8_t i, n;
+
+  n = page_chunks(c, c->rcv_page);
+  mask &= page_mask(c, c->rcv_page);
+
+  /* Rows only have bits from their own on, so eliminating with row i
+     leaves the bits below i alone */
+  for(i = 0; i < n && mask != 0; i++) {
+    if((mask & BIT(i)) == 0) {
+      continue;
+    }
+    if(c->rows[i] == 0) {
+      c->rows[i] = mask;
+      c->rank++;
+      write_data(c, first + i, RUDOLPH3_FLAG_NONE, data);
+      return mask;
+    }
+    mask ^= c->rows[i];
+    read_data(c, chunk, first + i);
+    xor(data, chunk);
+  }
+  PRINTF("%d.%d: encoded chunk of page %d was not independent\n",
+	 rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+	 c->rcv_page);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Pass on the row in the packetbuf, so that nodes farther away get the
+   page without waiting for it to be decoded here */
+static void
+relay(struct rudolph3_conn *c, uint32_t mask, uint8_t left)
+{
+  struct rudolph3_hdr *hdr;
+
+  packetbuf_hdralloc(sizeof(struct rudolph3_hdr));
+  hdr = packetbuf_hdrptr();
+  format_hdr(c, hdr, TYPE_DATA);
+  hdr->page = c->rcv_page;
+  hdr->count = left;
+  hdr->mask = mask;
+  polite_send(&c->c, SEND_INTERVAL, POLITE_HEADER);
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv(struct polite_conn *polite)
+{
+  struct rudolph3_conn *c = (struct rudolph3_conn *)polite;
+  struct rudolph3_hdr *hdr = packetbuf_dataptr();
+  uint32_t mask;
+  uint8_t page, left;
+
+  if(packetbuf_datalen() < sizeof(struct rudolph3_hdr)) {
+    return;
+  }
+
+  /* Only accept requests from nodes that are farther away from the
+     base than us. */
+
+  if(hdr->type == TYPE_REQ && hdr->hops_from_base > c->hops_from_base) {
+    PRINTF("%d.%d: Got request for %d chunks of %d:%d (%d:%d)\n",
+	   rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+	   hdr->count, hdr->version, hdr->page,
+	   c->version, c->rcv_page);
+    if(hdr->version == c->version) {
+      if(hdr->page < c->rcv_page &&
+	 (c->snd_left == 0 || hdr->page <= c->snd_page)) {
+	/* The chunks the receiver has no row for are sent first, as
+	   each of them is sure to be independent of its rows */
+	left = hdr->count + EXTRA;
+	if(hdr->page != c->snd_page || c->snd_left == 0) {
+	  c->snd_page = hdr->page;
+	  c->snd_left = left;
+	  c->snd_sys = 0;
+	} else if(c->snd_left < left) {
+	  c->snd_left = left;
+	}
+	c->snd_sys |= hdr->mask & page_mask(c, hdr->page);
+	timed_send(c);
+      }
+    } else if(LT(hdr->version, c->version) && c->rcv_page > 0) {
+      c->snd_page = 0;
+      c->snd_left = page_chunks(c, 0) + EXTRA;
+      c->snd_sys = page_mask(c, 0);
+      timed_send(c);
+    }
+  } else if(hdr->type == TYPE_DATA) {
+    if(hdr->hops_from_base < c->hops_from_base) {
+      /* Only accept data from nodes that are closer to the base than
+	 us. */
+      c->hops_from_base = hdr->hops_from_base + 1;
+      if(LT(c->version, hdr->version)) {
+	PRINTF("%d.%d: rudolph3 new version %d, %d bytes\n",
+	       rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+	       hdr->version, hdr->size);
+	c->version = hdr->version;
+	c->size = hdr->size;
+	c->rcv_page = c->rank = 0;
+	memset(c->rows, 0, sizeof(c->rows));
+	c->snd_left = 0;
+	c->flags &= ~FLAG_LAST_RECEIVED;
+	if((c->flags & FLAG_IS_STOPPED) == 0) {
+	  c->cb->write_chunk(c, 0, RUDOLPH3_FLAG_NEWFILE, chunk, 0);
+	}
+      }
+      if(hdr->version == c->version &&
+	 (c->flags & FLAG_LAST_RECEIVED) == 0) {
+	if(hdr->page == c->rcv_page) {
+	  page = hdr->page;
+	  left = hdr->count;
+	  mask = hdr->mask;
+	  packetbuf_hdrreduce(sizeof(struct rudolph3_hdr));
+	  if(packetbuf_datalen() >= RUDOLPH3_DATASIZE &&
+	     (mask = add_data(c, mask)) != 0) {
+	    if(c->rank == page_chunks(c, page)) {
+	      decode_page(c);
+	    } else if(c->snd_left == 0) {
+	      relay(c, mask, left);
+	    }
+	  }
+	  /* Ask for more if what the sender still has coming will not be
+	     enough, even if none of it is lost */
+	  if(c->rcv_page == page &&
+	     page_chunks(c, page) - c->rank > left) {
+	    send_req(c);
+	  }
+	} else if(hdr->page > c->rcv_page) {
+	  PRINTF("%d.%d: received page %d > %d, sending request\n",
+		 rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+		 hdr->page, c->rcv_page);
+	  send_req(c);
+	}
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static const struct polite_callbacks polite = { recv, NULL, NULL };
+/*---------------------------------------------------------------------------*/
+void
+rudolph3_open(struct rudolph3_conn *c, uint16_t channel,
+	      const struct rudolph3_callbacks *cb)
+{
+  polite_open(&c->c, channel, &polite);
+  c->cb = cb;
+  c->version = 0;
+  c->hops_from_base = HOPS_MAX;
+}
+/*---------------------------------------------------------------------------*/
+void
+rudolph3_close(struct rudolph3_conn *c)
+{
+  polite_close(&c->c);
+  ctimer_stop(&c->t);
+}
+/*---------------------------------------------------------------------------*/
+void
+rudolph3_send(struct rudolph3_conn *c, clock_time_t send_interval)
+{
+  int len;
+
+  c->hops_from_base = 0;
+  c->version++;
+  c->size = 0;
+  do {
+    len = read_data(c, chunk, c->size / RUDOLPH3_DATASIZE);
+    c->size += len;
+  } while(len == RUDOLPH3_DATASIZE);
+  c->rcv_page = pages(c);
+  c->rank = 0;
+  c->flags = FLAG_LAST_RECEIVED;
+  c->snd_page = 0;
+  c->snd_left = page_chunks(c, 0) + EXTRA;
+  c->snd_sys = page_mask(c, 0);
+  timed_send(c);
+}
+/*---------------------------------------------------------------------------*/
+void
+rudolph3_stop(struct rudolph3_conn *c)
+{
+  polite_cancel(&c->c);
+  ctimer_stop(&c->t);
+  c->flags |= FLAG_IS_STOPPED;
+}
+/*---------------------------------------------------------------------------*/
+/** @} */
@@ -0,0 +1,108 @@
+/**
+ * \addtogroup rime
+ * @{
+ */
+
+/**
+ * \defgroup rudolph3 Fountain-coded bulk data dissemination
+ * @{
+ *
+ * The rudolph3 module disseminates a file the way rudolph2 does, but
+ * sends encoded chunks rather than the chunks themselves. The file is
+ * split into pages of RUDOLPH3_PAGE_CHUNKS chunks, and every encoded
+ * chunk is the XOR of a random set of the chunks of one page. A
+ * receiver decodes a page once it has as many independent encoded
+ * chunks of it as the page has chunks, which takes slightly more than
+ * that many on average. Which encoded chunks it got, and in what order,
+ * does not matter.
+ *
+ * A receiver that falls behind asks for a page, saying how many more
+ * encoded chunks it needs, rather than asking for each chunk it missed.
+ * Any neighbor that has the page answers with fresh encoded chunks,
+ * which are useful to every receiver still missing the page, whatever
+ * it lost. Pages are decoded in order. A node passes on every encoded
+ * chunk that is new to it right away, so that a page moves on before
+ * it has been decoded, and serves the page once it has.
+ *
+ * Decoded rows are kept in the file through the write_chunk and
+ * read_chunk callbacks until the page is done, so write_chunk may be
+ * called more than once for the same offset. Only the last call for an
+ * offset has the final data. read_chunk must return what was written
+ * last.
+ *
+ * \section channels Channels
+ *
+ * The rudolph3 module uses 1 channel.
+ *
+ */
+
+/**
+ * \file
+ *         Header file for the fountain-coded bulk data dissemination module
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#ifndef __RUDOLPH3_H__
+#define __RUDOLPH3_H__
+
+#include "net/rime/polite.h"
+#include "sys/ctimer.h"
+
+/* Chunks coded together, at most 32. More chunks per page need fewer
+   extra encoded chunks per chunk, but cost more to decode. */
+#ifdef RUDOLPH3_CONF_PAGE_CHUNKS
+#define RUDOLPH3_PAGE_CHUNKS RUDOLPH3_CONF_PAGE_CHUNKS
+#else
+#define RUDOLPH3_PAGE_CHUNKS 16
+#endif
+
+#if RUDOLPH3_PAGE_CHUNKS > 32
+#error "RUDOLPH3_CONF_PAGE_CHUNKS cannot be greater than 32"
+#endif
+
+struct rudolph3_conn;
+
+enum {
+  RUDOLPH3_FLAG_NONE,
+  RUDOLPH3_FLAG_NEWFILE,
+  RUDOLPH3_FLAG_LASTCHUNK,
+};
+
+struct rudolph3_callbacks {
+  void (* write_chunk)(struct rudolph3_conn *c, int offset, int flag,
+		       uint8_t *data, int len);
+  int (* read_chunk)(struct rudolph3_conn *c, int offset, uint8_t *to,
+		     int maxsize);
+};
+
+#define RUDOLPH3_DATASIZE 64
+
+struct rudolph3_conn {
+  struct polite_conn c;
+  const struct rudolph3_callbacks *cb;
+  struct ctimer t;
+  uint16_t version;
+  uint16_t size;
+  /* Pages before rcv_page are decoded. Row i of rcv_page is the XOR
+     of the chunks in rows[i], which has bit i as its lowest bit, or 0
+     if there is no such row yet. */
+  uint32_t rows[RUDOLPH3_PAGE_CHUNKS];
+  /* snd_left more encoded chunks of snd_page are to be sent, and the
+     first ones are the chunks in snd_sys as they are */
+  uint32_t snd_sys;
+  uint8_t rcv_page, rank;
+  uint8_t snd_page, snd_left;
+  uint8_t hops_from_base;
+  uint8_t flags;
+};
+
+void rudolph3_open(struct rudolph3_conn *c, uint16_t channel,
+		   const struct rudolph3_callbacks *cb);
+void rudolph3_close(struct rudolph3_conn *c);
+void rudolph3_send(struct rudolph3_conn *c, clock_time_t interval);
+void rudolph3_stop(struct rudolph3_conn *c);
+
+#endif /* __RUDOLPH3_H__ */
+/** @} */
+/** @} */
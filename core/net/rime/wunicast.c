@@ -0,0 +1,395 @@
+/**
+ * \addtogroup rimewunicast
+ * @{
+ */
+
+/**
+ * \file
+ *         Windowed reliable unicast
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "net/rime/wunicast.h"
+#include "net/rime.h"
+#include <string.h>
+
+#ifdef WUNICAST_CONF_REXMIT_TIME
+#define REXMIT_TIME WUNICAST_CONF_REXMIT_TIME
+#else /* WUNICAST_CONF_REXMIT_TIME */
+#define REXMIT_TIME CLOCK_SECOND
+#endif /* WUNICAST_CONF_REXMIT_TIME */
+
+/* An acknowledgement is held back this long, so that one covers
+   several packets of a burst */
+#ifdef WUNICAST_CONF_ACK_TIME
+#define ACK_TIME WUNICAST_CONF_ACK_TIME
+#else /* WUNICAST_CONF_ACK_TIME */
+#define ACK_TIME (CLOCK_SECOND / 16)
+#endif /* WUNICAST_CONF_ACK_TIME */
+
+#define SEQNO(n) ((n) & ((1 << WUNICAST_PACKET_ID_BITS) - 1))
+#define RESTARTS(n) ((n) & ((1 << (8 - WUNICAST_PACKET_ID_BITS)) - 1))
+
+static const struct packetbuf_attrlist attributes[] =
+  {
+    WUNICAST_ATTRIBUTES
+    PACKETBUF_ATTR_LAST
+  };
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/*---------------------------------------------------------------------------*/
+/* Send the i:th unacknowledged packet. Its first byte is the oldest
+   packet the receiver can still get, with the restart count above it. */
+static void
+send_data(struct wunicast_conn *c, uint8_t i)
+{
+  queuebuf_to_packetbuf(c->sndbuf[i]);
+  *(uint8_t *)packetbuf_dataptr() =
+    c->snduna | (c->sndrestarts << WUNICAST_PACKET_ID_BITS);
+  unicast_send(&c->c, &c->receiver);
+}
+/*---------------------------------------------------------------------------*/
+static void
+rexmit(void *ptr)
+{
+  struct wunicast_conn *c = ptr;
+  uint8_t i, n, rxmit;
+
+  n = SEQNO(c->sndnxt - c->snduna);
+  if(n == 0) {
+    return;
+  }
+
+  if(++c->rxmit >= c->max_rxmit) {
+    RIMESTATS_ADD(timedout);
+    PRINTF("%d.%d: wunicast: packets %d to %d timed out\n",
+           rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+           c->snduna, SEQNO(c->sndnxt - 1));
+    for(i = 0; i < n; i++) {
+      queuebuf_free(c->sndbuf[i]);
+    }
+    c->snduna = c->sndnxt;
+    c->sacked = 0;
+    c->sndrestarts = RESTARTS(c->sndrestarts + 1);
+    rxmit = c->rxmit;
+    c->rxmit = 0;
+    if(c->u->timedout) {
+      c->u->timedout(c, &c->receiver, rxmit);
+    }
+    return;
+  }
+
+  /* Everything the receiver has not said it holds is sent again, in
+     one burst */
+  for(i = 0; i < n; i++) {
+    if(i == 0 || (c->sacked & (1 << (i - 1))) == 0) {
+      RIMESTATS_ADD(rexmit);
+      send_data(c, i);
+    }
+  }
+  ctimer_set(&c->rexmit_timer, REXMIT_TIME, rexmit, c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_ack(struct wunicast_conn *c, const rimeaddr_t *from)
+{
+  uint8_t acked, i, rxmit;
+
+  if(!rimeaddr_cmp(from, &c->receiver) || packetbuf_datalen() < 2) {
+    return;
+  }
+  if(((uint8_t *)packetbuf_dataptr())[1] != c->sndrestarts) {
+    PRINTF("%d.%d: wunicast: received ACK from before restart %d\n",
+           rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+           c->sndrestarts);
+    RIMESTATS_ADD(badackrx);
+    return;
+  }
+
+  acked = SEQNO(packetbuf_attr(PACKETBUF_ATTR_PACKET_ID) - c->snduna);
+  if(acked > SEQNO(c->sndnxt - c->snduna)) {
+    PRINTF("%d.%d: wunicast: received bad ACK %d for %d\n",
+           rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+           packetbuf_attr(PACKETBUF_ATTR_PACKET_ID), c->snduna);
+    RIMESTATS_ADD(badackrx);
+    return;
+  }
+  RIMESTATS_ADD(ackrx);
+
+  for(i = 0; i < acked; i++) {
+    queuebuf_free(c->sndbuf[i]);
+  }
+  memmove(&c->sndbuf[0], &c->sndbuf[acked],
+          (WUNICAST_WINDOW - acked) * sizeof(c->sndbuf[0]));
+  c->snduna = SEQNO(c->snduna + acked);
+  c->sacked = *(uint8_t *)packetbuf_dataptr();
+
+  if(acked > 0) {
+    rxmit = c->rxmit;
+    c->rxmit = 0;
+    if(c->snduna == c->sndnxt) {
+      ctimer_stop(&c->rexmit_timer);
+    } else {
+      ctimer_set(&c->rexmit_timer, REXMIT_TIME, rexmit, c);
+    }
+    for(i = 0; i < acked; i++) {
+      if(c->u->sent) {
+        c->u->sent(c, &c->receiver, rxmit);
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_ack(void *ptr)
+{
+  struct wunicast_conn *c = ptr;
+  uint8_t ack[2];
+
+  ctimer_stop(&c->ack_timer);
+  c->unacked = 0;
+  ack[0] = c->rcvd;
+  ack[1] = c->rcvrestarts;
+  packetbuf_clear();
+  packetbuf_copyfrom(ack, sizeof(ack));
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE, PACKETBUF_ATTR_PACKET_TYPE_ACK);
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_ID, c->rcvnxt);
+  unicast_send(&c->c, &c->sender);
+  RIMESTATS_ADD(acktx);
+}
+/*---------------------------------------------------------------------------*/
+/* Move the receive window up by one packet, and return the packet
+   that is now next if it is held */
+static struct queuebuf *
+rcv_shift(struct wunicast_conn *c)
+{
+  struct queuebuf *q = (c->rcvd & 1) ? c->rcvbuf[0] : NULL;
+  memmove(&c->rcvbuf[0], &c->rcvbuf[1],
+          (WUNICAST_WINDOW - 1) * sizeof(c->rcvbuf[0]));
+  c->rcvd >>= 1;
+  c->rcvnxt = SEQNO(c->rcvnxt + 1);
+  return q;
+}
+/*---------------------------------------------------------------------------*/
+/* Deliver the next packet, which is in the packetbuf, and return the
+   one after it if it is held */
+static struct queuebuf *
+deliver_one(struct wunicast_conn *c)
+{
+  struct queuebuf *q;
+  uint8_t seqno;
+
+  seqno = c->rcvnxt;
+  q = rcv_shift(c);
+  if(c->u->recv) {
+    c->u->recv(c, &c->sender, seqno);
+  }
+  return q;
+}
+/*---------------------------------------------------------------------------*/
+static struct queuebuf *
+deliver_held(struct wunicast_conn *c, struct queuebuf *q)
+{
+  queuebuf_to_packetbuf(q);
+  queuebuf_free(q);
+  return deliver_one(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+flush_rcvbuf(struct wunicast_conn *c)
+{
+  uint8_t i;
+  for(i = 0; i < WUNICAST_WINDOW - 1; i++) {
+    if(c->rcvd & (1 << i)) {
+      queuebuf_free(c->rcvbuf[i]);
+    }
+  }
+  c->rcvd = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_data(struct wunicast_conn *c, const rimeaddr_t *from)
+{
+  struct queuebuf *q, *next;
+  uint8_t seqno, base, restarts, d;
+  int gap;
+
+  if(packetbuf_datalen() < 1) {
+    return;
+  }
+  RIMESTATS_ADD(reliablerx);
+  seqno = packetbuf_attr(PACKETBUF_ATTR_PACKET_ID);
+  base = SEQNO(*(uint8_t *)packetbuf_dataptr());
+  restarts = *(uint8_t *)packetbuf_dataptr() >> WUNICAST_PACKET_ID_BITS;
+  packetbuf_hdrreduce(1);
+
+  PRINTF("%d.%d: wunicast: got packet %d (base %d, next %d) from %d.%d\n",
+         rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+         seqno, base, c->rcvnxt, from->u8[0], from->u8[1]);
+
+  if(!rimeaddr_cmp(from, &c->sender)) {
+    /* A new sender: start from the oldest packet it has */
+    flush_rcvbuf(c);
+    rimeaddr_copy(&c->sender, from);
+    c->rcvnxt = base;
+    c->rcvrestarts = restarts;
+    c->unacked = 0;
+  } else if(restarts != c->rcvrestarts ||
+            SEQNO(c->rcvnxt - base) > WUNICAST_WINDOW) {
+    /* The sender started over, and will not send the packets before
+       base again. Held packets would be delivered across the gap, so
+       they are dropped too. Within one restart base never passes
+       rcvnxt, but that is checked as well in case the count wrapped. */
+    gap = c->rcvnxt != base || c->rcvd != 0;
+    flush_rcvbuf(c);
+    c->rcvnxt = base;
+    c->rcvrestarts = restarts;
+    c->unacked = 0;
+    if(gap && c->u->skipped) {
+      PRINTF("%d.%d: wunicast: skipping to %d\n",
+             rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1], base);
+      /* the callback may use the packetbuf */
+      q = queuebuf_new_from_packetbuf();
+      c->u->skipped(c, from);
+      if(q == NULL) {
+        send_ack(c);
+        return;
+      }
+      queuebuf_to_packetbuf(q);
+      queuebuf_free(q);
+    }
+  }
+
+  d = SEQNO(seqno - c->rcvnxt);
+  if(d == 0) {
+    next = deliver_one(c);
+    while(next != NULL) {
+      next = deliver_held(c, next);
+    }
+  } else if(d < WUNICAST_WINDOW && (c->rcvd & (1 << (d - 1))) == 0) {
+    q = queuebuf_new_from_packetbuf();
+    if(q != NULL) {
+      c->rcvbuf[d - 1] = q;
+      c->rcvd |= 1 << (d - 1);
+    }
+  }
+
+  /* A packet out of order means one was lost, or that the sender
+     missed an acknowledgement, so it is told at once */
+  if(d != 0 || ++c->unacked >= (WUNICAST_WINDOW + 1) / 2) {
+    send_ack(c);
+  } else if(ctimer_expired(&c->ack_timer)) {
+    ctimer_set(&c->ack_timer, ACK_TIME, send_ack, c);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_from_unicast(struct unicast_conn *uc, const rimeaddr_t *from)
+{
+  struct wunicast_conn *c = (struct wunicast_conn *)uc;
+
+  if(packetbuf_attr(PACKETBUF_ATTR_PACKET_TYPE) ==
+     PACKETBUF_ATTR_PACKET_TYPE_ACK) {
+    recv_ack(c, from);
+  } else {
+    recv_data(c, from);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static const struct unicast_callbacks wunicast = {recv_from_unicast};
+/*---------------------------------------------------------------------------*/
+void
+wunicast_open(struct wunicast_conn *c, uint16_t channel,
+              const struct wunicast_callbacks *u)
+{
+  unicast_open(&c->c, channel, &wunicast);
+  channel_set_attributes(channel, attributes);
+  c->u = u;
+  c->snduna = c->sndnxt = c->sacked = c->sndrestarts = 0;
+  c->rxmit = 0;
+  c->rcvnxt = c->rcvd = c->unacked = c->rcvrestarts = 0;
+  rimeaddr_copy(&c->receiver, &rimeaddr_null);
+  rimeaddr_copy(&c->sender, &rimeaddr_null);
+}
+/*---------------------------------------------------------------------------*/
+void
+wunicast_close(struct wunicast_conn *c)
+{
+  uint8_t i;
+
+  unicast_close(&c->c);
+  ctimer_stop(&c->rexmit_timer);
+  ctimer_stop(&c->ack_timer);
+  for(i = 0; i < SEQNO(c->sndnxt - c->snduna); i++) {
+    queuebuf_free(c->sndbuf[i]);
+  }
+  c->snduna = c->sndnxt;
+  flush_rcvbuf(c);
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+wunicast_window_free(struct wunicast_conn *c)
+{
+  return WUNICAST_WINDOW - SEQNO(c->sndnxt - c->snduna);
+}
+/*---------------------------------------------------------------------------*/
+int
+wunicast_send(struct wunicast_conn *c, const rimeaddr_t *receiver,
+              uint8_t max_retransmissions)
+{
+  uint8_t n;
+
+  n = SEQNO(c->sndnxt - c->snduna);
+  if(n >= WUNICAST_WINDOW) {
+    PRINTF("%d.%d: wunicast: window full\n",
+           rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1]);
+    return 0;
+  }
+  if(n > 0 && !rimeaddr_cmp(receiver, &c->receiver)) {
+    PRINTF("%d.%d: wunicast: still sending to another receiver\n",
+           rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1]);
+    return 0;
+  }
+  if(n == 0 && !rimeaddr_cmp(receiver, &c->receiver)) {
+    /* packets went elsewhere since this receiver last heard from us */
+    c->sndrestarts = RESTARTS(c->sndrestarts + 1);
+  }
+  if(!packetbuf_hdralloc(1)) {
+    return 0;
+  }
+  packetbuf_set_attr(PACKETBUF_ATTR_RELIABLE, 1);
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE, PACKETBUF_ATTR_PACKET_TYPE_DATA);
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_ID, c->sndnxt);
+  packetbuf_set_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS, 3);
+  c->sndbuf[n] = queuebuf_new_from_packetbuf();
+  if(c->sndbuf[n] == NULL) {
+    PRINTF("%d.%d: wunicast: no queuebuf for packet %d\n",
+           rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1], c->sndnxt);
+    packetbuf_hdr_remove(1);
+    return 0;
+  }
+
+  rimeaddr_copy(&c->receiver, receiver);
+  c->max_rxmit = max_retransmissions;
+  c->sndnxt = SEQNO(c->sndnxt + 1);
+  RIMESTATS_ADD(reliabletx);
+  PRINTF("%d.%d: wunicast: sending packet %d\n",
+         rimeaddr_node_addr.u8[0], rimeaddr_node_addr.u8[1],
+         SEQNO(c->sndnxt - 1));
+  send_data(c, n);
+  if(n == 0) {
+    c->rxmit = 0;
+    ctimer_set(&c->rexmit_timer, REXMIT_TIME, rexmit, c);
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/** @} */
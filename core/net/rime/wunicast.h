@@ -0,0 +1,125 @@
+/**
+ * \addtogroup rime
+ * @{
+ */
+
+/**
+ * \defgroup rimewunicast Windowed reliable unicast
+ * @{
+ *
+ * The windowed reliable unicast primitive (wunicast) reliably sends a
+ * stream of packets to a single-hop neighbor. Unlike runicast, which
+ * waits for each packet to be acknowledged before the next one can be
+ * sent, wunicast keeps up to WUNICAST_WINDOW packets in flight. Packets
+ * queued back to back go out in the same MAC burst.
+ *
+ * The receiver delivers packets in order, exactly once, holding back
+ * packets that arrive ahead of a lost one. Its acknowledgements carry
+ * the next packet it expects, and a bitmap of the packets after that
+ * which it already holds, so the sender only retransmits packets that
+ * are actually missing. Every data packet also carries the oldest
+ * packet the sender still has, and a count of the times it started
+ * over: when it gave up on the packets in flight, or turned to another
+ * receiver. A receiver that sees the count change starts over at the
+ * oldest packet, drops the packets it held, and reports the gap if it
+ * skipped any. Acknowledgements echo the count, so that one from before
+ * is not taken to acknowledge packets after.
+ *
+ * \section channels Channels
+ *
+ * The wunicast primitive uses 1 channel.
+ *
+ */
+
+/**
+ * \file
+ *         Windowed reliable unicast header file
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#ifndef __WUNICAST_H__
+#define __WUNICAST_H__
+
+#include "sys/ctimer.h"
+#include "net/rime/unicast.h"
+#include "net/queuebuf.h"
+
+/* Number of packets that can be unacknowledged at once, at most 8 */
+#ifdef WUNICAST_CONF_WINDOW
+#define WUNICAST_WINDOW WUNICAST_CONF_WINDOW
+#else
+#define WUNICAST_WINDOW 4
+#endif
+
+#if WUNICAST_WINDOW > 8
+#error "WUNICAST_CONF_WINDOW cannot be greater than 8"
+#endif
+
+/* enough to tell a window from the one before it; the rest of the
+   byte that carries the oldest packet counts restarts */
+#define WUNICAST_PACKET_ID_BITS 4
+
+#define WUNICAST_ATTRIBUTES  { PACKETBUF_ATTR_PACKET_TYPE, PACKETBUF_ATTR_BIT }, \
+                             { PACKETBUF_ATTR_PACKET_ID, PACKETBUF_ATTR_BIT * WUNICAST_PACKET_ID_BITS }, \
+                             UNICAST_ATTRIBUTES
+
+struct wunicast_conn;
+
+struct wunicast_callbacks {
+  /* A packet arrived, in order. It is in the packetbuf. */
+  void (* recv)(struct wunicast_conn *c, const rimeaddr_t *from, uint8_t seqno);
+  /* A packet was acknowledged. There is room for another one. */
+  void (* sent)(struct wunicast_conn *c, const rimeaddr_t *to, uint8_t retransmissions);
+  /* The receiver stopped answering. All unacknowledged packets are dropped. */
+  void (* timedout)(struct wunicast_conn *c, const rimeaddr_t *to, uint8_t retransmissions);
+  /* Packets from the sender were skipped, so the next one delivered does
+     not follow on from the last. */
+  void (* skipped)(struct wunicast_conn *c, const rimeaddr_t *from);
+};
+
+struct wunicast_conn {
+  struct unicast_conn c;
+  const struct wunicast_callbacks *u;
+
+  /* Sender: packets from snduna up to sndnxt are unacknowledged. Bit i
+     of sacked is set if snduna + 1 + i has been acknowledged. */
+  struct ctimer rexmit_timer;
+  struct queuebuf *sndbuf[WUNICAST_WINDOW];
+  rimeaddr_t receiver;
+  uint8_t snduna, sndnxt, sacked, sndrestarts;
+  uint8_t rxmit, max_rxmit;
+
+  /* Receiver: rcvnxt is the next packet to deliver. Bit i of rcvd is
+     set if rcvnxt + 1 + i is held in rcvbuf. */
+  struct ctimer ack_timer;
+  struct queuebuf *rcvbuf[WUNICAST_WINDOW];
+  rimeaddr_t sender;
+  uint8_t rcvnxt, rcvd, unacked, rcvrestarts;
+};
+
+void wunicast_open(struct wunicast_conn *c, uint16_t channel,
+                   const struct wunicast_callbacks *u);
+void wunicast_close(struct wunicast_conn *c);
+
+/**
+ * \brief Queue the packet in the packetbuf for sending
+ * \param c The connection
+ * \param receiver The neighbor to send it to
+ * \param max_retransmissions Times the oldest unacknowledged packet is
+ *        sent again before the receiver is considered gone
+ * \return Non-zero if the packet was queued, zero if the window is full,
+ *         packets to another receiver are still unacknowledged, or there
+ *         was no queuebuf to keep it in
+ */
+int wunicast_send(struct wunicast_conn *c, const rimeaddr_t *receiver,
+                  uint8_t max_retransmissions);
+
+/**
+ * \brief The number of packets that can be sent before the window is full
+ */
+uint8_t wunicast_window_free(struct wunicast_conn *c);
+
+#endif /* __WUNICAST_H__ */
+/** @} */
+/** @} */
@@ -0,0 +1,43 @@
+/**
+ * \file
+ *         Reporting for the subnet and pubsub microbenchmarks
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "bench.h"
+#include <stdio.h>
+
+unsigned long bench_ops;
+short bench_size;
+
+/**
+ * Print the per-operation cost of a benchmark run. Lines look like
+ *   bench: <name> size <n>: <ns> ns/op [<cycles> cycles/op] (...)
+ * so that results from several runs can be compared with a simple grep.
+ */
+void bench_print_report(const unit_test_t *utp) {
+  /* unsigned subtraction copes with a single wrap of the 16 bit clock */
+  rtimer_clock_t ticks = utp->end - utp->start;
+  unsigned long long ps;
+
+  if (utp->result == unit_test_failure) {
+    printf("bench: %s size %d: failed at %s:%u\n",
+        utp->descr, bench_size, utp->test_file, utp->exit_line);
+    return;
+  }
+
+  if (bench_ops == 0) {
+    return;
+  }
+
+  /* in picoseconds, since a fast operation on native takes only a few ns */
+  ps = (unsigned long long) ticks * 1000000000000ULL / RTIMER_SECOND / bench_ops;
+  printf("bench: %s size %d: %lu.%lu ns/op", utp->descr, bench_size,
+      (unsigned long) (ps / 1000), (unsigned long) (ps % 1000 / 100));
+#ifdef F_CPU
+  printf(" %lu cycles/op",
+      (unsigned long) ((unsigned long long) ticks * F_CPU / RTIMER_SECOND / bench_ops));
+#endif
+  printf(" (%u ticks, %lu ops)\n", ticks, bench_ops);
+}
@@ -0,0 +1,49 @@
+/**
+ * \file
+ *         Helpers for the subnet and pubsub microbenchmarks
+ *
+ *         Each benchmark is a unit test (see apps/unit-test) whose body runs
+ *         an operation BENCH_ITERATIONS times. The report printed after the
+ *         test divides the elapsed rtimer ticks by the number of operations,
+ *         giving ns/op, and on platforms with a known CPU clock (F_CPU, as on
+ *         sky under mspsim) also cycles/op.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "contiki.h"
+
+#define UNIT_TEST_PRINT_FUNCTION bench_print_report
+#include "unit-test.h"
+
+#ifdef BENCH_CONF_ITERATIONS
+#define BENCH_ITERATIONS BENCH_CONF_ITERATIONS
+#elif CONTIKI_TARGET_NATIVE
+/* rtimer ticks are milliseconds on native, so run long enough to measure */
+#define BENCH_ITERATIONS 5000000UL
+#else
+/* rtimer_clock_t is 16 bits, so a run must finish within one wrap */
+#define BENCH_ITERATIONS 100UL
+#endif
+
+/* operations done in the last benchmark run, and the table size it used */
+extern unsigned long bench_ops;
+extern short bench_size;
+
+void bench_print_report(const unit_test_t *utp);
+
+/**
+ * \brief Run BLOCK BENCH_ITERATIONS times, each run doing OPS operations
+ */
+#define BENCH_LOOP(OPS, BLOCK) do {                                 \
+    unsigned long benchi;                                           \
+    for (benchi = 0; benchi < BENCH_ITERATIONS; benchi++) {         \
+      BLOCK                                                         \
+    }                                                               \
+    bench_ops = BENCH_ITERATIONS * (OPS);                           \
+  } while(0)
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,163 @@
+/**
+ * \file
+ *         Microbenchmark for the bit-optimized chameleon header codecs
+ *
+ *         Compares walking the attribute list with set_bits() and get_bits()
+ *         to following the plan compiled for it, for the attribute lists of
+ *         broadcast, collect and subnet. chameleon-bitopt.c is included
+ *         rather than linked so that both codecs can be called directly. The
+ *         size is the number of attributes in the list.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "bench.h"
+#include "net/rime/chameleon-bitopt.c"
+#include "net/rime/collect.h"
+#include "../subnet.h"
+#include <stdio.h>
+#include <stdlib.h>
+/*---------------------------------------------------------------------------*/
+UNIT_TEST_REGISTER(pack_walk, "pack walk");
+UNIT_TEST_REGISTER(pack_plan, "pack plan");
+UNIT_TEST_REGISTER(unpack_walk, "unpack walk");
+UNIT_TEST_REGISTER(unpack_plan, "unpack plan");
+
+static const struct packetbuf_attrlist broadcast_attributes[] = {
+  BROADCAST_ATTRIBUTES
+  PACKETBUF_ATTR_LAST
+};
+static const struct packetbuf_attrlist collect_attributes[] = {
+  COLLECT_ATTRIBUTES
+  PACKETBUF_ATTR_LAST
+};
+static const struct packetbuf_attrlist subnet_attributes[] = {
+  SUBNET_ATTRIBUTES
+  PACKETBUF_ATTR_LAST
+};
+static const struct {
+  const char *name;
+  const struct packetbuf_attrlist *attrlist;
+} lists[] = {
+  { "broadcast", broadcast_attributes },
+  { "collect", collect_attributes },
+  { "subnet", subnet_attributes },
+};
+#define LISTS (sizeof(lists) / sizeof(lists[0]))
+
+static const struct packetbuf_attrlist *attrlist;
+static const struct bitopt_plan *plan;
+static uint8_t walked[PACKETBUF_HDR_SIZE];
+static uint8_t planned[PACKETBUF_HDR_SIZE];
+static int hdrbytes;
+static packetbuf_attr_t values[PACKETBUF_NUM_ATTRS];
+static rimeaddr_t addrs[PACKETBUF_NUM_ADDRS];
+/*---------------------------------------------------------------------------*/
+/* sets every attribute in the list to a value that fits its field */
+static void set_values(void) {
+  const struct packetbuf_attrlist *a;
+  int i;
+
+  packetbuf_clear();
+  for (a = attrlist, i = 1; a->type != PACKETBUF_ATTR_NONE; ++a, ++i) {
+    if (PACKETBUF_IS_ADDR(a->type)) {
+      addrs[a->type - PACKETBUF_ADDR_FIRST].u8[0] = 0x40 + i;
+      addrs[a->type - PACKETBUF_ADDR_FIRST].u8[1] = 0x80 + i;
+      packetbuf_set_addr(a->type, &addrs[a->type - PACKETBUF_ADDR_FIRST]);
+    } else {
+      values[a->type] = (0xa5c3 + i) & ((1UL << (a->len < 16 ? a->len : 16)) - 1);
+      packetbuf_set_attr(a->type, values[a->type]);
+    }
+  }
+}
+/* whether the packetbuf holds what set_values() put there */
+static bool has_values(void) {
+  const struct packetbuf_attrlist *a;
+
+  for (a = attrlist; a->type != PACKETBUF_ATTR_NONE; ++a) {
+    if (PACKETBUF_IS_ADDR(a->type)) {
+      if (!rimeaddr_cmp(packetbuf_addr(a->type), &addrs[a->type - PACKETBUF_ADDR_FIRST])) {
+        return false;
+      }
+    } else if (packetbuf_attr(a->type) != values[a->type]) {
+      return false;
+    }
+  }
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+UNIT_TEST(pack_walk) {
+  UNIT_TEST_BEGIN();
+  BENCH_LOOP(1,
+    memset(walked, 0, hdrbytes);
+    pack_walk(attrlist, walked);
+  );
+  UNIT_TEST_END();
+}
+UNIT_TEST(pack_plan) {
+  UNIT_TEST_BEGIN();
+  BENCH_LOOP(1,
+    memset(planned, 0, hdrbytes);
+    pack_planned(plan, planned);
+  );
+  /* both codecs have to put every attribute in the same place */
+  UNIT_TEST_ASSERT(memcmp(walked, planned, hdrbytes) == 0);
+  UNIT_TEST_END();
+}
+UNIT_TEST(unpack_walk) {
+  UNIT_TEST_BEGIN();
+  packetbuf_clear();
+  BENCH_LOOP(1,
+    unpack_walk(attrlist, walked);
+  );
+  UNIT_TEST_ASSERT(has_values());
+  UNIT_TEST_END();
+}
+UNIT_TEST(unpack_plan) {
+  UNIT_TEST_BEGIN();
+  packetbuf_clear();
+  BENCH_LOOP(1,
+    unpack_planned(plan, planned);
+  );
+  UNIT_TEST_ASSERT(has_values());
+  UNIT_TEST_END();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS(chameleon_bench_process, "Chameleon benchmarks");
+AUTOSTART_PROCESSES(&chameleon_bench_process);
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(chameleon_bench_process, ev, data)
+{
+  const struct packetbuf_attrlist *a;
+  uint8_t i;
+  int bits;
+
+  PROCESS_BEGIN();
+
+  printf("bench: %lu iterations per run\n", BENCH_ITERATIONS);
+
+  for (i = 0; i < LISTS; i++) {
+    attrlist = lists[i].attrlist;
+    bits = header_size(attrlist);
+    hdrbytes = bits / 8 + ((bits & 7) == 0 ? 0 : 1);
+    plan = find_plan(attrlist);
+    for (bench_size = 0, a = attrlist; a->type != PACKETBUF_ATTR_NONE; ++a) {
+      bench_size++;
+    }
+    printf("bench: %s attributes, %d bits\n", lists[i].name, bits);
+
+    set_values();
+    UNIT_TEST_RUN(pack_walk);
+    UNIT_TEST_RUN(pack_plan);
+    UNIT_TEST_RUN(unpack_walk);
+    UNIT_TEST_RUN(unpack_plan);
+  }
+
+  printf("bench: done\n");
+#if CONTIKI_TARGET_NATIVE
+  exit(0);
+#endif
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
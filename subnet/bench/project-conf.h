@@ -0,0 +1,9 @@
+#include "../project-conf.h"
+
+/* benchmarks should measure the code, not the flash */
+#undef SUBNET_CONF_CHECKPOINT
+#define SUBNET_CONF_CHECKPOINT 0
+
+/* counting is part of the hot paths being measured */
+#undef SUBNET_CONF_COUNTERS
+#define SUBNET_CONF_COUNTERS 1
@@ -0,0 +1,94 @@
+/**
+ * \file
+ *         Microbenchmark for publishing a reading through pubsub
+ *
+ *         pubsub.c is included rather than linked so that subscriptions can
+ *         be handed to it directly instead of arriving over the radio. The
+ *         size is the number of subscriptions the reading matches, spread
+ *         over all sinks.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "bench.h"
+#include "../pubsub.c"
+#include "lib/publisher.h"
+#include <stdio.h>
+#include <stdlib.h>
+/*---------------------------------------------------------------------------*/
+#define MAX_BENCH_SUBSCRIPTIONS 8
+
+UNIT_TEST_REGISTER(publish, "publisher_publish");
+
+static uint16_t reading = 0x2a;
+/*---------------------------------------------------------------------------*/
+static bool bench_soft_filter(struct sfilter *f, short sink, subid_t subid, enum reading_type t, void *data) {
+  return false;
+}
+/* empties every sink's buffer, so that publishes never fill a packet */
+static void clear_sinks(void) {
+  short i;
+  for (i = 0; i < state.c.numsinks; i++) {
+    state.c.sinks[i].fragments = 0;
+    state.c.sinks[i].buflen = 0;
+  }
+}
+static void add_subscription(short i) {
+  struct subscription s;
+
+  memset(&s, 0, sizeof(struct subscription));
+  s.interval = 60 * CLOCK_SECOND;
+  s.sensor = READING_HUMIDITY;
+  s.priority = SUBNET_PRIORITY_BULK;
+  on_subscribe(&state.c, i % SUBNET_MAX_SINKS, i / SUBNET_MAX_SINKS, &s);
+}
+/*---------------------------------------------------------------------------*/
+UNIT_TEST(publish) {
+  UNIT_TEST_BEGIN();
+  /* includes emptying the sink buffers after each publish */
+  BENCH_LOOP(1,
+    publisher_publish(READING_HUMIDITY, &reading);
+    clear_sinks();
+  );
+#if SUBNET_COUNTERS
+  UNIT_TEST_ASSERT(state.counters.subscriptions == bench_size);
+#endif
+  UNIT_TEST_END();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS(pubsub_bench_process, "Pubsub benchmarks");
+AUTOSTART_PROCESSES(&pubsub_bench_process);
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(pubsub_bench_process, ev, data)
+{
+  short i;
+
+  PROCESS_BEGIN();
+
+  publisher_start(bench_soft_filter, NULL, NULL, 60 * CLOCK_SECOND);
+  publisher_has(READING_HUMIDITY, sizeof(reading));
+
+  /* readings are only added for sinks that subnet knows about */
+  state.c.numsinks = SUBNET_MAX_SINKS;
+  for (i = 0; i < SUBNET_MAX_SINKS; i++) {
+    memset(&state.c.sinks[i], 0, sizeof(struct sink));
+    state.c.sinks[i].sink.u8[0] = 200 + i;
+  }
+
+  printf("bench: %lu iterations per run\n", BENCH_ITERATIONS);
+
+  i = 0;
+  for (bench_size = 1; bench_size <= MAX_BENCH_SUBSCRIPTIONS; bench_size *= 2) {
+    for (; i < bench_size; i++) {
+      add_subscription(i);
+    }
+    UNIT_TEST_RUN(publish);
+  }
+
+  printf("bench: done\n");
+#if CONTIKI_TARGET_NATIVE
+  exit(0);
+#endif
+
+  PROCESS_END();
+}
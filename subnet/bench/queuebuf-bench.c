@@ -0,0 +1,205 @@
+/**
+ * \file
+ *         Microbenchmark for compact queuebufs
+ *
+ *         Queues packets with the attributes CSMA leaves on a unicast,
+ *         and measures the cost of queueing, restoring and freeing one, and
+ *         how many fit in the RAM that eight fixed size queuebufs take.
+ *         Packets that do not fit are swapped to CFS, and the swap test
+ *         counts the reads and writes a deep FIFO queue costs. queuebuf.c is
+ *         included rather than linked so that it can be built with
+ *         QUEUEBUF_CONF_COMPACT and swapping. The size is the packet length.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "bench.h"
+
+#define FIXED_QUEUEBUFS 8
+#define QUEUEBUF_CONF_COMPACT 1
+#define QUEUEBUF_CONF_POOL_SIZE (FIXED_QUEUEBUFS * sizeof(struct queuebuf_data))
+#undef QUEUEBUF_CONF_NUM
+#define QUEUEBUF_CONF_NUM 64
+#undef QUEUEBUFRAM_CONF_NUM
+#define QUEUEBUFRAM_CONF_NUM FIXED_QUEUEBUFS
+
+/* count the swap file operations queuebuf.c does */
+#include "cfs/cfs.h"
+static unsigned swap_reads, swap_writes;
+static int counted_read(int fd, void *buf, unsigned int len) {
+  swap_reads++;
+  return cfs_read(fd, buf, len);
+}
+static int counted_write(int fd, const void *buf, unsigned int len) {
+  swap_writes++;
+  return cfs_write(fd, buf, len);
+}
+#define cfs_read counted_read
+#define cfs_write counted_write
+#include "net/queuebuf.c"
+#undef cfs_read
+#undef cfs_write
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+/*---------------------------------------------------------------------------*/
+UNIT_TEST_REGISTER(roundtrip, "queue restore free");
+UNIT_TEST_REGISTER(capacity, "capacity");
+UNIT_TEST_REGISTER(swap, "swap");
+
+static const uint16_t sizes[] = { 16, 48, 96 };
+#define SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint8_t payload[PACKETBUF_SIZE];
+static rimeaddr_t receiver = { { 0x12, 0x34 } };
+static rimeaddr_t sender = { { 0x56, 0x78 } };
+/*---------------------------------------------------------------------------*/
+static void set_packet(uint16_t len) {
+  packetbuf_copyfrom(payload, len);
+  packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &receiver);
+  packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &sender);
+  packetbuf_set_attr(PACKETBUF_ATTR_RELIABLE, 1);
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_ID, 0x2a);
+  packetbuf_set_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS, 3);
+  packetbuf_set_attr(PACKETBUF_ATTR_MAC_SEQNO, 0x9c);
+}
+/* whether the packetbuf holds what set_packet() put there */
+static bool has_packet(uint16_t len) {
+  return packetbuf_datalen() == len &&
+    memcmp(packetbuf_dataptr(), payload, len) == 0 &&
+    rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &receiver) &&
+    rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_SENDER), &sender) &&
+    packetbuf_attr(PACKETBUF_ATTR_RELIABLE) == 1 &&
+    packetbuf_attr(PACKETBUF_ATTR_PACKET_ID) == 0x2a &&
+    packetbuf_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS) == 3 &&
+    packetbuf_attr(PACKETBUF_ATTR_MAC_SEQNO) == 0x9c &&
+    packetbuf_attr(PACKETBUF_ATTR_NETWORK_ID) == 0 &&
+    rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_ESENDER), &rimeaddr_null);
+}
+/*---------------------------------------------------------------------------*/
+UNIT_TEST(roundtrip) {
+  struct queuebuf *q;
+
+  UNIT_TEST_BEGIN();
+  BENCH_LOOP(1,
+    set_packet(bench_size);
+    q = queuebuf_new_from_packetbuf();
+    packetbuf_clear();
+    queuebuf_to_packetbuf(q);
+    queuebuf_free(q);
+  );
+  UNIT_TEST_ASSERT(has_packet(bench_size));
+  UNIT_TEST_ASSERT(pool_used == 0);
+  UNIT_TEST_END();
+}
+UNIT_TEST(capacity) {
+  static struct queuebuf *q[QUEUEBUF_NUM];
+  uint8_t n, i;
+
+  UNIT_TEST_BEGIN();
+  set_packet(bench_size);
+  /* stop at the first packet that has to be swapped */
+  for (n = 0; n < QUEUEBUF_NUM; n++) {
+    q[n] = queuebuf_new_from_packetbuf();
+    if (q[n] == NULL || !IN_POOL(q[n])) {
+      queuebuf_free(q[n]);
+      break;
+    }
+  }
+  printf("bench: %d byte packets: %d fit where %d did\n",
+      bench_size, n, FIXED_QUEUEBUFS);
+
+  /* free every other one, so that the rest have to be moved down */
+  for (i = 0; i < n; i += 2) {
+    queuebuf_free(q[i]);
+  }
+  for (i = 1; i < n; i += 2) {
+    packetbuf_clear();
+    queuebuf_to_packetbuf(q[i]);
+    UNIT_TEST_ASSERT(has_packet(bench_size));
+    UNIT_TEST_ASSERT(queuebuf_attr(q[i], PACKETBUF_ATTR_MAC_SEQNO) == 0x9c);
+    UNIT_TEST_ASSERT(rimeaddr_cmp(queuebuf_addr(q[i], PACKETBUF_ADDR_RECEIVER), &receiver));
+    queuebuf_free(q[i]);
+  }
+  UNIT_TEST_ASSERT(pool_used == 0);
+  UNIT_TEST_ASSERT(bench_size > PACKETBUF_SIZE / 2 || n >= 2 * FIXED_QUEUEBUFS);
+  bench_ops = 0;
+  UNIT_TEST_END();
+}
+UNIT_TEST(swap) {
+  static struct queuebuf *q[QUEUEBUF_NUM];
+  unsigned swapped = 0;
+  uint8_t i;
+
+  UNIT_TEST_BEGIN();
+  swap_reads = swap_writes = 0;
+  for (i = 0; i < QUEUEBUF_NUM; i++) {
+    set_packet(bench_size);
+    packetbuf_set_attr(PACKETBUF_ATTR_MAC_SEQNO, 0);
+    packetbuf_set_attr(PACKETBUF_ATTR_EPACKET_ID, i + 1);
+    q[i] = queuebuf_new_from_packetbuf();
+    UNIT_TEST_ASSERT(q[i] != NULL);
+    swapped += !IN_POOL(q[i]);
+  }
+
+  /* the way CSMA sends its queue: restore, update, restore again, free */
+  for (i = 0; i < QUEUEBUF_NUM; i++) {
+    queuebuf_to_packetbuf(q[i]);
+    packetbuf_set_attr(PACKETBUF_ATTR_MAC_SEQNO, 0x9c);
+    queuebuf_update_attr_from_packetbuf(q[i]);
+    packetbuf_clear();
+    queuebuf_to_packetbuf(q[i]);
+    UNIT_TEST_ASSERT(packetbuf_attr(PACKETBUF_ATTR_EPACKET_ID) == i + 1);
+    packetbuf_set_attr(PACKETBUF_ATTR_EPACKET_ID, 0);
+    UNIT_TEST_ASSERT(has_packet(bench_size));
+    queuebuf_free(q[i]);
+  }
+  UNIT_TEST_ASSERT(pool_used == 0);
+
+  printf("bench: %d byte packets: %u swapped, %u writes, %u reads\n",
+      bench_size, swapped, swap_writes, swap_reads);
+  bench_ops = 0;
+  UNIT_TEST_END();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS(queuebuf_bench_process, "Queuebuf benchmarks");
+AUTOSTART_PROCESSES(&queuebuf_bench_process);
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(queuebuf_bench_process, ev, data)
+{
+  uint16_t i;
+
+  PROCESS_BEGIN();
+
+  printf("bench: %lu iterations per run\n", BENCH_ITERATIONS);
+  printf("bench: %d byte pool, %d bytes per fixed queuebuf\n",
+      (int) QUEUEBUF_POOL_SIZE, (int) sizeof(struct queuebuf_data));
+
+  for (i = 0; i < sizeof(payload); i++) {
+    payload[i] = i * 7;
+  }
+
+  queuebuf_init();
+  for (i = 0; i < SIZES; i++) {
+    bench_size = sizes[i];
+    UNIT_TEST_RUN(roundtrip);
+    UNIT_TEST_RUN(capacity);
+    UNIT_TEST_RUN(swap);
+  }
+
+  /* the swap files queuebuf_init() created */
+  for (i = 0; i < NQBUF_FILES; i++) {
+    char name[2] = { 'a' + i, '\0' };
+    cfs_close(qbuf_files[i].fd);
+    cfs_remove(name);
+  }
+
+  printf("bench: done\n");
+#if CONTIKI_TARGET_NATIVE
+  exit(0);
+#endif
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
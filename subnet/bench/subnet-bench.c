@@ -0,0 +1,230 @@
+/**
+ * \file
+ *         Microbenchmarks for the subnet hot paths
+ *
+ *         The functions measured here are static, so subnet.c is included
+ *         rather than linked. Every benchmark is run at several table sizes;
+ *         the size is the number of fragments in a packet, alternate routes
+ *         to a sink or known sinks, depending on what the operation scans.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "bench.h"
+#include "../subnet.c"
+#include <stdio.h>
+#include <stdlib.h>
+/*---------------------------------------------------------------------------*/
+#define READING_SIZE 2
+#define MAX_BENCH_FRAGMENTS 16 /* 16 * (2 + READING_SIZE) fits in a packet */
+
+UNIT_TEST_REGISTER(inject, "inject_packetbuf");
+UNIT_TEST_REGISTER(iterate, "EACH_FRAGMENT");
+UNIT_TEST_REGISTER(nexthop, "get_next_hop");
+UNIT_TEST_REGISTER(routes, "update_routes");
+UNIT_TEST_REGISTER(recv_ask, "on_recv ASK");
+
+static void bench_ondata(struct subnet_conn *c, short sinkid, subid_t subid, void *data);
+static enum existance bench_exists(struct subnet_conn *c, short sinkid, subid_t subid);
+static const struct subnet_callbacks bench_callbacks = {
+  NULL,
+  bench_ondata,
+  NULL,
+  NULL,
+  bench_exists,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+static struct subnet_conn bc;
+static char buf[PACKETBUF_SIZE];
+static dlen_t buflen;
+static uint16_t reading = 0x2a;
+static unsigned long checksum; /* keeps loops from being optimized away */
+static rimeaddr_t sinks[SUBNET_MAX_SINKS];
+static rimeaddr_t hops[SUBNET_MAX_ALTERNATE_ROUTES];
+static struct queuebuf *heard;
+/*---------------------------------------------------------------------------*/
+static void bench_ondata(struct subnet_conn *c, short sinkid, subid_t subid, void *data) {
+  /* readings for unknown subscriptions never get here */
+}
+static enum existance bench_exists(struct subnet_conn *c, short sinkid, subid_t subid) {
+  /* worst case: every subscription needs to be asked for */
+  return UNKNOWN;
+}
+/* writes bench_size fragments to buf */
+static void fill_buffer(void) {
+  uint8_t fragments = 0;
+  subid_t subid;
+
+  buflen = 0;
+  for (subid = 0; subid < bench_size; subid++) {
+    inject_packetbuf(subid, READING_SIZE, &fragments, &buflen, &reading, buf + buflen);
+  }
+}
+/* learns every alternate route to the first bench_size sinks through
+ * update_routes, the way they would be learned from subscriptions */
+static void fill_routes(void) {
+  short s, h;
+
+  bc.numsinks = 0;
+  bc.numneighbors = 0;
+  packetbuf_clear();
+  packetbuf_set_attr(PACKETBUF_ATTR_HOPS, 1);
+  for (s = 0; s < bench_size; s++) {
+    for (h = 0; h < SUBNET_MAX_ALTERNATE_ROUTES; h++) {
+      update_routes(&bc, &sinks[s], &hops[h]);
+    }
+  }
+}
+/* puts a publish packet with bench_size fragments for the first sink in heard,
+ * as received by us as next hop */
+static void fill_heard(void) {
+  fill_buffer();
+  prepare_packetbuf(&bc, SUBNET_PACKET_TYPE_PUBLISH, &sinks[0], 1);
+  memcpy(packetbuf_dataptr(), buf, buflen);
+  packetbuf_set_datalen(buflen);
+  packetbuf_set_attr(PACKETBUF_ATTR_EFRAGMENTS, bench_size);
+
+  if (heard != NULL) {
+    queuebuf_free(heard);
+  }
+  heard = queuebuf_new_from_packetbuf();
+}
+/*---------------------------------------------------------------------------*/
+UNIT_TEST(inject) {
+  uint8_t fragments = 0;
+  subid_t subid;
+
+  UNIT_TEST_BEGIN();
+  BENCH_LOOP(bench_size,
+    fragments = 0;
+    buflen = 0;
+    for (subid = 0; subid < bench_size; subid++) {
+      inject_packetbuf(subid, READING_SIZE, &fragments, &buflen, &reading, buf + buflen);
+    }
+  );
+  UNIT_TEST_ASSERT(fragments == bench_size);
+  UNIT_TEST_END();
+}
+UNIT_TEST(iterate) {
+  UNIT_TEST_BEGIN();
+  BENCH_LOOP(bench_size,
+    EACH_FRAGMENT(bench_size, buf,
+      checksum += subid;
+    );
+  );
+  UNIT_TEST_END();
+}
+UNIT_TEST(nexthop) {
+  const rimeaddr_t *next = NULL;
+
+  UNIT_TEST_BEGIN();
+  BENCH_LOOP(1,
+    next = get_next_hop(&bc, &bc.sinks[0], NULL, NULL);
+  );
+  UNIT_TEST_ASSERT(next != NULL);
+  UNIT_TEST_END();
+}
+UNIT_TEST(routes) {
+  UNIT_TEST_BEGIN();
+  /* refreshing a known route is what nearly every subscribe packet does */
+  BENCH_LOOP(1,
+    update_routes(&bc, &sinks[bench_size - 1], &hops[SUBNET_MAX_ALTERNATE_ROUTES - 1]);
+  );
+  UNIT_TEST_ASSERT(bc.numsinks == bench_size);
+  UNIT_TEST_END();
+}
+UNIT_TEST(recv_ask) {
+  const struct peer_packet *p;
+
+  UNIT_TEST_BEGIN();
+  /* includes restoring the received packet to the packetbuf */
+  BENCH_LOOP(1,
+    queuebuf_to_packetbuf(heard);
+    on_recv(&bc.pubsub, &hops[0]);
+    if (bc.queued > 0) {
+      dequeue(&bc, 0);
+    }
+  );
+
+  /* the sender is asked, on the peer connection, about every subscription */
+  queuebuf_to_packetbuf(heard);
+  on_recv(&bc.pubsub, &hops[0]);
+  UNIT_TEST_ASSERT(bc.queued == 1);
+  UNIT_TEST_ASSERT(bc.queue[0].via == &bc.peer);
+  UNIT_TEST_ASSERT(rimeaddr_cmp(&bc.queue[0].to, &hops[0]));
+  p = (const struct peer_packet *) queuebuf_dataptr(bc.queue[0].packet);
+  UNIT_TEST_ASSERT(p->unknown == bench_size && p->revoked == 0);
+  dequeue(&bc, 0);
+  UNIT_TEST_END();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS(subnet_bench_process, "Subnet benchmarks");
+AUTOSTART_PROCESSES(&subnet_bench_process);
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(subnet_bench_process, ev, data)
+{
+  short i;
+
+  PROCESS_BEGIN();
+
+  subnet_open(&bc, 14159, 26535, &bench_callbacks);
+  for (i = 0; i < SUBNET_MAX_SINKS; i++) {
+    sinks[i].u8[0] = 200 + i;
+    sinks[i].u8[1] = 0;
+  }
+  for (i = 0; i < SUBNET_MAX_ALTERNATE_ROUTES; i++) {
+    hops[i].u8[0] = 100 + i;
+    hops[i].u8[1] = 0;
+  }
+
+  printf("bench: %lu iterations per run\n", BENCH_ITERATIONS);
+
+  for (bench_size = 1; bench_size <= MAX_BENCH_FRAGMENTS; bench_size *= 4) {
+    UNIT_TEST_RUN(inject);
+  }
+
+  for (bench_size = 1; bench_size <= MAX_BENCH_FRAGMENTS; bench_size *= 4) {
+    fill_buffer();
+    UNIT_TEST_RUN(iterate);
+  }
+
+  /* every next hop is equally costly, so all of them are compared in full */
+  for (bench_size = 1; bench_size <= SUBNET_MAX_ALTERNATE_ROUTES; bench_size++) {
+    bc.numsinks = 1;
+    bc.numneighbors = bench_size;
+    bc.sinks[0].revoked = 0;
+    bc.sinks[0].numhops = bench_size;
+    for (i = 0; i < bench_size; i++) {
+      rimeaddr_copy(&bc.neighbors[i].addr, &hops[i]);
+      bc.neighbors[i].last_active = 0;
+      bc.sinks[0].nexthops[i].node = &bc.neighbors[i];
+      bc.sinks[0].nexthops[i].cost = 2;
+    }
+    UNIT_TEST_RUN(nexthop);
+  }
+
+  for (bench_size = 1; bench_size <= SUBNET_MAX_SINKS; bench_size++) {
+    fill_routes();
+    UNIT_TEST_RUN(routes);
+  }
+
+  for (bench_size = 1; bench_size <= MAX_BENCH_FRAGMENTS; bench_size *= 4) {
+    fill_routes();
+    fill_heard();
+    UNIT_TEST_RUN(recv_ask);
+  }
+  ctimer_stop(&bc.flush);
+
+  printf("bench: done (checksum %lu)\n", checksum);
+#if CONTIKI_TARGET_NATIVE
+  exit(0);
+#endif
+
+  PROCESS_END();
+}
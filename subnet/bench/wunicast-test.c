@@ -0,0 +1,409 @@
+/**
+ * \file
+ *         Tests for windowed reliable unicast under loss, reordering and
+ *         timeouts
+ *
+ *         wunicast.c and rucb.c are included rather than linked, with
+ *         unicast_send() and the ctimers replaced, so that each frame on the
+ *         air between a sender and a receiver can be dropped or reordered
+ *         and each timer fired by hand. The size is the window.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "bench.h"
+#include "net/rime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* frames on the air, in the order they were sent */
+struct frame {
+  struct unicast_conn *to;
+  const rimeaddr_t *from;
+  uint8_t type, id;
+  uint16_t len;
+  uint8_t data[PACKETBUF_SIZE];
+};
+#define AIR_SIZE 16
+static struct frame air[AIR_SIZE];
+static uint8_t onair;
+
+/* the two ends, sender first */
+static struct unicast_conn *ends[2];
+static const rimeaddr_t addrs[2] = { { { 1, 0 } }, { { 2, 0 } } };
+
+static int fake_unicast_send(struct unicast_conn *c, const rimeaddr_t *receiver) {
+  struct frame *f = &air[onair];
+  uint8_t i = c == ends[0] ? 0 : 1;
+
+  if (onair == AIR_SIZE) {
+    return 0;
+  }
+  onair++;
+  f->to = ends[1 - i];
+  f->from = &addrs[i];
+  f->type = packetbuf_attr(PACKETBUF_ATTR_PACKET_TYPE);
+  f->id = packetbuf_attr(PACKETBUF_ATTR_PACKET_ID);
+  f->len = packetbuf_totlen();
+  memcpy(f->data, packetbuf_hdrptr(), f->len);
+  return 1;
+}
+static void fake_unicast_open(struct unicast_conn *c, uint16_t channel,
+    const struct unicast_callbacks *u) {
+}
+static void fake_unicast_close(struct unicast_conn *c) {
+}
+static void fake_channel_set_attributes(uint16_t channel,
+    const struct packetbuf_attrlist attrs[]) {
+}
+
+/* a timer is pending while its next pointer is set */
+static void fake_ctimer_set(struct ctimer *t, clock_time_t interval,
+    void (*f)(void *), void *ptr) {
+  t->next = t;
+  t->f = f;
+  t->ptr = ptr;
+}
+static void fake_ctimer_stop(struct ctimer *t) {
+  t->next = NULL;
+}
+static int fake_ctimer_expired(struct ctimer *t) {
+  return t->next == NULL;
+}
+
+#define unicast_send fake_unicast_send
+#define unicast_open fake_unicast_open
+#define unicast_close fake_unicast_close
+#define channel_set_attributes fake_channel_set_attributes
+#define ctimer_set fake_ctimer_set
+#define ctimer_stop fake_ctimer_stop
+#define ctimer_expired fake_ctimer_expired
+#include "net/rime/wunicast.c"
+#include "net/rime/rucb.c"
+#undef unicast_send
+#undef unicast_open
+#undef unicast_close
+#undef channel_set_attributes
+#undef ctimer_set
+#undef ctimer_stop
+#undef ctimer_expired
+/*---------------------------------------------------------------------------*/
+UNIT_TEST_REGISTER(inorder, "in order");
+UNIT_TEST_REGISTER(reorder, "loss and reordering");
+UNIT_TEST_REGISTER(timeout, "timeout");
+UNIT_TEST_REGISTER(file, "rucb after timeout");
+
+#define MAX_RXMIT 3
+
+static struct wunicast_conn snd, rcv;
+static uint8_t got[2 * AIR_SIZE];
+static uint8_t ngot, nsent, ntimedout, nskipped;
+/*---------------------------------------------------------------------------*/
+static void on_recv(struct wunicast_conn *c, const rimeaddr_t *from, uint8_t seqno) {
+  got[ngot++] = *(uint8_t *)packetbuf_dataptr();
+}
+static void on_sent(struct wunicast_conn *c, const rimeaddr_t *to, uint8_t retransmissions) {
+  nsent++;
+}
+static void on_timedout(struct wunicast_conn *c, const rimeaddr_t *to, uint8_t retransmissions) {
+  ntimedout++;
+}
+static void on_skipped(struct wunicast_conn *c, const rimeaddr_t *from) {
+  nskipped++;
+}
+static const struct wunicast_callbacks callbacks = {
+  on_recv, on_sent, on_timedout, on_skipped
+};
+/*---------------------------------------------------------------------------*/
+static void setup(struct wunicast_conn *s, struct wunicast_conn *r,
+    const struct wunicast_callbacks *u) {
+  onair = ngot = nsent = ntimedout = nskipped = 0;
+  ends[0] = &s->c;
+  ends[1] = &r->c;
+  wunicast_open(s, 0, u);
+  wunicast_open(r, 0, u);
+}
+static void teardown(struct wunicast_conn *s, struct wunicast_conn *r) {
+  wunicast_close(s);
+  wunicast_close(r);
+}
+/* queue a one byte packet */
+static bool send_one(uint8_t n) {
+  packetbuf_clear();
+  packetbuf_copyfrom(&n, 1);
+  return wunicast_send(&snd, &addrs[1], MAX_RXMIT);
+}
+/* hand the i:th frame on the air to its receiver, and take it off */
+static void transmit(uint8_t i) {
+  struct frame f = air[i];
+
+  memmove(&air[i], &air[i + 1], (onair - i - 1) * sizeof(air[0]));
+  onair--;
+  packetbuf_clear();
+  packetbuf_copyfrom(f.data, f.len);
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_TYPE, f.type);
+  packetbuf_set_attr(PACKETBUF_ATTR_PACKET_ID, f.id);
+  recv_from_unicast(f.to, f.from);
+}
+static void drop(uint8_t i) {
+  memmove(&air[i], &air[i + 1], (onair - i - 1) * sizeof(air[0]));
+  onair--;
+}
+static void fire(struct ctimer *t) {
+  if (t->next != NULL) {
+    t->next = NULL;
+    t->f(t->ptr);
+  }
+}
+/* deliver everything, acknowledgements included, until the air is quiet */
+static void settle(void) {
+  do {
+    while (onair > 0) {
+      transmit(0);
+    }
+    fire(&rcv.ack_timer);
+  } while (onair > 0);
+}
+/*---------------------------------------------------------------------------*/
+UNIT_TEST(inorder) {
+  uint8_t i;
+
+  UNIT_TEST_BEGIN();
+  setup(&snd, &rcv, &callbacks);
+  for (i = 0; i < WUNICAST_WINDOW; i++) {
+    UNIT_TEST_ASSERT(send_one(i));
+  }
+  UNIT_TEST_ASSERT(!send_one(i));
+  UNIT_TEST_ASSERT(onair == WUNICAST_WINDOW);
+
+  settle();
+  UNIT_TEST_ASSERT(ngot == WUNICAST_WINDOW);
+  for (i = 0; i < ngot; i++) {
+    UNIT_TEST_ASSERT(got[i] == i);
+  }
+  UNIT_TEST_ASSERT(nsent == WUNICAST_WINDOW);
+  UNIT_TEST_ASSERT(wunicast_window_free(&snd) == WUNICAST_WINDOW);
+  UNIT_TEST_ASSERT(ctimer_expired(&snd.rexmit_timer));
+  teardown(&snd, &rcv);
+  bench_ops = 0;
+  UNIT_TEST_END();
+}
+UNIT_TEST(reorder) {
+  uint8_t i;
+
+  UNIT_TEST_BEGIN();
+  setup(&snd, &rcv, &callbacks);
+  for (i = 0; i < WUNICAST_WINDOW; i++) {
+    UNIT_TEST_ASSERT(send_one(i));
+  }
+
+  /* the second packet is lost, the rest arrive last first */
+  drop(1);
+  while (onair > 0) {
+    transmit(onair - 1);
+  }
+  UNIT_TEST_ASSERT(ngot == 1);
+  settle();
+  UNIT_TEST_ASSERT(nsent == 1);
+
+  /* only the lost one is sent again */
+  fire(&snd.rexmit_timer);
+  UNIT_TEST_ASSERT(onair == 1);
+  settle();
+  UNIT_TEST_ASSERT(ngot == WUNICAST_WINDOW);
+  for (i = 0; i < ngot; i++) {
+    UNIT_TEST_ASSERT(got[i] == i);
+  }
+  UNIT_TEST_ASSERT(nsent == WUNICAST_WINDOW);
+
+  /* a duplicate is not delivered again */
+  UNIT_TEST_ASSERT(send_one(WUNICAST_WINDOW));
+  air[1] = air[0];
+  onair = 2;
+  settle();
+  UNIT_TEST_ASSERT(ngot == WUNICAST_WINDOW + 1);
+  UNIT_TEST_ASSERT(got[WUNICAST_WINDOW] == WUNICAST_WINDOW);
+  UNIT_TEST_ASSERT(nskipped == 0);
+  teardown(&snd, &rcv);
+  bench_ops = 0;
+  UNIT_TEST_END();
+}
+UNIT_TEST(timeout) {
+  struct frame ack;
+  uint8_t i, r, n = 0;
+
+  UNIT_TEST_BEGIN();
+  setup(&snd, &rcv, &callbacks);
+
+  /* go round the sequence numbers a few times first */
+  for (r = 0; r < 5; r++) {
+    for (i = 0; i < WUNICAST_WINDOW; i++) {
+      UNIT_TEST_ASSERT(send_one(n++));
+    }
+    settle();
+  }
+  UNIT_TEST_ASSERT(ngot == n);
+  ngot = nsent = 0;
+
+  /* the first packet never arrives, and no acknowledgement gets back */
+  for (i = 0; i < WUNICAST_WINDOW; i++) {
+    UNIT_TEST_ASSERT(send_one(n + i));
+  }
+  drop(0);
+  while (onair > 0) {
+    transmit(0);
+    if (onair > 0 && air[onair - 1].to == &snd.c) {
+      ack = air[onair - 1];
+      drop(onair - 1);
+    }
+  }
+  for (r = 0; r < MAX_RXMIT; r++) {
+    fire(&snd.rexmit_timer);
+    while (onair > 0) {
+      drop(0);
+    }
+  }
+  UNIT_TEST_ASSERT(ntimedout == 1);
+  UNIT_TEST_ASSERT(nsent == 0);
+  UNIT_TEST_ASSERT(wunicast_window_free(&snd) == WUNICAST_WINDOW);
+  UNIT_TEST_ASSERT(ngot == 0);
+  n += WUNICAST_WINDOW;
+
+  /* an acknowledgement from before the timeout acknowledges nothing */
+  UNIT_TEST_ASSERT(send_one(n));
+  drop(0);
+  air[onair++] = ack;
+  transmit(0);
+  UNIT_TEST_ASSERT(nsent == 0);
+  UNIT_TEST_ASSERT(wunicast_window_free(&snd) == WUNICAST_WINDOW - 1);
+
+  /* the receiver skips the gap without delivering what it held */
+  fire(&snd.rexmit_timer);
+  settle();
+  UNIT_TEST_ASSERT(nskipped == 1);
+  UNIT_TEST_ASSERT(ngot == 1);
+  UNIT_TEST_ASSERT(got[0] == n);
+  UNIT_TEST_ASSERT(nsent == 1);
+  n++;
+
+  /* and carries on from there */
+  for (i = 0; i < WUNICAST_WINDOW; i++) {
+    UNIT_TEST_ASSERT(send_one(n + i));
+  }
+  settle();
+  UNIT_TEST_ASSERT(ngot == 1 + WUNICAST_WINDOW);
+  for (i = 0; i < ngot; i++) {
+    UNIT_TEST_ASSERT(got[i] == n - 1 + i);
+  }
+  UNIT_TEST_ASSERT(nskipped == 1);
+  teardown(&snd, &rcv);
+  bench_ops = 0;
+  UNIT_TEST_END();
+}
+/*---------------------------------------------------------------------------*/
+static struct rucb_conn rsnd, rrcv;
+static char file[3 * RUCB_DATASIZE + RUCB_DATASIZE / 2];
+static char written[sizeof(file)];
+static uint8_t newfiles, lastchunks, broken;
+
+static void write_chunk(struct rucb_conn *c, int offset, int flag, char *data, int len) {
+  if (flag == RUCB_FLAG_NEWFILE) {
+    newfiles++;
+    memset(written, 0, sizeof(written));
+  } else if (flag == RUCB_FLAG_LASTCHUNK) {
+    lastchunks++;
+  }
+  if (offset + len <= sizeof(written)) {
+    memcpy(written + offset, data, len);
+  }
+}
+static int read_chunk(struct rucb_conn *c, int offset, char *to, int maxsize) {
+  int len = sizeof(file) - offset;
+  len = len < maxsize ? len : maxsize;
+  memcpy(to, file + offset, len);
+  return len;
+}
+static void file_timedout(struct rucb_conn *c) {
+  broken++;
+}
+static const struct rucb_callbacks rucb_callbacks = {
+  write_chunk, read_chunk, file_timedout
+};
+UNIT_TEST(file) {
+  uint8_t r;
+
+  UNIT_TEST_BEGIN();
+  newfiles = lastchunks = broken = 0;
+  onair = 0;
+  ends[0] = &rsnd.c.c;
+  ends[1] = &rrcv.c.c;
+  rucb_open(&rsnd, 0, &rucb_callbacks);
+  rucb_open(&rrcv, 0, &rucb_callbacks);
+
+  /* the second chunk is lost until the sender gives up */
+  rucb_send(&rsnd, &addrs[1]);
+  drop(1);
+  while (onair > 0) {
+    transmit(0);
+    while (onair > 0 && air[onair - 1].to == &rsnd.c.c) {
+      drop(onair - 1);
+    }
+  }
+  for (r = 0; r < MAX_TRANSMISSIONS; r++) {
+    fire(&rsnd.c.rexmit_timer);
+    while (onair > 0) {
+      drop(0);
+    }
+  }
+  UNIT_TEST_ASSERT(broken == 1);
+  UNIT_TEST_ASSERT(newfiles == 1);
+
+  /* sent again, the file is written from the start, and only once */
+  rucb_send(&rsnd, &addrs[1]);
+  while (onair > 0 || !ctimer_expired(&rrcv.c.ack_timer)) {
+    while (onair > 0) {
+      transmit(0);
+    }
+    fire(&rrcv.c.ack_timer);
+  }
+  UNIT_TEST_ASSERT(broken == 2);
+  UNIT_TEST_ASSERT(newfiles == 2);
+  UNIT_TEST_ASSERT(lastchunks == 1);
+  UNIT_TEST_ASSERT(memcmp(written, file, sizeof(file)) == 0);
+
+  rucb_close(&rsnd);
+  rucb_close(&rrcv);
+  bench_ops = 0;
+  UNIT_TEST_END();
+}
+/*---------------------------------------------------------------------------*/
+PROCESS(wunicast_test_process, "Windowed reliable unicast tests");
+AUTOSTART_PROCESSES(&wunicast_test_process);
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(wunicast_test_process, ev, data)
+{
+  uint16_t i;
+
+  PROCESS_BEGIN();
+
+  for (i = 0; i < sizeof(file); i++) {
+    file[i] = i * 7 + 1;
+  }
+
+  bench_size = WUNICAST_WINDOW;
+  UNIT_TEST_RUN(inorder);
+  UNIT_TEST_RUN(reorder);
+  UNIT_TEST_RUN(timeout);
+  UNIT_TEST_RUN(file);
+
+  printf("bench: done\n");
+#if CONTIKI_TARGET_NATIVE
+  exit(0);
+#endif
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
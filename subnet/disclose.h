@@ -15,6 +15,17 @@
  * callback functions depending on whether the address matches the address of
  * the node.
  *
+ * Since the MAC layer also looks at the receiver attribute, packets sent to a
+ * neighbor are link-layer unicasts: they are acknowledged, retransmitted by
+ * CSMA, and ContikiMAC can use phase optimization for them. Packets sent to
+ * rimeaddr_null are link-layer broadcasts. Other neighbors only overhear
+ * unicasts if neither the RDC nor the radio filters frames on their
+ * destination address, so the hear callback must not be relied upon for
+ * anything but broadcasts. nullrdc filters unless NULLRDC_CONF_ADDRESS_FILTER
+ * is 0; ContikiMAC does not filter, but the CC2420 does whenever
+ * CC2420_CONF_AUTOACK is set, since it needs address decoding for hardware
+ * acks, and ContikiMAC's ack window is too short for acks in software.
+ *
  * \section channels Channels
  *
  * The disclose module uses 1 channel.
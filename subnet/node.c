@@ -9,12 +9,17 @@
 #include "contiki.h"
 #include "lib/publisher.h"
 #include "lib/random.h"
+#include "lib/fft.h"
 #include "dev/serial-line.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 /*---------------------------------------------------------------------------*/
 #define AVG_WINDOW 10
+/* samples in each window of vibration that is turned into a spectrum */
+#define VIBRATION_WINDOW 128
+#define TWO_PI 6.28318530718
 struct location node_location;
 /*---------------------------------------------------------------------------*/
 PROCESS(node_process, "Node");
@@ -35,7 +40,70 @@ static pressure *get_pressure() {
   printf("sense: pressure @ <%03d, %03d> = %d\n", p.location.x, p.location.y, p.value);
   return &p;
 }
-bool soft_filter_proxy(struct sfilter *f, enum reading_type t, void *data);
+static vibration *get_vibration() {
+  static vibration v;
+  static int16_t samples[VIBRATION_WINDOW];
+  uint32_t energy[SPECTRUM_BANDS];
+  uint8_t exp, i;
+  /* a machine turning at a speed given by where it is, that wanders a bit */
+  double f = 4 + (node_location.x + node_location.y) % 40 + random_rand() % 3;
+
+  for (i = 0; i < VIBRATION_WINDOW; i++) {
+    samples[i] = 8000 * sin(TWO_PI * f * i / VIBRATION_WINDOW);
+    samples[i] += (int16_t)(random_rand() % 2001) - 1000;
+  }
+
+  fft_hann(samples, VIBRATION_WINDOW);
+  exp = fft_real(samples, VIBRATION_WINDOW);
+  v.peak = fft_bands(samples, VIBRATION_WINDOW, energy, SPECTRUM_BANDS);
+  for (i = 0; i < SPECTRUM_BANDS; i++) {
+    v.bands[i] = fft_level(energy[i], exp);
+  }
+
+  v.location.x = node_location.x;
+  v.location.y = node_location.y;
+  printf("sense: vibration @ <%03d, %03d> = %d\n", v.location.x, v.location.y, v.peak);
+  return &v;
+}
+static dlen_t reading_size(enum reading_type t) {
+  switch (t) {
+    case READING_VIBRATION:
+      return sizeof(vibration);
+    default:
+      return sizeof(struct locshort);
+  }
+}
+/* whether a spectrum is too close to the last one published for the same
+ * subscription to be worth sending */
+static bool spectrum_unchanged(short sink, subid_t subid, const vibration *v, short change) {
+  static struct {
+    bool published;
+    unsigned char peak;
+    unsigned char bands[SPECTRUM_BANDS];
+  } last[SUBNET_MAX_SINKS][PUBSUB_MAX_SUBSCRIPTIONS];
+  uint8_t i;
+
+  if (sink < 0 || sink >= SUBNET_MAX_SINKS || subid >= PUBSUB_MAX_SUBSCRIPTIONS) {
+    return false;
+  }
+
+  if (last[sink][subid].published && v->peak == last[sink][subid].peak) {
+    for (i = 0; i < SPECTRUM_BANDS; i++) {
+      if (abs(v->bands[i] - last[sink][subid].bands[i]) >= change) {
+        break;
+      }
+    }
+    if (i == SPECTRUM_BANDS) {
+      return true;
+    }
+  }
+
+  last[sink][subid].published = true;
+  last[sink][subid].peak = v->peak;
+  memcpy(last[sink][subid].bands, v->bands, SPECTRUM_BANDS);
+  return false;
+}
+bool soft_filter_proxy(struct sfilter *f, short sink, subid_t subid, enum reading_type t, void *data);
 bool hard_filter_proxy(struct hfilter *f);
 void aggregator_proxy(struct aggregator *a, short sink, subid_t subid, uint8_t items, void *datas[]);
 /*---------------------------------------------------------------------------*/
@@ -61,10 +129,15 @@ PROCESS_THREAD(node_process, ev, data)
 
   // Initialize publisher
   publisher_start(&soft_filter_proxy, &hard_filter_proxy, &aggregator_proxy, 5*CLOCK_SECOND);
+  {
+    struct position p = { node_location.x, node_location.y };
+    pubsub_locate(&p);
+  }
 
   // Dynamic properties
   publisher_has(READING_HUMIDITY, sizeof(humidity));
   publisher_has(READING_PRESSURE, sizeof(pressure));
+  publisher_has(READING_VIBRATION, sizeof(vibration));
 
   while(1) {
     // When data is needed, read and publish
@@ -80,18 +153,30 @@ PROCESS_THREAD(node_process, ev, data)
     if (publisher_needs(READING_PRESSURE)) {
       publisher_publish(READING_PRESSURE, get_pressure());
     }
+
+    // Vibration is only ever published as a spectrum
+    if (publisher_needs(READING_VIBRATION)) {
+      publisher_publish(READING_VIBRATION, get_vibration());
+    }
   }
 
   PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
 /* proxy callbacks */
-bool soft_filter_proxy(struct sfilter *f, enum reading_type t, void *data) {
+bool soft_filter_proxy(struct sfilter *f, short sink, subid_t subid, enum reading_type t, void *data) {
   static short prevs[PUBSUB_MAX_SENSORS][AVG_WINDOW];
   static uint8_t num[PUBSUB_MAX_SENSORS];
   static uint8_t old[PUBSUB_MAX_SENSORS];
   struct locshort *l = (struct locshort *) data;
-  switch (f->filter) {
+  enum soft_filter filter = f->filter;
+
+  /* spectra have no single value to deviate */
+  if (t == READING_VIBRATION && filter == DEVIATION) {
+    filter = NO_SOFT_FILTER;
+  }
+
+  switch (filter) {
     case DEVIATION:
     {
       uint8_t i;
@@ -114,6 +199,11 @@ bool soft_filter_proxy(struct sfilter *f, enum reading_type t, void *data) {
       }
       /* fall-through */
     }
+    case SPECTRAL_CHANGE:
+      if (t == READING_VIBRATION && spectrum_unchanged(sink, subid, (vibration *) data, f->arg.spectral)) {
+        return true;
+      }
+      /* fall-through */
     default:
       switch (t) {
         case READING_HUMIDITY:
@@ -122,6 +212,9 @@ bool soft_filter_proxy(struct sfilter *f, enum reading_type t, void *data) {
         case READING_PRESSURE:
           printf("publish: pressure @ <%03d, %03d> = %d\n", l->location.x, l->location.y, l->value);
           break;
+        case READING_VIBRATION:
+          printf("publish: vibration @ <%03d, %03d> = %d\n", l->location.x, l->location.y, ((vibration *) data)->peak);
+          break;
 
       }
       return false;
@@ -136,7 +229,7 @@ bool hard_filter_proxy(struct hfilter *f) {
       n = &node_location;
 
       double dist = sqrt(pow(abs(n->x - v->x), 2) + pow(abs(n->y - v->y), 2));
-      if (dist > 10) return true;
+      if (dist > CLOSE_TO_DISTANCE) return true;
       /* fall-through */
     default:
       return false;
@@ -146,8 +239,15 @@ bool hard_filter_proxy(struct hfilter *f) {
 void aggregator_proxy(struct aggregator *agg, short sink, subid_t subid, uint8_t items, void *datas[]) {
   int i;
   int avg;
+  enum reading_type t = find_subscription(sink, subid)->in.sensor;
+  enum aggregator_t kind = agg->aggregator;
 
-  switch (agg->aggregator) {
+  /* spectra from different places cannot be averaged */
+  if (t == READING_VIBRATION) {
+    kind = NO_AGGREGATION;
+  }
+
+  switch (kind) {
     case LOCATION_AVG:
     {
       struct locshort *a,*b;
@@ -189,7 +289,7 @@ void aggregator_proxy(struct aggregator *agg, short sink, subid_t subid, uint8_t
     }
     default:
       for (i = 0; i < items; i++) {
-        pubsub_add_data(sink, subid, datas[i], sizeof(struct locshort));
+        pubsub_add_data(sink, subid, datas[i], reading_size(t));
       }
   }
 }
@@ -28,6 +28,9 @@ static void on_reading(subid_t subid, void *data) {
       printf("got: pressure @ <%03d, %03d> = %d\n", r.location.x, r.location.y, r.value);
       break;
     }
+    default:
+      /* not subscribed to */
+      break;
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -46,6 +49,8 @@ PROCESS_THREAD(sink_process, ev, data)
   /* no special stuff here */
   s.soft.filter = NO_SOFT_FILTER;
   s.hard.filter = NO_HARD_FILTER;
+  s.scope.radius = 0;
+  s.priority = SUBNET_PRIORITY_BULK;
   s.aggregator.aggregator = NO_AGGREGATION;
 
   /* subscribe to humidity */
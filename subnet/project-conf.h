@@ -1 +1,4 @@
-#define WITH_PHASE_OPTIMIZATION      0
+/* the reading store (see store.h) can only reserve space up front on Coffee */
+#ifdef CONTIKI_TARGET_NATIVE
+#define DB_FEATURE_COFFEE 0
+#endif
@@ -22,12 +22,17 @@
 /* private functions */
 static void on_errpub();
 static void on_ondata(short sink, subid_t subid, void *data);
+static void on_onshared(uint8_t targets, short sinks[], subid_t subids[], void *data, dlen_t bytes);
+static void on_onrelay(short sink, subid_t subid, void *data, dlen_t bytes);
 static void on_subscription(struct esubscription *s);
 static void on_unsubscription(struct esubscription *old);
 static void on_collect_timer_expired(void *tp);
 static void on_aggregate_timer_expired(void *sinkp);
+static void flush(short sink);
 static void set_needs(enum reading_type t, bool need);
 static void aggregate_trigger(short sink);
+static clock_time_t until_grid(clock_time_t interval);
+static void schedule_collect(enum reading_type t);
 /*---------------------------------------------------------------------------*/
 /* private members */
 static bool added_data;
@@ -37,25 +42,31 @@ static struct pubsub_callbacks callbacks = {
   on_ondata,
 
   on_subscription,
-  on_unsubscription
+  on_unsubscription,
+  on_onshared,
+  NULL,
+  on_onrelay
 };
 
 static struct ctimer aggregate[SUBNET_MAX_SINKS];
 static short is[SUBNET_MAX_SINKS]; /* sometimes, I dislike C */
+static clock_time_t agg_period;
 
 static struct ctimer collect[PUBSUB_MAX_SENSORS];
+static enum reading_type ts[PUBSUB_MAX_SENSORS];
+static clock_time_t period[PUBSUB_MAX_SENSORS]; /* shortest sample interval */
 static dlen_t rsize[PUBSUB_MAX_SENSORS];
 
 static bool needs[PUBSUB_MAX_SENSORS];
 static uint8_t numneeds;
 
-static bool (* soft_filter)(struct sfilter *f, enum reading_type t, void *data);
+static bool (* soft_filter)(struct sfilter *f, short sink, subid_t subid, enum reading_type t, void *data);
 static bool (* hard_filter)(struct hfilter *f);
 static void (* aggregator)(struct aggregator *a, short sink, subid_t subid, uint8_t items, void *datas[]);
 /*---------------------------------------------------------------------------*/
 /* public function definitions */
 void publisher_start(
-  bool (* soft_filter_proxy)(struct sfilter *f, enum reading_type t, void *data),
+  bool (* soft_filter_proxy)(struct sfilter *f, short sink, subid_t subid, enum reading_type t, void *data),
   bool (* hard_filter_proxy)(struct hfilter *f),
   void (* aggregator_proxy)(struct aggregator *a, short sink, subid_t subid, uint8_t items, void *datas[]),
   clock_time_t agg_interval
@@ -68,14 +79,15 @@ void publisher_start(
   aggregator = aggregator_proxy;
 
   etarget = PROCESS_CURRENT();
-  pubsub_init(&callbacks);
   numneeds = 0;
+  agg_period = agg_interval;
   for (i = 0; i < PUBSUB_MAX_SENSORS; i++) {
     rsize[i] = 0;
     needs[i] = false;
+    ts[i] = i;
 
     /* make sure we will chose any period over this one */
-    collect[i].etimer.timer.interval = max;
+    period[i] = max;
   }
 
   for (i = 0; i < SUBNET_MAX_SINKS; i++) {
@@ -91,6 +103,9 @@ void publisher_start(
     /* makes ctimer_expired return true before the timer was started */
     aggregate[i].etimer.p = PROCESS_NONE;
   }
+
+  /* last, since restored subscriptions need the timers to be set up */
+  pubsub_init(&callbacks);
 }
 void publisher_has(enum reading_type t, dlen_t sz) {
   rsize[t] = sz;
@@ -103,11 +118,19 @@ bool publisher_needs(enum reading_type t) {
 }
 void publisher_publish(enum reading_type t, void *reading) {
   struct wsubscription s;
+#if PUBLISHER_SHARED_PATHS
+  short sinkids[SUBNET_MAX_SINKS*PUBSUB_MAX_SUBSCRIPTIONS];
+  subid_t subids[SUBNET_MAX_SINKS*PUBSUB_MAX_SUBSCRIPTIONS];
+  uint8_t shared = 0;
+  uint8_t i;
+#endif
   added_data = true;
   set_needs(t, false);
   PRINTF("publisher: incoming reading for sensor %d\n", t);
-  PRINTF("publisher: resetting collection timer with interval %lu\n", collect[t].etimer.timer.interval);
-  ctimer_restart(&collect[t]);
+  if (period[t] != (~((clock_time_t)0) / 2)) {
+    PRINTF("publisher: rescheduling collection timer with interval %lu\n", period[t]);
+    schedule_collect(t);
+  }
 
   s.sink = -1;
   while (pubsub_next_subscription(&s)) {
@@ -116,8 +139,26 @@ void publisher_publish(enum reading_type t, void *reading) {
       if (hard_filter != NULL && hard_filter(&s.esub->in.hard)) continue;
 
       PRINTF("publisher: applying to subscription %d:%d\n", s.sink, s.subid);
+      pubsub_count_sample(s.sink);
+
+      if (s.esub->in.priority > SUBNET_PRIORITY_BULK) {
+        if (!soft_filter(&s.esub->in.soft, s.sink, s.subid, t, reading)) {
+          PRINTF("publisher: subscription has priority %d, sending now\n", s.esub->in.priority);
+          added_data = pubsub_add_urgent_data(s.sink, s.subid, reading, rsize[t]);
+        }
+        continue;
+      }
 
-      if (!soft_filter(&s.esub->in.soft, t, reading)) {
+      if (!soft_filter(&s.esub->in.soft, s.sink, s.subid, t, reading)) {
+#if PUBLISHER_SHARED_PATHS
+        if (s.esub->in.aggregator.aggregator == NO_AGGREGATION) {
+          /* added below together with the other sinks that want it */
+          sinkids[shared] = s.sink;
+          subids[shared] = s.subid;
+          shared++;
+          continue;
+        }
+#endif
         added_data = pubsub_add_data(s.sink, s.subid, reading, rsize[t]);
       } else {
         PRINTF("publisher: reading soft filtered, so not writing\n");
@@ -126,33 +167,44 @@ void publisher_publish(enum reading_type t, void *reading) {
       aggregate_trigger(s.sink);
     }
   }
+
+#if PUBLISHER_SHARED_PATHS
+  if (shared > 0) {
+    PRINTF("publisher: adding reading for %d subscriptions as shared\n", shared);
+    added_data = pubsub_add_shared_data(shared, sinkids, subids, reading, rsize[t]);
+    for (i = 0; i < shared; i++) {
+      aggregate_trigger(sinkids[i]);
+    }
+  }
+#endif
 }
 /*---------------------------------------------------------------------------*/
 /* private function definitions */
 static void on_subscription(struct esubscription *s) {
-  struct ctimer *c = &collect[s->in.sensor];
-  PRINTF("publisher: got new subscription for sensor: %d\n", s->in.sensor);
+  enum reading_type t = s->in.sensor;
+  PRINTF("publisher: got new subscription for sensor: %d\n", t);
   if (hard_filter != NULL && hard_filter(&s->in.hard)) {
     PRINTF("publisher: subscription ignored - hard filtered\n");
     return;
   }
 
-  if (s->in.interval < c->etimer.timer.interval) {
-    PRINTF("publisher: new interval %lu is lower than current %lu, setting ctimer\n", s->in.interval, c->etimer.timer.interval);
-    ctimer_set(c, s->in.interval, &on_collect_timer_expired, &s->in.sensor);
-    on_collect_timer_expired(&s->in.sensor);
+  if (s->in.interval < period[t]) {
+    PRINTF("publisher: new interval %lu is lower than current %lu, setting ctimer\n", s->in.interval, period[t]);
+    period[t] = s->in.interval;
+    schedule_collect(t);
+    on_collect_timer_expired(&ts[t]);
   } else {
-    PRINTF("publisher: current interval %lu < subscription's %lu, ignoring\n", c->etimer.timer.interval, s->in.interval);
+    PRINTF("publisher: current interval %lu < subscription's %lu, ignoring\n", period[t], s->in.interval);
   }
 }
 static void on_unsubscription(struct esubscription *old) {
   struct wsubscription s;
   enum reading_type t = old->in.sensor;
-  struct ctimer c = collect[t];
-  ctimer_stop(&c);
   clock_time_t max = (~((clock_time_t)0) / 2);
   clock_time_t min = max;
 
+  ctimer_stop(&collect[t]);
+
   s.sink = -1;
   while (pubsub_next_subscription(&s)) {
     if (s.esub->in.sensor != t) continue;
@@ -163,24 +215,49 @@ static void on_unsubscription(struct esubscription *old) {
     }
   }
 
+  /* if there are no other subscriptions for this sensor, the timer is left
+   * stopped. The interval is then max for the check in on_subscription to
+   * keep working */
+  period[t] = min;
   if (min == max) {
-    /* we now have no subscriptions for this timer, so no need to start it */
-    /* we have to set the interval to max for the check in on_subscription to
-     * keep working */
-    c.etimer.timer.interval = max;
     PRINTF("publisher: no other subscriptions for this sensor, stopping timer\n");
     return;
   }
 
   PRINTF("publisher: new sample interval is %lu\n", min);
-  ctimer_set(&c, min, &on_collect_timer_expired, &s.esub->in.sensor);
+  schedule_collect(t);
+}
+/**
+ * Time from now until the next multiple of the given interval on the node's
+ * clock, after rounding the interval up to the wake-up grid.
+ *
+ * clock_time() wraps too often to be used for this on some platforms, so
+ * clock_seconds() is used for the whole seconds.
+ */
+static clock_time_t until_grid(clock_time_t interval) {
+#if PUBLISHER_WAKEUP_GRID > 0
+  unsigned long now = clock_seconds() * CLOCK_SECOND + clock_time() % CLOCK_SECOND;
+
+  interval = ((interval + PUBLISHER_WAKEUP_GRID - 1) / PUBLISHER_WAKEUP_GRID) * PUBLISHER_WAKEUP_GRID;
+  if (interval == 0) {
+    return 0;
+  }
+
+  return interval - now % interval;
+#else
+  return interval;
+#endif
+}
+static void schedule_collect(enum reading_type t) {
+  ctimer_set(&collect[t], until_grid(period[t]), &on_collect_timer_expired, &ts[t]);
 }
 static void aggregate_trigger(short sink) {
   /* if last add failed, we should send the packet straightaway */
   if (!added_data) {
     PRINTF("publisher: packet probably full - attempting to send\n");
     ctimer_stop(&aggregate[sink]);
-    on_aggregate_timer_expired(&sink);
+    pubsub_count_flush(PUBSUB_FLUSH_FULL);
+    flush(sink);
   }
 
   /* if the packet is more than half full, send to avoid dropping readings */
@@ -190,21 +267,44 @@ static void aggregate_trigger(short sink) {
   if (pubsub_packetlen(sink) > PACKETBUF_SIZE/2) {
     PRINTF("publisher: pre-empting half-full packet\n");
     ctimer_stop(&aggregate[sink]);
-    on_aggregate_timer_expired(&sink);
+    pubsub_count_flush(PUBSUB_FLUSH_HALF);
+    flush(sink);
   }
 
   if (ctimer_expired(&aggregate[sink])) {
     PRINTF("publisher: aggregation timer expired, restarting\n");
-    ctimer_restart(&aggregate[sink]);
+    ctimer_set(&aggregate[sink], until_grid(agg_period), &on_aggregate_timer_expired, &is[sink]);
   }
 }
 static void on_ondata(short sink, subid_t subid, void *data) {
   PRINTF("publisher: heard data from upstream - adding\n");
 
   struct esubscription *s = find_subscription(sink, subid);
+  if (s->in.priority > SUBNET_PRIORITY_BULK) {
+    /* pass it on right away */
+    added_data = pubsub_add_urgent_data(sink, subid, data, rsize[s->in.sensor]);
+    return;
+  }
+
   added_data = pubsub_add_data(sink, subid, data, rsize[s->in.sensor]);
   aggregate_trigger(sink);
 }
+static void on_onshared(uint8_t targets, short sinks[], subid_t subids[], void *data, dlen_t bytes) {
+  uint8_t i;
+  PRINTF("publisher: heard shared data from upstream - adding\n");
+
+  added_data = pubsub_add_shared_data(targets, sinks, subids, data, bytes);
+  for (i = 0; i < targets; i++) {
+    aggregate_trigger(sinks[i]);
+  }
+}
+static void on_onrelay(short sink, subid_t subid, void *data, dlen_t bytes) {
+  PRINTF("publisher: heard data for unknown %d:%d from upstream - adding as is\n", sink, subid);
+
+  /* not aggregated, since how to is not known yet */
+  added_data = pubsub_add_data(sink, subid, data, bytes);
+  aggregate_trigger(sink);
+}
 static void on_errpub() {
   PRINTF("publisher: data publishing failed - could not forward packet\n");
 }
@@ -228,9 +328,12 @@ static void on_collect_timer_expired(void *tp) {
   }
 }
 static void on_aggregate_timer_expired(void *sinkp) {
+  pubsub_count_flush(PUBSUB_FLUSH_TIMER);
+  flush(*((short *)sinkp));
+}
+static void flush(short sink) {
   static void *payloads[MAX_FRAGS_PER_PACKET];
   struct esubscription *sub = NULL;
-  short sink = *((short *)sinkp);
   subid_t maxsub = last_subscription(sink);
   short num, i, subid;
 
@@ -266,6 +369,13 @@ static void on_aggregate_timer_expired(void *sinkp) {
       }
     }
   }
+
+  /* shared fragments are never aggregated, so just carry them over */
+  num = extract_data(sink, SUBNET_SHARED_SUBID, payloads, MAX_FRAGS_PER_PACKET);
+  for (i = 0; i < num; i++) {
+    pubsub_add_data(sink, SUBNET_SHARED_SUBID, payloads[i], shared_fragment_size(payloads[i]));
+  }
+
   pubsub_writein();
   pubsub_publish(sink);
 }
@@ -20,21 +20,45 @@
 #define PUBSUB_MAX_SENSORS 5
 #endif
 
+/* whether readings for several sinks should be sent as shared fragments */
+#ifdef PUBLISHER_CONF_SHARED_PATHS
+#define PUBLISHER_SHARED_PATHS PUBLISHER_CONF_SHARED_PATHS
+#else
+#define PUBLISHER_SHARED_PATHS 0
+#endif
+
+/* sampling and flush timers fire at multiples of their interval, rounded up
+ * to this grid, so that timers with related intervals wake the node at the
+ * same time. 0 makes timers run relative to when they were started */
+#ifdef PUBLISHER_CONF_WAKEUP_GRID
+#define PUBLISHER_WAKEUP_GRID PUBLISHER_CONF_WAKEUP_GRID
+#else
+#define PUBLISHER_WAKEUP_GRID CLOCK_SECOND
+#endif
+
 #define MAX_FRAGS_PER_PACKET (PACKETBUF_SIZE/sizeof(struct fragment))
 
 /**
  * \brief Starts the pubsub network connection
  * \param soft_filter_proxy Function to use as a soft filter proxy. Should
- *          return true if the value should be filtered. Note that data may be a
- *          NULL pointer if the node doesn't have the given sensor
+ *          return true if the value should be filtered for the subscription
+ *          subid of sink. Note that data may be a NULL pointer if the node
+ *          doesn't have the given sensor
  * \param hard_filter_proxy Function to use as a hard filter proxy. Should
  *          return true if the value should be filtered.
  * \param aggregator_proxy Function to use as an aggregator. Should call
  *          pubsub_add_data with every aggregated value. items is a count of the
  *          number of data items, and datas is a list of pointers to each value.
+ * \param agg_interval How long to collect data for a sink before sending it
+ *
+ * Sampling for a sensor and flushing data for a sink both happen at the
+ * next multiple of their interval on the node's clock (see
+ * PUBLISHER_WAKEUP_GRID). A 30 second interval thus always fires together
+ * with a 15 second one, and flushes to different sinks happen at the same
+ * time so that packets for a common next hop go out in one burst.
  */
 void publisher_start(
-  bool (* soft_filter_proxy)(struct sfilter *f, enum reading_type t, void *data),
+  bool (* soft_filter_proxy)(struct sfilter *f, short sink, subid_t subid, enum reading_type t, void *data),
   bool (* hard_filter_proxy)(struct hfilter *f),
   void (* aggregator_proxy)(struct aggregator *a, short sink, subid_t subid, uint8_t items, void *datas[]),
   clock_time_t agg_interval
@@ -64,6 +88,10 @@ bool publisher_needs(enum reading_type t);
  * \brief Publish a new value for the given reading
  * \param t Type of the reading
  * \param reading Value of the reading
+ *
+ * If PUBLISHER_SHARED_PATHS is set, a reading that matches non-aggregated
+ * subscriptions from several sinks is added as a single shared fragment for
+ * all sinks that share the next hop, rather than once per sink.
  */
 void publisher_publish(enum reading_type t, void *reading);
 
@@ -11,6 +11,18 @@
 #include "lib/pubsub.h"
 #include "sys/ctimer.h"
 #include <string.h>
+#if PUBSUB_COUNTER_DUMP
+#include <stdio.h>
+#endif
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+#include "net/mac/contikimac.h"
+#endif
+#if SUBNET_CHECKPOINT
+#include "cfs/cfs.h"
+#if SUBNET_CHECKPOINT_COFFEE
+#include "cfs/cfs-coffee.h"
+#endif
+#endif
 
 #define DEBUG 0
 #if DEBUG
@@ -31,6 +43,28 @@ static void on_unsubscribe(struct subnet_conn *c, short sink, subid_t subid);
 static enum existance on_exists(struct subnet_conn *c, short sink, subid_t subid);
 static dlen_t on_inform(struct subnet_conn *c, short sink, subid_t subid, void *target, dlen_t space);
 static void on_sink_left(struct subnet_conn *c, short sink);
+static void on_onshared(struct subnet_conn *c, uint8_t targets, short sinks[], subid_t subids[], void *data, dlen_t bytes);
+static bool on_forward(struct subnet_conn *c, short sink, subid_t subid, void *data, const struct position *from);
+static unsigned long distance2(const struct position *a, const struct position *b);
+static void checkpoint_subscription(short sink, subid_t subid);
+static void on_sink_reset(struct subnet_conn *c, short sink);
+static void on_onbatch(struct subnet_conn *c, short sink, uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]);
+static void on_onrelay(struct subnet_conn *c, short sink, subid_t subid, void *data, dlen_t bytes);
+static void restore(void);
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+static void report_load(void *ptr);
+#endif
+#if PUBSUB_COUNTER_DUMP
+static void dump_counters(void *ptr);
+#endif
+#if SUBNET_COUNTERS
+static uint8_t *put_counter(uint8_t *p, uint8_t *end, unsigned long v);
+#define COUNT(FIELD) (state.counters.FIELD++)
+#define COUNT_N(FIELD, N) (state.counters.FIELD += (N))
+#else
+#define COUNT(FIELD)
+#define COUNT_N(FIELD, N)
+#endif
 /*---------------------------------------------------------------------------*/
 /* private members */
 struct sink_subscriptions {
@@ -39,6 +73,30 @@ struct sink_subscriptions {
 };
 static struct sink_subscriptions sinks[SUBNET_MAX_SINKS];
 static struct pubsub_state state;
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+#define LOAD_INTERVAL 60*CLOCK_SECOND
+static struct ctimer load_timer;
+static unsigned long relayed; /* subnet's relay count at the last report */
+static bool sampled[SUBNET_MAX_SINKS]; /* sinks we took readings for since */
+#endif
+#if PUBSUB_COUNTER_DUMP
+static struct ctimer dump_timer;
+#endif
+#if SUBNET_CHECKPOINT
+/**
+ * \brief On-flash copy of a single subscription
+ */
+struct subscription_record {
+  uint8_t magic;
+  uint8_t revoked;
+  rimeaddr_t sink;
+  subid_t subid;
+  struct subscription in;
+};
+#define SUBSCRIPTION_RECORD_MAGIC 0x5d
+#define PUBSUB_CHECKPOINT_FILE "pubsub"
+static int checkpoint = -1;
+#endif
 static struct subnet_callbacks su = {
   on_errpub,
   on_ondata,
@@ -46,7 +104,12 @@ static struct subnet_callbacks su = {
   on_unsubscribe,
   on_exists,
   on_inform,
-  on_sink_left
+  on_sink_left,
+  on_onshared,
+  on_forward,
+  on_sink_reset,
+  on_onbatch,
+  on_onrelay
 };
 /*---------------------------------------------------------------------------*/
 /* public function definitions */
@@ -77,9 +140,23 @@ void pubsub_init(struct pubsub_callbacks *u) {
 
   /* store callbacks */
   state.u = u;
+#if SUBNET_COUNTERS
+  memset(&state.counters, 0, sizeof(struct pubsub_counters));
+#endif
 
   /* and start subnet networking */
   subnet_open(&state.c, 14159, 26535, &su);
+
+  restore();
+
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+  relayed = 0;
+  memset(sampled, 0, sizeof(sampled));
+  ctimer_set(&load_timer, LOAD_INTERVAL, report_load, NULL);
+#endif
+#if PUBSUB_COUNTER_DUMP
+  ctimer_set(&dump_timer, PUBSUB_COUNTER_DUMP*CLOCK_SECOND, dump_counters, NULL);
+#endif
 }
 
 bool pubsub_next_subscription(struct wsubscription *sub) {
@@ -114,6 +191,12 @@ bool pubsub_next_subscription(struct wsubscription *sub) {
 bool pubsub_add_data(short sinkid, subid_t subid, void *payload, dlen_t bytes) {
   return subnet_add_data(&state.c, sinkid, subid, payload, bytes);
 }
+bool pubsub_add_urgent_data(short sinkid, subid_t subid, void *payload, dlen_t bytes) {
+  return subnet_add_urgent_data(&state.c, sinkid, subid, payload, bytes);
+}
+bool pubsub_add_shared_data(uint8_t targets, short sinkids[], subid_t subids[], void *payload, dlen_t bytes) {
+  return subnet_add_shared_data(&state.c, targets, sinkids, subids, payload, bytes);
+}
 void pubsub_publish(short sinkid) {
   subnet_publish(&state.c, sinkid);
 }
@@ -133,7 +216,81 @@ void pubsub_unsubscribe(subid_t subid) {
 short pubsub_myid() {
   return subnet_myid(&state.c);
 }
+const struct pubsub_counters *pubsub_counters() {
+#if SUBNET_COUNTERS
+  return &state.counters;
+#else
+  return NULL;
+#endif
+}
+const struct subnet_counters *pubsub_subnet_counters() {
+  return subnet_counters(&state.c);
+}
+void pubsub_count_flush(enum pubsub_flush_reason why) {
+  COUNT(flushes[why]);
+}
+void pubsub_count_sample(short sinkid) {
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+  if (sinkid >= 0 && sinkid < SUBNET_MAX_SINKS) {
+    sampled[sinkid] = true;
+  }
+#endif
+}
+uint8_t pubsub_dump_counters(uint8_t *buf, uint8_t len) {
+#if SUBNET_COUNTERS
+  const struct subnet_counters *c = subnet_counters(&state.c);
+  uint8_t *p = buf, *end = buf + len;
+  uint8_t i;
+
+  if (len < 3) {
+    return 0;
+  }
+
+  *p++ = PUBSUB_COUNTERS_VERSION;
+  *p++ = rimeaddr_node_addr.u8[0];
+  *p++ = rimeaddr_node_addr.u8[1];
+
+  for (i = 0; i < SUBNET_COUNTED_TYPES; i++) {
+    p = put_counter(p, end, c->sent[i].packets);
+    p = put_counter(p, end, c->sent[i].bytes);
+  }
+  for (i = 0; i < SUBNET_COUNTED_TYPES; i++) {
+    p = put_counter(p, end, c->received[i].packets);
+    p = put_counter(p, end, c->received[i].bytes);
+  }
+  p = put_counter(p, end, c->added);
+  p = put_counter(p, end, c->merged);
+  p = put_counter(p, end, c->dropped);
+  p = put_counter(p, end, c->failovers);
+  p = put_counter(p, end, c->resurrections);
+  p = put_counter(p, end, c->solicits);
+  p = put_counter(p, end, c->repairs);
+  for (i = 0; i < SUBNET_FLUSH_REASONS; i++) {
+    p = put_counter(p, end, c->flushes[i]);
+  }
+  p = put_counter(p, end, c->buffer_hwm);
+  p = put_counter(p, end, c->queue_hwm);
+
+  p = put_counter(p, end, state.counters.subscriptions);
+  p = put_counter(p, end, state.counters.unsubscriptions);
+  p = put_counter(p, end, state.counters.delivered);
+  p = put_counter(p, end, state.counters.forwarded);
+  for (i = 0; i < PUBSUB_FLUSH_REASONS; i++) {
+    p = put_counter(p, end, state.counters.flushes[i]);
+  }
+
+  return p == NULL ? 0 : p - buf;
+#else
+  return 0;
+#endif
+}
 void pubsub_close() {
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+  ctimer_stop(&load_timer);
+#endif
+#if PUBSUB_COUNTER_DUMP
+  ctimer_stop(&dump_timer);
+#endif
   subnet_close(&state.c);
 }
 uint8_t extract_data(short sink, subid_t sid, void *payloads[], int plen) {
@@ -156,6 +313,9 @@ uint8_t extract_data(short sink, subid_t sid, void *payloads[], int plen) {
 
   return num;
 }
+void pubsub_locate(const struct position *position) {
+  subnet_locate(&state.c, position);
+}
 void pubsub_writeout(short sinkid) {
   subnet_writeout(&state.c, sinkid);
 }
@@ -171,11 +331,102 @@ static void on_errpub(struct subnet_conn *c) {
 }
 
 static void on_ondata(struct subnet_conn *c, short sink, subid_t subid, void *data) {
+  if (sink == pubsub_myid()) {
+    COUNT(delivered);
+  } else {
+    COUNT(forwarded);
+  }
+
   if (state.u->on_ondata != NULL) {
     state.u->on_ondata(sink, subid, data);
   }
 }
 
+static void on_onbatch(struct subnet_conn *c, short sink, uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]) {
+  uint8_t i, j, n = 0;
+
+  if (state.u->on_onbatch != NULL) {
+    for (i = 0; i < groups; i++) {
+      COUNT_N(delivered, counts[i]);
+    }
+    state.u->on_onbatch(sink, groups, subids, counts, readings);
+    return;
+  }
+
+  for (i = 0; i < groups; i++) {
+    for (j = 0; j < counts[i]; j++) {
+      on_ondata(c, sink, subids[i], readings[n++]);
+    }
+  }
+}
+
+static void on_onshared(struct subnet_conn *c, uint8_t targets, short sinks[], subid_t subids[], void *data, dlen_t bytes) {
+  uint8_t i;
+
+  if (state.u->on_onshared != NULL) {
+    COUNT_N(forwarded, targets);
+    state.u->on_onshared(targets, sinks, subids, data, bytes);
+    return;
+  }
+
+  for (i = 0; i < targets; i++) {
+    on_ondata(c, sinks[i], subids[i], data);
+  }
+}
+
+static void on_onrelay(struct subnet_conn *c, short sink, subid_t subid, void *data, dlen_t bytes) {
+  if (state.u->on_onrelay != NULL) {
+    COUNT(forwarded);
+    state.u->on_onrelay(sink, subid, data, bytes);
+  }
+}
+
+static unsigned long distance2(const struct position *a, const struct position *b) {
+  long dx = a->x - b->x;
+  long dy = a->y - b->y;
+  return dx*dx + dy*dy;
+}
+
+static bool on_forward(struct subnet_conn *c, short sink, subid_t subid, void *data, const struct position *from) {
+  const struct position *me = subnet_position(c);
+  struct subscription s;
+  unsigned long r2, d2;
+
+  /* sinks drop readings for other sinks, so must not be their next hop */
+  if (pubsub_myid() != -1 && sink != pubsub_myid()) {
+    PRINTF("pubsub: we are a sink, not forwarding %d:%d\n", sink, subid);
+    return false;
+  }
+
+  /* data is straight out of the packet, so may not be aligned */
+  memcpy(&s, data, sizeof(struct subscription));
+
+  if (s.scope.radius == 0 || me == NULL) {
+    return true;
+  }
+
+  r2 = (unsigned long) s.scope.radius * s.scope.radius;
+  d2 = distance2(me, &s.scope.center);
+  if (d2 <= r2) {
+    PRINTF("pubsub: inside scope of %d:%d, forwarding\n", sink, subid);
+    return true;
+  }
+
+  if (from == NULL) {
+    PRINTF("pubsub: position of sender unknown, forwarding %d:%d\n", sink, subid);
+    return true;
+  }
+
+  /* only forward if we're bringing the subscription closer to its scope */
+  if (d2 < distance2(from, &s.scope.center)) {
+    PRINTF("pubsub: on path to scope of %d:%d, forwarding\n", sink, subid);
+    return true;
+  }
+
+  PRINTF("pubsub: %d:%d is out of scope, not forwarding\n", sink, subid);
+  return false;
+}
+
 static enum existance sub_state(struct esubscription *s) {
   if (s->revoked == 1) {
     /* invalid (never started) subscription */
@@ -200,11 +451,14 @@ static void on_subscribe(struct subnet_conn *c, short sink, subid_t subid, void
   struct esubscription *s = find_subscription(sink, subid);
   s->revoked = 0;
   memcpy(&s->in, data, sizeof(struct subscription));
+  COUNT(subscriptions);
 
   if (sinks[sink].maxsub < subid) {
     sinks[sink].maxsub = subid;
   }
 
+  checkpoint_subscription(sink, subid);
+
   if (state.u->on_subscription != NULL) {
     state.u->on_subscription(s);
   }
@@ -219,6 +473,8 @@ static void on_unsubscribe(struct subnet_conn *c, short sink, subid_t subid) {
     }
 
     remove->revoked = clock_seconds();
+    checkpoint_subscription(sink, subid);
+    COUNT(unsubscriptions);
 
     if (state.u->on_unsubscription != NULL) {
       state.u->on_unsubscription(remove);
@@ -243,15 +499,185 @@ static dlen_t on_inform(struct subnet_conn *c, short sink, subid_t subid, void *
 }
 
 static void on_sink_left(struct subnet_conn *c, short sink) {
-  struct sink_subscriptions s = sinks[sink];
+  struct sink_subscriptions *s = &sinks[sink];
+  subid_t i;
+
+  for (i = 0; i <= s->maxsub; i++) {
+    if (s->subs[i].revoked == 0) {
+      s->subs[i].revoked = clock_seconds();
+      checkpoint_subscription(sink, i);
+    }
+  }
+  s->maxsub = 0;
+}
+
+static void on_sink_reset(struct subnet_conn *c, short sink) {
+  struct sink_subscriptions *s = &sinks[sink];
   subid_t i;
 
-  for (i = 0; i <= s.maxsub; i++) {
-    if (s.subs[i].revoked == 0) {
-      s.subs[i].revoked = clock_seconds();
+  for (i = 0; i < PUBSUB_MAX_SUBSCRIPTIONS; i++) {
+    if (sub_state(&s->subs[i]) == KNOWN && state.u->on_unsubscription != NULL) {
+      state.u->on_unsubscription(&s->subs[i]);
     }
+
+    /* forget rather than revoke, so the reused subids are accepted */
+    s->subs[i].revoked = 1;
+    checkpoint_subscription(sink, i);
   }
-  s.maxsub = 0;
+  s->maxsub = 0;
+}
+
+#if PUBSUB_ADAPTIVE_DUTY_CYCLE
+static void report_load(void *ptr) {
+  unsigned long delta = state.c.relayed - relayed;
+  uint8_t flows = 0;
+  short i;
+
+  /* every node knows most subscriptions, so only those we take readings
+   * for make us part of a flow */
+  for (i = 0; i < SUBNET_MAX_SINKS; i++) {
+    if (sampled[i]) {
+      flows++;
+      sampled[i] = false;
+    }
+  }
+
+  PRINTF("pubsub: relayed %lu packets, took readings for %d sinks\n", delta, flows);
+  contikimac_set_load(delta > 0xffff ? 0xffff : delta, flows);
+
+  relayed = state.c.relayed;
+  ctimer_reset(&load_timer);
+}
+#endif
+
+#if SUBNET_COUNTERS
+/* unsigned LEB128: seven bits at the time, high bit set on all but the last */
+static uint8_t *put_counter(uint8_t *p, uint8_t *end, unsigned long v) {
+  do {
+    if (p == NULL || p == end) {
+      return NULL;
+    }
+    *p = v & 0x7f;
+    v >>= 7;
+    if (v != 0) {
+      *p |= 0x80;
+    }
+    p++;
+  } while (v != 0);
+  return p;
+}
+#endif
+
+#if PUBSUB_COUNTER_DUMP
+static void dump_counters(void *ptr) {
+  uint8_t buf[PUBSUB_COUNTERS_DUMP_SIZE];
+  uint8_t i, len = pubsub_dump_counters(buf, sizeof(buf));
+
+  if (len > 0) {
+    printf("counters: ");
+    for (i = 0; i < len; i++) {
+      printf("%02x", buf[i]);
+    }
+    printf("\n");
+  }
+
+  ctimer_reset(&dump_timer);
+}
+#endif
+
+static void checkpoint_subscription(short sink, subid_t subid) {
+#if SUBNET_CHECKPOINT
+  struct esubscription *s = find_subscription(sink, subid);
+  struct subscription_record r, stored;
+  cfs_offset_t offset = (sink * PUBSUB_MAX_SUBSCRIPTIONS + subid) * sizeof(struct subscription_record);
+
+  if (checkpoint < 0) return;
+
+  memset(&r, 0, sizeof(struct subscription_record));
+  if (sub_state(s) != UNKNOWN) {
+    r.magic = SUBSCRIPTION_RECORD_MAGIC;
+    r.revoked = s->revoked != 0;
+    rimeaddr_copy(&r.sink, &subnet_sink(&state.c, sink)->sink);
+    r.subid = subid;
+    memcpy(&r.in, &s->in, sizeof(struct subscription));
+  }
+
+  /* unchanged records are not written again, so that flash is not worn */
+  cfs_seek(checkpoint, offset, CFS_SEEK_SET);
+  if (cfs_read(checkpoint, &stored, sizeof(struct subscription_record)) == sizeof(struct subscription_record) &&
+      memcmp(&stored, &r, sizeof(struct subscription_record)) == 0) {
+    return;
+  }
+
+  cfs_seek(checkpoint, offset, CFS_SEEK_SET);
+  if (cfs_write(checkpoint, &r, sizeof(struct subscription_record)) != sizeof(struct subscription_record)) {
+    PRINTF("pubsub: failed to checkpoint subscription %d:%d\n", sink, subid);
+  }
+#endif
+}
+
+static void restore(void) {
+#if SUBNET_CHECKPOINT
+  struct subscription_record r;
+  struct esubscription *s;
+  short sink;
+  subid_t subid;
+  int fd;
+
+  fd = cfs_open(PUBSUB_CHECKPOINT_FILE, CFS_READ);
+  if (fd >= 0) {
+    while (cfs_read(fd, &r, sizeof(struct subscription_record)) == sizeof(struct subscription_record)) {
+      if (r.magic != SUBSCRIPTION_RECORD_MAGIC || r.subid >= PUBSUB_MAX_SUBSCRIPTIONS) {
+        continue;
+      }
+
+      /* sink ids may have changed, and we only trust subscriptions for sinks
+       * that subnet also remembers */
+      sink = subnet_sinkid(&state.c, &r.sink);
+      if (sink == -1) {
+        PRINTF("pubsub: dropping stored subscription for unknown sink %d.%d\n",
+            r.sink.u8[0], r.sink.u8[1]);
+        continue;
+      }
+
+      s = find_subscription(sink, r.subid);
+      memcpy(&s->in, &r.in, sizeof(struct subscription));
+
+      /* the time of revocation is lost across reboots, so start over */
+      if (r.revoked || subnet_sink(&state.c, sink)->revoked != 0) {
+        s->revoked = clock_seconds() > 1 ? clock_seconds() : 2;
+        continue;
+      }
+
+      s->revoked = 0;
+      if (sinks[sink].maxsub < r.subid) {
+        sinks[sink].maxsub = r.subid;
+      }
+      PRINTF("pubsub: restored subscription %d:%d\n", sink, r.subid);
+    }
+    cfs_close(fd);
+  }
+
+#if SUBNET_CHECKPOINT_COFFEE
+  cfs_coffee_reserve(PUBSUB_CHECKPOINT_FILE,
+      SUBNET_MAX_SINKS * PUBSUB_MAX_SUBSCRIPTIONS * sizeof(struct subscription_record));
+#endif
+  checkpoint = cfs_open(PUBSUB_CHECKPOINT_FILE, CFS_READ | CFS_WRITE);
+  if (checkpoint < 0) {
+    PRINTF("pubsub: cannot open checkpoint file, not checkpointing\n");
+  }
+
+  for (sink = 0; sink < SUBNET_MAX_SINKS; sink++) {
+    for (subid = 0; subid < PUBSUB_MAX_SUBSCRIPTIONS; subid++) {
+      checkpoint_subscription(sink, subid);
+
+      s = find_subscription(sink, subid);
+      if (sub_state(s) == KNOWN && state.u->on_subscription != NULL) {
+        state.u->on_subscription(s);
+      }
+    }
+  }
+#endif
 }
 /*---------------------------------------------------------------------------*/
 
@@ -27,6 +27,34 @@
 #else
 #define PUBSUB_MAX_SUBSCRIPTIONS 8
 #endif
+
+/* report forwarding load to ContikiMAC every minute (see contikimac_set_load)
+ * so that it can adapt its duty cycle. Compare with subnet-sim -c before
+ * turning it on: with subnet's own traffic, the longer strobes to nodes that
+ * skip checks cost more than the skipped checks save */
+#ifdef PUBSUB_CONF_ADAPTIVE_DUTY_CYCLE
+#define PUBSUB_ADAPTIVE_DUTY_CYCLE PUBSUB_CONF_ADAPTIVE_DUTY_CYCLE
+#else
+#define PUBSUB_ADAPTIVE_DUTY_CYCLE 0
+#endif
+
+/* if not 0, print the counters (see pubsub_dump_counters) as a hex line
+ * starting with "counters: " this often, in seconds. subnet/stats/counters
+ * reads these lines from a log */
+#ifdef PUBSUB_CONF_COUNTER_DUMP
+#define PUBSUB_COUNTER_DUMP PUBSUB_CONF_COUNTER_DUMP
+#else
+#define PUBSUB_COUNTER_DUMP 0
+#endif
+
+#if PUBSUB_COUNTER_DUMP && !SUBNET_COUNTERS
+#error "PUBSUB_CONF_COUNTER_DUMP needs SUBNET_CONF_COUNTERS"
+#endif
+
+/* first byte of every counter dump, changed whenever its layout changes */
+#define PUBSUB_COUNTERS_VERSION 2
+/* largest possible counter dump */
+#define PUBSUB_COUNTERS_DUMP_SIZE 255
 /*---------------------------------------------------------------------------*/
 struct sfilter {
   enum soft_filter filter;
@@ -40,12 +68,19 @@ struct aggregator {
   enum aggregator_t    aggregator;
   union aggregator_arg arg;
 };
+struct scope {
+  struct position center;
+  unsigned short  radius; /* 0 means the whole network */
+};
 struct subscription {
   clock_time_t      interval;
   struct sfilter    soft;
   struct hfilter    hard;
   struct aggregator aggregator;
   enum reading_type sensor;
+  struct scope      scope;  /* area outside which no node will publish */
+  uint8_t           priority; /* SUBNET_PRIORITY_*. Data for subscriptions
+                                 above bulk is never aggregated or held back */
 };
 struct esubscription {
   clock_time_t revoked;
@@ -56,9 +91,28 @@ struct wsubscription {
   subid_t subid;
   struct esubscription *esub;
 };
+/**
+ * \brief Why the publisher sent the data buffered for a sink
+ */
+enum pubsub_flush_reason {
+  PUBSUB_FLUSH_TIMER,   /* aggregation interval passed */
+  PUBSUB_FLUSH_FULL,    /* data could not be added */
+  PUBSUB_FLUSH_HALF,    /* buffer was more than half full */
+  PUBSUB_FLUSH_REASONS
+};
+struct pubsub_counters {
+  unsigned long subscriptions;   /* subscriptions learned */
+  unsigned long unsubscriptions; /* subscriptions revoked */
+  unsigned long delivered;       /* readings that reached this sink */
+  unsigned long forwarded;       /* readings handed on towards other sinks */
+  unsigned long flushes[PUBSUB_FLUSH_REASONS];
+};
 struct pubsub_state {
   struct subnet_conn c;
   struct pubsub_callbacks *u;
+#if SUBNET_COUNTERS
+  struct pubsub_counters counters;
+#endif
 };
 struct pubsub_callbacks {
   /* Function to call if a publish couldn't be sent */
@@ -73,11 +127,30 @@ struct pubsub_callbacks {
   /* Function to call when a subscription was removed. Note that after this
    * function returns, the object pointed to will be replaced */
   void (* on_unsubscription)(struct esubscription *s);
+
+  /* Function to call when a publish fragment shared by several subscriptions
+   * is received and should be forwarded. If NULL, on_ondata is called for each
+   * of the subscriptions instead */
+  void (* on_onshared)(uint8_t targets, short sinks[], subid_t subids[], void *data, dlen_t bytes);
+
+  /* Function to call with all readings in a packet that has reached this
+   * sink, grouped by subscription (see subnet_callbacks.onbatch). If NULL,
+   * on_ondata is called for each reading instead */
+  void (* on_onbatch)(short sink, uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]);
+
+  /* Function to call with a reading to forward for a subscription this node
+   * does not know yet (see subnet_callbacks.onrelay). Should add it
+   * unchanged with pubsub_add_data. If NULL, such readings are dropped */
+  void (* on_onrelay)(short sink, subid_t subid, void *data, dlen_t bytes);
 };
 /*---------------------------------------------------------------------------*/
 /**
  * \brief Initialize a pubsub network
  * \param u Callbacks
+ *
+ * If SUBNET_CHECKPOINT is set, subscriptions stored by an earlier boot are
+ * restored here and on_subscription is called for each of them, so callers
+ * must be ready to handle subscriptions before calling this function.
  */
 void pubsub_init(struct pubsub_callbacks *u);
 
@@ -114,6 +187,32 @@ bool pubsub_next_subscription(struct wsubscription *rev);
  */
 bool pubsub_add_data(short sinkid, subid_t subid, void *payload, dlen_t bytes);
 
+/**
+ * \brief Add data for a high priority subscription and send it right away
+ * \param sinkid Sink to send data to
+ * \param subid Subscription data is being added for
+ * \param payload Data
+ * \param bytes Number of bytes of data being added
+ * \return True if data was added, false otherwise
+ *
+ * See subnet_add_urgent_data().
+ */
+bool pubsub_add_urgent_data(short sinkid, subid_t subid, void *payload, dlen_t bytes);
+
+/**
+ * \brief Add data for several subscriptions to the current publishes
+ * \param targets Number of subscriptions in sinkids and subids
+ * \param sinkids Sink of each subscription
+ * \param subids ID of each subscription
+ * \param payload Data
+ * \param bytes Number of bytes of data being added
+ * \return True if data was added for all subscriptions, false otherwise
+ *
+ * Subscriptions whose sinks share a next hop only get a single copy of the
+ * data. See subnet_add_shared_data().
+ */
+bool pubsub_add_shared_data(uint8_t targets, short sinkids[], subid_t subids[], void *payload, dlen_t bytes);
+
 /**
  * \brief Send publishe data packet
  * \param sink Sink to send data to
@@ -155,6 +254,16 @@ void pubsub_unsubscribe(subid_t subid);
  */
 short pubsub_myid();
 
+/**
+ * \brief Set the physical position of this node
+ * \param position This node's position
+ *
+ * Nodes that know their position only rebroadcast a scoped subscription if
+ * they are inside its scope or closer to it than the node they heard it from.
+ * Nodes that don't know their position forward all subscriptions.
+ */
+void pubsub_locate(const struct position *position);
+
 /**
  * \brief Redirect all writes to the given sink to a spare buffer
  * \param sinkid Sink to redirect writes for
@@ -192,6 +301,48 @@ uint8_t extract_data(short sink, subid_t subid, void *payloads[], int plen);
  */
 subid_t last_subscription(short sink);
 
+/**
+ * \brief Get the counters kept by pubsub
+ * \return The counters, or NULL if SUBNET_COUNTERS is not set
+ */
+const struct pubsub_counters *pubsub_counters();
+
+/**
+ * \brief Get the counters kept by the underlying subnet connection
+ * \return The counters, or NULL if SUBNET_COUNTERS is not set
+ */
+const struct subnet_counters *pubsub_subnet_counters();
+
+/**
+ * \brief Count a flush of the data buffered for a sink
+ * \param why Why the data was sent
+ */
+void pubsub_count_flush(enum pubsub_flush_reason why);
+
+/**
+ * \brief Note that this node took a reading for a sink's subscription
+ * \param sinkid The sink the reading is for
+ *
+ * Sinks this node has taken readings for in the last minute are the flows
+ * reported to ContikiMAC with PUBSUB_ADAPTIVE_DUTY_CYCLE. Knowing of a
+ * subscription does not make a node part of its flow.
+ */
+void pubsub_count_sample(short sinkid);
+
+/**
+ * \brief Write all counters to a buffer in a compact binary format
+ * \param buf Buffer to write to
+ * \param len Size of buf. PUBSUB_COUNTERS_DUMP_SIZE is always enough
+ * \return Number of bytes written, 0 if buf is too small or there are no
+ *         counters
+ *
+ * The dump starts with PUBSUB_COUNTERS_VERSION and the two bytes of this
+ * node's address, followed by every counter as an unsigned LEB128 number, in
+ * the order they appear in struct subnet_counters and then struct
+ * pubsub_counters.
+ */
+uint8_t pubsub_dump_counters(uint8_t *buf, uint8_t len);
+
 /**
  * \brief End all subscriptions and close subnet connection
  *
@@ -0,0 +1,45 @@
+/*
+ * Test script for the scenarios generated by ./run, which replaces @TIMEOUT@
+ * with the length of the scenario in milliseconds.
+ *
+ * Every line the motes print is logged in the raw.log format read by the
+ * scripts in ../stats, and node.c is told its position, like
+ * ../cooja-location.js does. Nodes do not log the frames they send, so the
+ * radios are watched directly to count packets and bytes.
+ */
+TIMEOUT(@TIMEOUT@, report());
+
+var packets = 0;
+var bytes = 0;
+
+function watch(radio) {
+  radio.addObserver(new java.util.Observer({
+    update: function(o, arg) {
+      if (radio.getLastEvent() == se.sics.cooja.interfaces.Radio.RadioEvent.PACKET_TRANSMITTED) {
+        packets++;
+        bytes += radio.getLastPacketTransmitted().getPacketData().length;
+      }
+    }
+  }));
+}
+
+function report() {
+  log.log("Number of packets: " + packets + "\n");
+  log.log("Total bytes sent: " + bytes + "\n");
+  log.testOK();
+}
+
+for (var i = 0; i < sim.getMotesCount(); i++) {
+  watch(sim.getMote(i).getInterfaces().getRadio());
+}
+
+while (true) {
+  YIELD();
+  log.log(Math.floor(time / 1000) + "\tID:" + id + "\t" + msg + "\n");
+
+  if (msg.equals("acquiring position...")) {
+    var x = mote.getInterfaces().getPosition().getXCoordinate() | 0;
+    var y = mote.getInterfaces().getPosition().getYCoordinate() | 0;
+    write(mote, x + "\n" + y);
+  }
+}
@@ -0,0 +1,90 @@
+/**
+ * \file
+ *         CFS for subnet-sim
+ *
+ *         The same as core/cfs/cfs-posix.c, except that every node keeps
+ *         its files in its own directory, so that nodes do not see each
+ *         other's checkpoints.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cfs/cfs.h"
+
+/* set by sim_init */
+const char *sim_fs_root = ".";
+/*---------------------------------------------------------------------------*/
+static const char *
+path(const char *n)
+{
+  static char p[256];
+  snprintf(p, sizeof(p), "%s/%s", sim_fs_root, n);
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_open(const char *n, int f)
+{
+  int s = 0;
+  if(f == CFS_READ) {
+    return open(path(n), O_RDONLY);
+  } else if(f & CFS_WRITE) {
+    s = O_CREAT;
+    if(f & CFS_READ) {
+      s |= O_RDWR;
+    } else {
+      s |= O_WRONLY;
+    }
+    if(f & CFS_APPEND) {
+      s |= O_APPEND;
+    } else {
+      s |= O_TRUNC;
+    }
+    return open(path(n), s, 0600);
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+void
+cfs_close(int f)
+{
+  close(f);
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_read(int f, void *b, unsigned int l)
+{
+  return read(f, b, l);
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_write(int f, const void *b, unsigned int l)
+{
+  return write(f, b, l);
+}
+/*---------------------------------------------------------------------------*/
+cfs_offset_t
+cfs_seek(int f, cfs_offset_t o, int w)
+{
+  if(w == CFS_SEEK_SET) {
+    w = SEEK_SET;
+  } else if(w == CFS_SEEK_CUR) {
+    w = SEEK_CUR;
+  } else if(w == CFS_SEEK_END) {
+    w = SEEK_END;
+  } else {
+    return (cfs_offset_t)-1;
+  }
+  return lseek(f, o, w);
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_remove(const char *name)
+{
+  return remove(path(name));
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,37 @@
+/**
+ * \file
+ *         Virtual clock for subnet-sim
+ *
+ *         Time only moves when the simulator says so.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "sys/clock.h"
+
+static clock_time_t now;
+/*---------------------------------------------------------------------------*/
+void
+sim_set_time(unsigned long ms)
+{
+  now = ms;
+}
+/*---------------------------------------------------------------------------*/
+clock_time_t
+clock_time(void)
+{
+  return now;
+}
+/*---------------------------------------------------------------------------*/
+unsigned long
+clock_seconds(void)
+{
+  return now / CLOCK_SECOND;
+}
+/*---------------------------------------------------------------------------*/
+void
+clock_delay(unsigned int d)
+{
+  /* Does not do anything. */
+}
+/*---------------------------------------------------------------------------*/
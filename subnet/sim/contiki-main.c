@@ -0,0 +1,121 @@
+/**
+ * \file
+ *         Node entry points for subnet-sim
+ *
+ *         Replaces the native platform's main loop. Instead of running
+ *         forever, the node is driven by the simulator one event at a
+ *         time, and printf output is handed to the simulator line by line.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "contiki.h"
+#include "net/netstack.h"
+#include "net/rime.h"
+#include "lib/random.h"
+#include "dev/serial-line.h"
+#include "dev/button-sensor.h"
+#include "dev/pir-sensor.h"
+#include "dev/vib-sensor.h"
+#include "sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+SENSORS(&pir_sensor, &vib_sensor, &button_sensor);
+
+const struct sim_hooks *sim_hooks;
+void *sim_ctx;
+extern const char *sim_fs_root;
+
+static char line[256];
+static int linelen;
+/*---------------------------------------------------------------------------*/
+int
+sim_printf(const char *fmt, ...)
+{
+  char buf[256];
+  va_list ap;
+  int i, n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  for(i = 0; i < n && i < sizeof(buf) - 1; i++) {
+    if(buf[i] == '\n') {
+      line[linelen] = '\0';
+      sim_hooks->log(sim_ctx, line);
+      linelen = 0;
+    } else if(linelen < sizeof(line) - 1) {
+      line[linelen++] = buf[i];
+    }
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_init(unsigned short id, const char *fsroot,
+         const struct sim_hooks *hooks, void *ctx)
+{
+  rimeaddr_t addr;
+
+  sim_hooks = hooks;
+  sim_ctx = ctx;
+  sim_fs_root = fsroot;
+
+  process_init();
+  process_start(&etimer_process, NULL);
+  ctimer_init();
+
+  memset(&addr, 0, sizeof(rimeaddr_t));
+  addr.u8[0] = id & 0xff;
+  addr.u8[1] = id >> 8;
+  rimeaddr_set_node_addr(&addr);
+
+  queuebuf_init();
+  netstack_init();
+  random_init(id);
+  serial_line_init();
+
+  autostart_start(autostart_processes);
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_run(void)
+{
+  etimer_request_poll();
+  while(process_run() > 0);
+}
+/*---------------------------------------------------------------------------*/
+unsigned long
+sim_next_wakeup(void)
+{
+  if(!etimer_pending()) {
+    return 0;
+  }
+  return etimer_next_expiration_time();
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_serial_input(const char *s)
+{
+  while(*s != '\0') {
+    serial_line_input_byte(*s++);
+  }
+  serial_line_input_byte('\n');
+}
+/*---------------------------------------------------------------------------*/
+void
+log_message(char *m1, char *m2)
+{
+  sim_printf("%s%s\n", m1, m2);
+}
+/*---------------------------------------------------------------------------*/
+void
+uip_log(char *m)
+{
+  sim_printf("%s\n", m);
+}
+/*---------------------------------------------------------------------------*/
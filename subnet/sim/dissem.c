@@ -0,0 +1,159 @@
+/**
+ * \file
+ *         Bulk data dissemination node for subnet-sim
+ *
+ *         Node 1 sends a DISSEM_SIZE byte file with the rudolph module
+ *         given by DISSEM_PROTOCOL (1, 2 or 3) a little after it boots,
+ *         and every other node receives it, checks it, and prints
+ *         "dissem: done" once it has the whole file. subnet-sim reports
+ *         how long that took, so that the modules can be compared on the
+ *         same topology and loss (see dissem-compare).
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "contiki.h"
+#include "net/rime.h"
+#include "cfs/cfs.h"
+#include <stdio.h>
+
+#if DISSEM_PROTOCOL == 1
+#include "net/rime/rudolph1.h"
+#define RUDOLPH(name) rudolph1_##name
+#define FLAG_NEWFILE RUDOLPH1_FLAG_NEWFILE
+#define FLAG_LASTCHUNK RUDOLPH1_FLAG_LASTCHUNK
+#elif DISSEM_PROTOCOL == 2
+#include "net/rime/rudolph2.h"
+#define RUDOLPH(name) rudolph2_##name
+#define FLAG_NEWFILE RUDOLPH2_FLAG_NEWFILE
+#define FLAG_LASTCHUNK RUDOLPH2_FLAG_LASTCHUNK
+#elif DISSEM_PROTOCOL == 3
+#include "net/rime/rudolph3.h"
+#define RUDOLPH(name) rudolph3_##name
+#define FLAG_NEWFILE RUDOLPH3_FLAG_NEWFILE
+#define FLAG_LASTCHUNK RUDOLPH3_FLAG_LASTCHUNK
+#else
+#error "DISSEM_PROTOCOL must be 1, 2 or 3"
+#endif
+
+#ifdef DISSEM_CONF_SIZE
+#define DISSEM_SIZE DISSEM_CONF_SIZE
+#else
+#define DISSEM_SIZE 2000
+#endif
+
+#define DISSEM_CHANNEL 140
+#define DISSEM_FILE "dissem"
+/*---------------------------------------------------------------------------*/
+static struct RUDOLPH(conn) conn;
+/* kept open, as chunks are written and read back in any order */
+static int fd = -1;
+static uint8_t done;
+/*---------------------------------------------------------------------------*/
+static uint8_t
+pattern(int offset)
+{
+  return (uint8_t)(offset * 7 + (offset >> 8));
+}
+/*---------------------------------------------------------------------------*/
+static void
+check(void)
+{
+  uint8_t buf[64];
+  int offset, len, i;
+
+  cfs_seek(fd, 0, CFS_SEEK_SET);
+  for(offset = 0; offset < DISSEM_SIZE; offset += len) {
+    len = cfs_read(fd, buf, sizeof(buf));
+    if(len <= 0) {
+      printf("dissem: short file, %d bytes\n", offset);
+      return;
+    }
+    for(i = 0; i < len; i++) {
+      if(buf[i] != pattern(offset + i)) {
+        printf("dissem: wrong byte at %d\n", offset + i);
+        return;
+      }
+    }
+  }
+  if(cfs_read(fd, buf, 1) != 0) {
+    printf("dissem: long file\n");
+    return;
+  }
+  printf("dissem: done\n");
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_chunk(struct RUDOLPH(conn) *c, int offset, int flag,
+	    uint8_t *data, int datalen)
+{
+  if(flag == FLAG_NEWFILE) {
+    if(fd >= 0) {
+      cfs_close(fd);
+    }
+    fd = cfs_open(DISSEM_FILE, CFS_READ | CFS_WRITE);
+    done = 0;
+  }
+  if(fd < 0) {
+    return;
+  }
+
+  if(datalen > 0) {
+    cfs_seek(fd, offset, CFS_SEEK_SET);
+    cfs_write(fd, data, datalen);
+  }
+
+  if(flag == FLAG_LASTCHUNK && !done) {
+    done = 1;
+    check();
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+read_chunk(struct RUDOLPH(conn) *c, int offset, uint8_t *to, int maxsize)
+{
+  int i;
+
+  if(rimeaddr_node_addr.u8[0] == 1 && rimeaddr_node_addr.u8[1] == 0) {
+    for(i = 0; i < maxsize && offset + i < DISSEM_SIZE; i++) {
+      to[i] = pattern(offset + i);
+    }
+    return i;
+  }
+
+  if(fd < 0) {
+    return 0;
+  }
+  cfs_seek(fd, offset, CFS_SEEK_SET);
+  i = cfs_read(fd, to, maxsize);
+  return i < 0 ? 0 : i;
+}
+/*---------------------------------------------------------------------------*/
+static const struct RUDOLPH(callbacks) callbacks = { write_chunk, read_chunk };
+/*---------------------------------------------------------------------------*/
+PROCESS(dissem_process, "Dissemination");
+AUTOSTART_PROCESSES(&dissem_process);
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(dissem_process, ev, data)
+{
+  static struct etimer et;
+
+  PROCESS_EXITHANDLER(RUDOLPH(close)(&conn);)
+  PROCESS_BEGIN();
+
+  RUDOLPH(open)(&conn, DISSEM_CHANNEL, &callbacks);
+
+  if(rimeaddr_node_addr.u8[0] == 1 && rimeaddr_node_addr.u8[1] == 0) {
+    /* let every node boot first */
+    etimer_set(&et, 5 * CLOCK_SECOND);
+    PROCESS_WAIT_UNTIL(etimer_expired(&et));
+    printf("dissem: start, %d bytes\n", DISSEM_SIZE);
+    /* the rate rudolph2 and rudolph3 always send at */
+    RUDOLPH(send)(&conn, CLOCK_SECOND / 2);
+  }
+
+  PROCESS_WAIT_UNTIL(0);
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
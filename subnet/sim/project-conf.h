@@ -0,0 +1,26 @@
+#include "../project-conf.h"
+
+/* the simulated radio stands in for the real one, and acks are decided by
+ * subnet-sim, so no RDC duty cycling is simulated */
+#undef NETSTACK_CONF_RADIO
+#define NETSTACK_CONF_RADIO   sim_radio_driver
+#undef NETSTACK_CONF_RDC
+#define NETSTACK_CONF_RDC     nullrdc_driver
+#undef NETSTACK_CONF_MAC
+#define NETSTACK_CONF_MAC     csma_driver
+#undef NETSTACK_CONF_FRAMER
+#define NETSTACK_CONF_FRAMER  framer_nullmac
+
+/* there is no Coffee on the native platform */
+#undef SUBNET_CONF_CHECKPOINT_COFFEE
+#define SUBNET_CONF_CHECKPOINT_COFFEE 0
+
+/* simulated runs are for measuring, so keep the counters (see
+ * stats/counters) */
+#undef SUBNET_CONF_COUNTERS
+#define SUBNET_CONF_COUNTERS 1
+
+/* report the load, so that subnet-sim -c adaptive can estimate the duty
+ * cycle of CONTIKIMAC_CONF_ADAPTIVE */
+#undef PUBSUB_CONF_ADAPTIVE_DUTY_CYCLE
+#define PUBSUB_CONF_ADAPTIVE_DUTY_CYCLE 1
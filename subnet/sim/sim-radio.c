@@ -0,0 +1,136 @@
+/**
+ * \file
+ *         Radio driver that hands frames to subnet-sim
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "contiki.h"
+#include "net/packetbuf.h"
+#include "net/netstack.h"
+#include "net/mac/contikimac.h"
+#include "dev/radio.h"
+#include "sim.h"
+
+#include <string.h>
+
+extern const struct sim_hooks *sim_hooks;
+extern void *sim_ctx;
+
+static uint8_t txbuf[PACKETBUF_SIZE + PACKETBUF_HDR_SIZE];
+static unsigned short txlen;
+/*---------------------------------------------------------------------------*/
+void
+sim_input(const void *data, unsigned short len)
+{
+  packetbuf_clear();
+  memcpy(packetbuf_dataptr(), data, len);
+  packetbuf_set_datalen(len);
+  NETSTACK_RDC.input();
+}
+/*---------------------------------------------------------------------------*/
+static int
+init(void)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+prepare(const void *payload, unsigned short payload_len)
+{
+  if(payload_len > sizeof(txbuf)) {
+    return RADIO_TX_ERR;
+  }
+  memcpy(txbuf, payload, payload_len);
+  txlen = payload_len;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+transmit(unsigned short transmit_len)
+{
+  const rimeaddr_t *to = packetbuf_addr(PACKETBUF_ADDR_RECEIVER);
+  unsigned short dest = SIM_BROADCAST;
+
+  if(!rimeaddr_cmp(to, &rimeaddr_null)) {
+    dest = to->u8[0] | (to->u8[1] << 8);
+  }
+
+  switch(sim_hooks->transmit(sim_ctx, txbuf, txlen, dest)) {
+  case SIM_TX_OK:
+    return RADIO_TX_OK;
+  case SIM_TX_COLLISION:
+    return RADIO_TX_COLLISION;
+  default:
+    return RADIO_TX_NOACK;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+send(const void *payload, unsigned short payload_len)
+{
+  if(prepare(payload, payload_len) != 0) {
+    return RADIO_TX_ERR;
+  }
+  return transmit(payload_len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+read(void *buf, unsigned short buf_len)
+{
+  /* frames are pushed into the stack by sim_input */
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+channel_clear(void)
+{
+  return sim_hooks->channel_clear(sim_ctx);
+}
+/*---------------------------------------------------------------------------*/
+static int
+receiving_packet(void)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+pending_packet(void)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+on(void)
+{
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+off(void)
+{
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+const struct radio_driver sim_radio_driver =
+  {
+    init,
+    prepare,
+    transmit,
+    send,
+    read,
+    channel_clear,
+    receiving_packet,
+    pending_packet,
+    on,
+    off,
+  };
+/*---------------------------------------------------------------------------*/
+/* there is no ContikiMAC here, subnet-sim works out what it would do with
+ * the load instead (see -c) */
+void
+contikimac_set_load(uint16_t relayed, uint8_t flows)
+{
+  sim_hooks->load(sim_ctx, relayed, flows);
+}
+/*---------------------------------------------------------------------------*/
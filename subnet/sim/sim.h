@@ -0,0 +1,49 @@
+/**
+ * \file
+ *         Interface between subnet-sim and the node images it loads
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+/* results of a transmission as decided by the simulator */
+#define SIM_TX_OK         0
+#define SIM_TX_COLLISION  1
+#define SIM_TX_NOACK      2
+
+/* destination of a transmission that is not acked by anyone */
+#define SIM_BROADCAST     0
+
+/**
+ * Callbacks from a node into the simulator. Every callback is passed the
+ * context pointer given to sim_init, so the simulator knows which node is
+ * calling. CFS files of the node are kept in the fsroot directory given to
+ * sim_init.
+ */
+struct sim_hooks {
+  /** Put a frame on the air. to is the node id of the unicast receiver, or
+   * SIM_BROADCAST. Returns one of the SIM_TX_* values. */
+  int (* transmit)(void *ctx, const void *data, unsigned short len, unsigned short to);
+
+  /** Whether the node currently hears nothing on the channel */
+  int (* channel_clear)(void *ctx);
+
+  /** A full line of output from the node, without the trailing newline */
+  void (* log)(void *ctx, const char *line);
+
+  /** The load the node reports to ContikiMAC, see contikimac_set_load */
+  void (* load)(void *ctx, unsigned short relayed, unsigned char flows);
+};
+
+/* entry points exported by each node image */
+typedef void (* sim_init_f)(unsigned short id, const char *fsroot,
+                            const struct sim_hooks *hooks, void *ctx);
+typedef void (* sim_set_time_f)(unsigned long ms);
+typedef void (* sim_run_f)(void);
+typedef unsigned long (* sim_next_wakeup_f)(void);
+typedef void (* sim_input_f)(const void *data, unsigned short len);
+typedef void (* sim_serial_input_f)(const char *line);
+
+#endif /* __SIM_H__ */
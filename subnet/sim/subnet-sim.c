@@ -0,0 +1,861 @@
+/**
+ * \file
+ *         Deterministic multi-node simulator for subnet
+ *
+ *         Loads one copy of a node image (see Makefile) per simulated
+ *         node, so that every node has its own Contiki globals, and
+ *         drives them all from a single event queue in virtual time.
+ *
+ *         The radio model is a unit disk graph with independent per-link
+ *         loss. Frames that overlap in time at a receiver corrupt each
+ *         other, and a node cannot receive while it transmits. Whether a
+ *         unicast is acked is decided when it is sent, so a collision that
+ *         starts after that point is not seen by the sender. Every node's
+ *         clock starts at zero when it boots, like on a real mote.
+ *
+ *         At the end of the run the same figures as stats/analyze are
+ *         printed, and with dissem.c nodes how long it took the file to
+ *         reach them. With -o, node output is written in the format of a
+ *         Cooja raw.log so that the other scripts in stats/ can be used.
+ *
+ *         Nodes run without duty cycling. With -c, how long ContikiMAC
+ *         would have kept each radio on for the same traffic is estimated
+ *         from the timings in contikimac.c, either as it is or with
+ *         CONTIKIMAC_CONF_ADAPTIVE driven by the load the nodes report. It
+ *         is a model, so use it to compare runs rather than as a figure
+ *         for real motes.
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <dlfcn.h>
+#include <ftw.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/* 250 kbit/s, and preamble, SFD and length bytes in front of every frame */
+#define BYTE_US           32
+#define PHY_OVERHEAD      6
+#define MAX_FRAME         256
+
+/* ContikiMAC at 8 Hz (see contikimac.c), in microseconds */
+#define CM_CYCLE          125000
+#define CM_HALF           (CM_CYCLE / 2)
+#define CM_CCA            122                    /* radio on for one CCA */
+#define CM_CHECK          (2 * (CM_CCA + 500))   /* CHECK_TIME */
+#define CM_CCA_TX         (6 * CM_CCA)           /* CCAs before sending */
+#define CM_GUARD          (10 * CM_CHECK + 6 * (CM_CCA + 500))
+#define CM_PHASE_STROBE   16667                  /* MAX_PHASE_STROBE_TIME */
+#define CM_SHORTEST       43                     /* SHORTEST_PACKET_SIZE */
+#define CM_HOLD           2000000                /* ADAPTIVE_HOLD */
+#define CM_BUSY           30                     /* ADAPTIVE_BUSY */
+#define CM_MAX_SKIP       4                      /* ADAPTIVE_MAX_SKIP */
+
+/* check periods in half cycles, as in contikimac.c */
+#define PERIOD_BUSY       1
+#define PERIOD_CYCLE      2
+#define PERIOD_MAX        (2 * CM_MAX_SKIP)
+
+enum rdc_mode {
+  RDC_NONE,
+  RDC_PLAIN,
+  RDC_ADAPTIVE,
+};
+
+enum event_type {
+  EV_BOOT,
+  EV_WAKEUP,
+  EV_RX,
+  EV_LOCATE,
+};
+
+struct rx {
+  struct rx *next;
+  uint64_t start;
+  uint64_t end;
+  int corrupt;
+  int lost;
+  unsigned short len;
+  uint8_t data[MAX_FRAME];
+};
+
+struct node {
+  unsigned short id;
+  int sink;
+  int x, y;
+
+  char fsroot[64];
+  void *image;
+  sim_init_f init;
+  sim_set_time_f set_time;
+  sim_run_f run;
+  sim_next_wakeup_f next_wakeup;
+  sim_input_f input;
+  sim_serial_input_f serial_input;
+
+  uint64_t boot;
+  uint64_t wakeup;
+  uint64_t tx_until;
+  struct rx *rx;
+
+  int *nbrs;
+  int nnbrs;
+
+  /* ContikiMAC model, see -c */
+  uint64_t phase;
+  int period;
+  int announced;
+  uint64_t hold_until;
+  uint64_t accounted;
+  double checks;
+  uint64_t on_tx;
+  uint64_t on_rx;
+};
+
+struct event {
+  uint64_t time;
+  uint64_t seq;
+  enum event_type type;
+  struct node *n;
+  struct rx *rx;
+};
+
+static struct node *nodes;
+static int nnodes;
+
+static struct event *heap;
+static int heaplen, heapsize;
+static uint64_t seq;
+static uint64_t now;
+
+static double loss;
+static uint64_t rng;
+static FILE *logfile;
+static int verbose;
+
+static enum rdc_mode rdc;
+/* per sender and receiver: whether the sender knows the receiver's phase,
+ * and whether it assumes the longest period after a missing ack */
+static unsigned char *locked;
+static unsigned char *assume_max;
+
+static struct {
+  unsigned long packets;
+  unsigned long bytes;
+  unsigned long published;
+  unsigned long got;
+  unsigned long aggregated;
+  unsigned long collisions;
+  /* unicasts the ContikiMAC model would not have got through */
+  unsigned long rdc_missed;
+  /* set by dissem.c nodes */
+  uint64_t dissem_start;
+  unsigned long dissem_done;
+  uint64_t dissem_total;
+  uint64_t dissem_last;
+} stats;
+/*---------------------------------------------------------------------------*/
+/* xorshift64*, so that runs do not depend on the host libc */
+static double
+prng(void)
+{
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (double)((rng * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+/*---------------------------------------------------------------------------*/
+static int
+before(struct event *a, struct event *b)
+{
+  return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void
+schedule(uint64_t time, enum event_type type, struct node *n, struct rx *rx)
+{
+  struct event e = { time, seq++, type, n, rx };
+  int i;
+
+  if(heaplen == heapsize) {
+    heapsize = heapsize ? 2 * heapsize : 64;
+    heap = realloc(heap, heapsize * sizeof(struct event));
+  }
+
+  for(i = heaplen++; i > 0 && before(&e, &heap[(i - 1) / 2]); i = (i - 1) / 2) {
+    heap[i] = heap[(i - 1) / 2];
+  }
+  heap[i] = e;
+}
+
+static struct event
+next_event(void)
+{
+  struct event top = heap[0];
+  struct event last = heap[--heaplen];
+  int i = 0, c;
+
+  while((c = 2 * i + 1) < heaplen) {
+    if(c + 1 < heaplen && before(&heap[c + 1], &heap[c])) {
+      c++;
+    }
+    if(!before(&heap[c], &last)) {
+      break;
+    }
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = last;
+  return top;
+}
+/*---------------------------------------------------------------------------*/
+/* let a node process whatever the last event caused, and note when it next
+ * needs to run */
+static void
+settle(struct node *n)
+{
+  unsigned long next;
+  uint64_t t;
+
+  n->run();
+
+  next = n->next_wakeup();
+  if(next == 0) {
+    n->wakeup = 0;
+    return;
+  }
+
+  t = n->boot + (uint64_t)next * 1000;
+  if(t < now) {
+    t = now;
+  }
+  if(t != n->wakeup) {
+    n->wakeup = t;
+    schedule(t, EV_WAKEUP, n, NULL);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* the period neighbours strobe for, as adaptive_announcement(). Every node
+ * is assumed to have heard the latest one */
+static int
+rdc_announcement(struct node *n)
+{
+  if(n->period == PERIOD_BUSY) {
+    return n->announced == PERIOD_BUSY ? PERIOD_BUSY : PERIOD_CYCLE;
+  }
+  return n->period;
+}
+
+/* the check period a node runs at, as adaptive_current() */
+static int
+rdc_period(struct node *n, uint64_t t)
+{
+  int p = rdc_announcement(n);
+
+  if(p != PERIOD_BUSY) {
+    p = p < n->announced ? p : n->announced;
+    if(p < PERIOD_CYCLE) {
+      p = PERIOD_CYCLE;
+    }
+  }
+  if(t < n->hold_until && p > PERIOD_CYCLE) {
+    p = PERIOD_CYCLE;
+  }
+  return p;
+}
+
+/* add up the channel checks of n until the given time */
+static void
+rdc_account(struct node *n, uint64_t until)
+{
+  uint64_t end;
+
+  while(n->accounted < until) {
+    end = until;
+    if(n->accounted < n->hold_until && n->hold_until < until) {
+      end = n->hold_until;
+    }
+    n->checks += 2.0 * (end - n->accounted) /
+      rdc_period(n, n->accounted) / CM_CYCLE;
+    n->accounted = end;
+  }
+}
+
+static void
+rdc_hold(struct node *n)
+{
+  rdc_account(n, now);
+  if(rdc == RDC_ADAPTIVE) {
+    n->hold_until = now + CM_HOLD;
+  }
+}
+
+/* the first channel check of n at or after t. Skipped cycles are counted
+ * from the phase rather than from the last check */
+static uint64_t
+rdc_next_check(struct node *n, uint64_t t)
+{
+  uint64_t j = 0;
+  int p;
+
+  if(t > n->phase) {
+    j = (t - n->phase + CM_HALF - 1) / CM_HALF;
+  }
+  for(;; j++) {
+    p = rdc_period(n, n->phase + j * CM_HALF);
+    if(p == PERIOD_BUSY || j % p == 0) {
+      return n->phase + j * CM_HALF;
+    }
+  }
+}
+
+/* neighbours that wake up while we strobe listen to one copy per check */
+static void
+rdc_overhear(struct node *s, struct node *r, uint64_t from, uint64_t until,
+             uint64_t air)
+{
+  struct node *o;
+  uint64_t t;
+  int i, heard;
+
+  for(i = 0; i < s->nnbrs; i++) {
+    o = &nodes[s->nbrs[i]];
+    if(o == r || o->boot > now) {
+      continue;
+    }
+    heard = 0;
+    for(t = rdc_next_check(o, from); t < until; t = rdc_next_check(o, t + 1)) {
+      o->on_rx += air + air / 2;
+      heard = 1;
+    }
+    if(heard && r == NULL) {
+      rdc_hold(o);
+    }
+  }
+}
+
+/* what ContikiMAC would have spent on a frame that was sent at now, to r
+ * or to everyone if r is NULL */
+static void
+rdc_transmit(struct node *s, struct node *r, int acked, unsigned short len)
+{
+  uint64_t air = (uint64_t)((len > CM_SHORTEST ? len : CM_SHORTEST) +
+                            PHY_OVERHEAD) * BYTE_US;
+  uint64_t from = now, until, check;
+  int p = PERIOD_CYCLE;
+  int i, pair;
+
+  rdc_hold(s);
+
+  /* neighbours hear our announcement in this frame */
+  for(i = 0; i < s->nnbrs; i++) {
+    assume_max[s->nbrs[i] * nnodes + (s - nodes)] = 0;
+  }
+
+  if(r == NULL) {
+    for(i = 0; i < s->nnbrs; i++) {
+      if(rdc_announcement(&nodes[s->nbrs[i]]) > p) {
+        p = rdc_announcement(&nodes[s->nbrs[i]]);
+      }
+    }
+    until = from + p * CM_HALF + 2 * CM_CHECK;
+    s->on_tx += CM_CCA_TX + (until - from);
+    rdc_overhear(s, NULL, from, until, air);
+    s->announced = s->period;
+    return;
+  }
+
+  pair = (s - nodes) * nnodes + (r - nodes);
+  p = assume_max[pair] ? PERIOD_MAX : rdc_announcement(r);
+  until = from + p * CM_HALF + 2 * CM_CHECK;
+  if(locked[pair]) {
+    /* as phase_wait(), wait until just before the receiver's next cycle */
+    check = r->phase;
+    if(now > r->phase) {
+      check += (now - r->phase + CM_CYCLE - 1) / CM_CYCLE * CM_CYCLE;
+    }
+    if(check - now > CM_GUARD) {
+      from = check - CM_GUARD;
+    }
+    if(p <= PERIOD_CYCLE) {
+      until = from + CM_PHASE_STROBE;
+    } else {
+      until = from + p * CM_HALF + 2 * CM_CHECK;
+    }
+  }
+
+  check = r->boot > now ? until : rdc_next_check(r, from);
+  if(check < until) {
+    until = check + air;
+    if(acked) {
+      r->on_rx += air + air / 2;
+      rdc_hold(r);
+      locked[pair] = 1;
+    }
+  } else if(acked) {
+    stats.rdc_missed++;
+  }
+  if(!acked) {
+    assume_max[pair] = rdc == RDC_ADAPTIVE;
+  }
+  s->on_tx += CM_CCA_TX + (until - from);
+  rdc_overhear(s, r, from, check < until ? check : until, air);
+}
+/*---------------------------------------------------------------------------*/
+static int
+hook_channel_clear(void *ctx)
+{
+  struct node *n = ctx;
+  struct rx *rx;
+
+  for(rx = n->rx; rx != NULL; rx = rx->next) {
+    if(rx->start <= now && rx->end > now) {
+      return 0;
+    }
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+overlaps(struct rx *a, struct rx *b)
+{
+  return a->start < b->end && b->start < a->end;
+}
+
+static int
+hook_transmit(void *ctx, const void *data, unsigned short len, unsigned short to)
+{
+  struct node *s = ctx;
+  struct node *r;
+  struct rx *rx, *o;
+  uint64_t start, end;
+  int acked = 0;
+  int i;
+
+  if(len > MAX_FRAME) {
+    return SIM_TX_COLLISION;
+  }
+
+  /* the radio does a CCA before it sends */
+  if(!hook_channel_clear(s)) {
+    return SIM_TX_COLLISION;
+  }
+
+  stats.packets++;
+  stats.bytes += len;
+
+  /* a node sends its frames back to back, never on top of each other */
+  start = s->tx_until > now ? s->tx_until : now;
+  end = start + (uint64_t)(len + PHY_OVERHEAD) * BYTE_US;
+  s->tx_until = end;
+
+  /* half duplex */
+  for(o = s->rx; o != NULL; o = o->next) {
+    if(o->end > start) {
+      o->corrupt = 1;
+    }
+  }
+
+  for(i = 0; i < s->nnbrs; i++) {
+    r = &nodes[s->nbrs[i]];
+
+    rx = calloc(1, sizeof(struct rx));
+    rx->start = start;
+    rx->end = end;
+    rx->lost = loss > 0 && prng() < loss;
+    rx->corrupt = r->tx_until > start;
+    rx->len = len;
+    memcpy(rx->data, data, len);
+
+    for(o = r->rx; o != NULL; o = o->next) {
+      if(overlaps(o, rx)) {
+        if(!o->corrupt) {
+          stats.collisions++;
+        }
+        o->corrupt = 1;
+        rx->corrupt = 1;
+      }
+    }
+
+    rx->next = r->rx;
+    r->rx = rx;
+    schedule(end, EV_RX, r, rx);
+
+    if(r->id == to && !rx->lost && !rx->corrupt) {
+      acked = 1;
+    }
+  }
+
+  if(rdc != RDC_NONE) {
+    rdc_transmit(s, to == SIM_BROADCAST ? NULL : &nodes[to - 1], acked, len);
+  }
+
+  if(to == SIM_BROADCAST || acked) {
+    return SIM_TX_OK;
+  }
+  return SIM_TX_NOACK;
+}
+/*---------------------------------------------------------------------------*/
+static void
+hook_log(void *ctx, const char *line)
+{
+  struct node *n = ctx;
+
+  if(strncmp(line, "publish:", 8) == 0) {
+    stats.published++;
+  } else if(strncmp(line, "got:", 4) == 0) {
+    stats.got++;
+  } else if(strcmp(line, "node: aggregated") == 0) {
+    stats.aggregated++;
+  } else if(strncmp(line, "dissem: start", 13) == 0) {
+    stats.dissem_start = now;
+  } else if(strcmp(line, "dissem: done") == 0) {
+    stats.dissem_done++;
+    stats.dissem_total += now - stats.dissem_start;
+    stats.dissem_last = now - stats.dissem_start;
+  } else if(strcmp(line, "acquiring position...") == 0) {
+    schedule(now, EV_LOCATE, n, NULL);
+  }
+
+  if(logfile != NULL) {
+    fprintf(logfile, "%llu\tID:%u\t%s\n",
+            (unsigned long long)(now / 1000), n->id, line);
+  }
+  if(verbose) {
+    printf("%8.3f %3u: %s\n", now / 1e6, n->id, line);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* as contikimac_set_load() */
+static void
+hook_load(void *ctx, unsigned short relayed, unsigned char flows)
+{
+  struct node *n = ctx;
+
+  if(rdc != RDC_ADAPTIVE) {
+    return;
+  }
+  rdc_account(n, now);
+  if(relayed >= CM_BUSY) {
+    n->period = PERIOD_BUSY;
+  } else if(relayed > 0 || flows > 0) {
+    n->period = 2 * (CM_MAX_SKIP / 2);
+  } else {
+    n->period = PERIOD_MAX;
+  }
+}
+
+static const struct sim_hooks hooks = {
+  hook_transmit,
+  hook_channel_clear,
+  hook_log,
+  hook_load,
+};
+/*---------------------------------------------------------------------------*/
+static void
+deliver(struct node *n, struct rx *rx)
+{
+  struct rx **p;
+
+  for(p = &n->rx; *p != rx; p = &(*p)->next);
+  *p = rx->next;
+
+  if(!rx->corrupt && !rx->lost) {
+    n->input(rx->data, rx->len);
+  }
+  free(rx);
+}
+/*---------------------------------------------------------------------------*/
+static void *
+sym(struct node *n, const char *name)
+{
+  void *f = dlsym(n->image, name);
+  if(f == NULL) {
+    fprintf(stderr, "node %u: %s\n", n->id, dlerror());
+    exit(1);
+  }
+  return f;
+}
+
+/* dlopen only maps a given file once, so every node gets its own copy. The
+ * node also gets a directory of its own for CFS */
+static void
+load(struct node *n, const char *image, const char *dir)
+{
+  char path[512];
+  char buf[65536];
+  FILE *in, *out;
+  size_t len;
+
+  snprintf(n->fsroot, sizeof(n->fsroot), "%s/node-%u", dir, n->id);
+  if(mkdir(n->fsroot, 0700) != 0) {
+    perror(n->fsroot);
+    exit(1);
+  }
+
+  snprintf(path, sizeof(path), "%s/node-%u.sim", dir, n->id);
+  in = fopen(image, "rb");
+  out = fopen(path, "wb");
+  if(in == NULL || out == NULL) {
+    perror(in == NULL ? image : path);
+    exit(1);
+  }
+  while((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+    fwrite(buf, 1, len, out);
+  }
+  fclose(in);
+  fclose(out);
+
+  n->image = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  unlink(path);
+  if(n->image == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+
+  n->init = (sim_init_f)sym(n, "sim_init");
+  n->set_time = (sim_set_time_f)sym(n, "sim_set_time");
+  n->run = (sim_run_f)sym(n, "sim_run");
+  n->next_wakeup = (sim_next_wakeup_f)sym(n, "sim_next_wakeup");
+  n->input = (sim_input_f)sym(n, "sim_input");
+  n->serial_input = (sim_serial_input_f)sym(n, "sim_serial_input");
+}
+/*---------------------------------------------------------------------------*/
+static int
+remove_file(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+/*---------------------------------------------------------------------------*/
+static void
+place(const char *topology, int spacing, int range)
+{
+  int side = (int)ceil(sqrt(nnodes));
+  int i, j;
+  double dx, dy;
+
+  for(i = 0; i < nnodes; i++) {
+    if(strcmp(topology, "grid") == 0) {
+      nodes[i].x = (i % side) * spacing;
+      nodes[i].y = (i / side) * spacing;
+    } else {
+      nodes[i].x = (int)(prng() * side * spacing);
+      nodes[i].y = (int)(prng() * side * spacing);
+    }
+  }
+
+  for(i = 0; i < nnodes; i++) {
+    nodes[i].nbrs = malloc(nnodes * sizeof(int));
+    for(j = 0; j < nnodes; j++) {
+      dx = nodes[i].x - nodes[j].x;
+      dy = nodes[i].y - nodes[j].y;
+      if(i != j && dx * dx + dy * dy <= (double)range * range) {
+        nodes[i].nbrs[nodes[i].nnbrs++] = j;
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_duty_cycle(unsigned long duration)
+{
+  uint64_t end = (uint64_t)duration * 1000000;
+  double idle = 0, tx = 0, rx = 0, on, max = 0;
+  struct node *n;
+  int i, booted = 0;
+
+  for(i = 0; i < nnodes; i++) {
+    n = &nodes[i];
+    if(n->boot >= end) {
+      continue;
+    }
+    booted++;
+    rdc_account(n, end);
+    idle += n->checks * 2 * CM_CCA / (end - n->boot);
+    tx += (double)n->on_tx / (end - n->boot);
+    rx += (double)n->on_rx / (end - n->boot);
+    on = (n->checks * 2 * CM_CCA + n->on_tx + n->on_rx) / (end - n->boot);
+    if(on > max) {
+      max = on;
+    }
+  }
+  printf("Radio on (%s ContikiMAC model): mean %.2f%%, max %.2f%% "
+         "(checks %.2f%%, tx %.2f%%, rx %.2f%%), %lu unicasts missed\n",
+         rdc == RDC_PLAIN ? "plain" : "adaptive",
+         100 * (idle + tx + rx) / booted, 100 * max,
+         100 * idle / booted, 100 * tx / booted, 100 * rx / booted,
+         stats.rdc_missed);
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n NODES     number of nodes, including sinks (25)\n"
+          "  -k SINKS     number of sinks (1)\n"
+          "  -t TOPOLOGY  grid or random (grid)\n"
+          "  -s SPACING   distance between grid neighbours (30)\n"
+          "  -r RANGE     radio range (50)\n"
+          "  -l LOSS      probability that a frame is lost on a link (0)\n"
+          "  -d SECONDS   simulated time (600)\n"
+          "  -S SEED      seed for placement, loss and boot times (1)\n"
+          "  -N IMAGE     node image (./node.sim)\n"
+          "  -K IMAGE     sink image (./sink.sim)\n"
+          "  -o FILE      write node output as a Cooja raw.log\n"
+          "  -c MAC       estimate the radio duty cycle of ContikiMAC, plain\n"
+          "               or adaptive (CONTIKIMAC_CONF_ADAPTIVE)\n"
+          "  -v           print node output\n",
+          prog);
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *topology = "grid";
+  const char *node_image = "./node.sim";
+  const char *sink_image = "./sink.sim";
+  int sinks = 1, spacing = 30, range = 50;
+  unsigned long duration = 600, seed = 1;
+  char dir[] = "/tmp/subnet-sim.XXXXXX";
+  struct event e;
+  struct node *n;
+  int i, opt;
+
+  nnodes = 25;
+  while((opt = getopt(argc, argv, "n:k:t:s:r:l:d:S:N:K:o:c:v")) != -1) {
+    switch(opt) {
+    case 'n': nnodes = atoi(optarg); break;
+    case 'k': sinks = atoi(optarg); break;
+    case 't': topology = optarg; break;
+    case 's': spacing = atoi(optarg); break;
+    case 'r': range = atoi(optarg); break;
+    case 'l': loss = atof(optarg); break;
+    case 'd': duration = strtoul(optarg, NULL, 10); break;
+    case 'S': seed = strtoul(optarg, NULL, 10); break;
+    case 'N': node_image = optarg; break;
+    case 'K': sink_image = optarg; break;
+    case 'o':
+      logfile = fopen(optarg, "w");
+      if(logfile == NULL) {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'c':
+      if(strcmp(optarg, "plain") == 0) {
+        rdc = RDC_PLAIN;
+      } else if(strcmp(optarg, "adaptive") == 0) {
+        rdc = RDC_ADAPTIVE;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'v': verbose = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if(nnodes < 1 || sinks > nnodes || nnodes > 0xffff ||
+     (strcmp(topology, "grid") != 0 && strcmp(topology, "random") != 0)) {
+    usage(argv[0]);
+  }
+
+  rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+  nodes = calloc(nnodes, sizeof(struct node));
+  place(topology, spacing, range);
+  locked = calloc((size_t)nnodes * nnodes, 1);
+  assume_max = calloc((size_t)nnodes * nnodes, 1);
+
+  if(mkdtemp(dir) == NULL) {
+    perror(dir);
+    return 1;
+  }
+  for(i = 0; i < nnodes; i++) {
+    n = &nodes[i];
+    n->id = i + 1;
+    n->sink = i < sinks;
+    load(n, n->sink ? sink_image : node_image, dir);
+    /* motes do not all power up at the same instant, and their clocks
+     * start counting when they do */
+    n->boot = (uint64_t)(prng() * 1000000);
+    schedule(n->boot, EV_BOOT, n, NULL);
+    /* the first cycle starts when ContikiMAC is initialized at boot */
+    n->phase = n->accounted = n->boot + CM_CYCLE;
+    n->period = n->announced = PERIOD_CYCLE;
+  }
+
+  while(heaplen > 0 && heap[0].time <= (uint64_t)duration * 1000000) {
+    e = next_event();
+    n = e.n;
+    if(e.type == EV_WAKEUP && e.time != n->wakeup) {
+      /* superseded by a later reschedule */
+      continue;
+    }
+
+    now = e.time;
+    n->set_time((now - n->boot) / 1000);
+
+    switch(e.type) {
+    case EV_BOOT:
+      n->init(n->id, n->fsroot, &hooks, n);
+      break;
+    case EV_WAKEUP:
+      n->wakeup = 0;
+      break;
+    case EV_RX:
+      deliver(n, e.rx);
+      break;
+    case EV_LOCATE:
+      {
+        char coord[16];
+        snprintf(coord, sizeof(coord), "%d", n->x);
+        n->serial_input(coord);
+        snprintf(coord, sizeof(coord), "%d", n->y);
+        n->serial_input(coord);
+      }
+      break;
+    }
+    settle(n);
+  }
+
+  printf("Number of packets: %lu\n", stats.packets);
+  printf("Total bytes sent: %lu\n", stats.bytes);
+  printf("Reading ratio: ");
+  if(stats.published > stats.aggregated) {
+    printf("%.1f", 100.0 * stats.got / (stats.published - stats.aggregated));
+  } else {
+    printf("-");
+  }
+  printf("%% (%lu published, %lu received, %lu aggregated)\n",
+         stats.published, stats.got, stats.aggregated);
+  printf("Collisions: %lu\n", stats.collisions);
+  if(rdc != RDC_NONE) {
+    print_duty_cycle(duration);
+  }
+  if(stats.dissem_start > 0) {
+    printf("Disseminated to: %lu of %d nodes", stats.dissem_done, nnodes - 1);
+    if(stats.dissem_done > 0) {
+      printf(", mean %.1f s, last %.1f s",
+             stats.dissem_total / 1e6 / stats.dissem_done,
+             stats.dissem_last / 1e6);
+    }
+    printf("\n");
+  }
+
+  if(logfile != NULL) {
+    fclose(logfile);
+  }
+  nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+  return 0;
+}
@@ -0,0 +1,38 @@
+/**
+ * \file
+ *         Binary frames the sink writes delivered readings to the host in
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ *
+ * Every frame is sent as a single SLIP frame and is laid out as
+ *
+ *   type | sequence | readings | reading... | crc16
+ *
+ * where each reading is its sensor (enum reading_type), x, y and value. All
+ * multi-byte fields are little-endian, and the CRC (see core/lib/crc16.c)
+ * covers everything before it. The sequence number goes up by one for every
+ * frame, so the host can tell how many frames the serial line lost.
+ */
+#ifndef __SINK_FRAME_H__
+#define __SINK_FRAME_H__
+
+/* first byte of frames with readings. Other frames on the same line, such as
+ * debug output, are skipped by the host */
+#define SINK_FRAME_TYPE 'R'
+
+#define SINK_FRAME_HEADER 3
+#define SINK_FRAME_READING 7
+#define SINK_FRAME_CRC 2
+
+/* readings are written out once this many have been collected, or when the
+ * packet they came in has been handled */
+#ifdef SINK_CONF_FRAME_READINGS
+#define SINK_FRAME_READINGS SINK_CONF_FRAME_READINGS
+#else
+#define SINK_FRAME_READINGS 8
+#endif
+
+#define SINK_FRAME_SIZE(n) \
+  (SINK_FRAME_HEADER + (n) * SINK_FRAME_READING + SINK_FRAME_CRC)
+
+#endif /* __SINK_FRAME_H__ */
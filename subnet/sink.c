@@ -10,26 +10,150 @@
 #include "subnet-config.h"
 #include <stdio.h>
 #include <string.h>
+
+/* whether delivered readings are written to the serial line as binary frames
+ * (see sink-frame.h) instead of "got:" lines. tools/subnet-decode turns them
+ * back into CSV on the host. Needs a platform with a SLIP driver, like sky */
+#ifdef SINK_CONF_BINARY
+#define SINK_BINARY SINK_CONF_BINARY
+#else
+#define SINK_BINARY 0
+#endif
+
+/* whether delivered readings are also kept in an Antelope relation that can be
+ * queried over the serial line (see store.h). Set by building with
+ * SINK_STORE=1 */
+#ifdef SINK_CONF_STORE
+#define SINK_STORE SINK_CONF_STORE
+#else
+#define SINK_STORE 0
+#endif
+
+/* whether to also subscribe to vibration spectra. They are printed as
+ * "got:" lines even with SINK_BINARY, as frames only carry single values */
+#ifdef SINK_CONF_VIBRATION
+#define SINK_VIBRATION SINK_CONF_VIBRATION
+#else
+#define SINK_VIBRATION 0
+#endif
+
+#if SINK_STORE
+#include "store.h"
+#endif
+#if SINK_BINARY
+#include "dev/slip.h"
+#include "lib/crc16.h"
+#include "sink-frame.h"
+#endif
 /*---------------------------------------------------------------------------*/
 #define MAX(a,b) (a>b?a:b)
 #define MIN_DEVIATION 10
+/* a band has to change by a factor 4 in power for a new spectrum to be sent */
+#define MIN_SPECTRAL_CHANGE 8
+/*---------------------------------------------------------------------------*/
+#if SINK_BINARY
+static uint8_t frame[SINK_FRAME_SIZE(SINK_FRAME_READINGS)];
+static uint8_t framed;
+static uint8_t seq;
+
+static uint8_t *put_short(uint8_t *p, uint16_t v) {
+  *p++ = v & 0xff;
+  *p++ = v >> 8;
+  return p;
+}
+
+static void write_frame(void) {
+  uint8_t len = SINK_FRAME_HEADER + framed * SINK_FRAME_READING;
+
+  frame[0] = SINK_FRAME_TYPE;
+  frame[1] = seq++;
+  frame[2] = framed;
+  put_short(frame + len, crc16_data(frame, len, 0));
+  slip_write(frame, len + SINK_FRAME_CRC);
+  framed = 0;
+}
+
+static void frame_reading(enum reading_type sensor, const struct locshort *r) {
+  uint8_t *p = frame + SINK_FRAME_HEADER + framed * SINK_FRAME_READING;
+
+  *p++ = sensor;
+  p = put_short(p, r->location.x);
+  p = put_short(p, r->location.y);
+  put_short(p, r->value);
+
+  if (++framed == SINK_FRAME_READINGS) {
+    write_frame();
+  }
+}
+#endif
+static void print_spectrum(const void *reading) {
+  vibration v;
+  uint8_t i;
+
+  memcpy(&v, reading, sizeof(vibration));
+  printf("got: vibration @ <%03d, %03d> = %d", v.location.x, v.location.y, v.peak);
+  for (i = 0; i < SPECTRUM_BANDS; i++) {
+    printf(" %d", v.bands[i]);
+  }
+  printf("\n");
+}
 /*---------------------------------------------------------------------------*/
-static void on_reading(subid_t subid, void *data) {
-  const struct subscription *s = subscriber_subscription(subid);
+static void on_readings(uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]) {
+  const struct subscription *s;
   struct locshort r;
-  memcpy(&r, data, sizeof(struct locshort));
-  switch (s->sensor) {
-    case READING_HUMIDITY:
-    {
-      printf("got: humidity @ <%03d, %03d> = %d\n", r.location.x, r.location.y, r.value);
-      break;
+  const char *sensor;
+  uint8_t i, j, n = 0;
+#if SINK_STORE
+  enum reading_type sensors[STORE_BATCH];
+  struct locshort stored[STORE_BATCH];
+  uint8_t batched = 0;
+#endif
+
+  for (i = 0; i < groups; i++) {
+    s = subscriber_subscription(subids[i]);
+    switch (s->sensor) {
+      case READING_HUMIDITY:
+        sensor = "humidity";
+        break;
+      case READING_PRESSURE:
+        sensor = "pressure";
+        break;
+      default:
+        sensor = NULL;
     }
-    case READING_PRESSURE:
-    {
-      printf("got: pressure @ <%03d, %03d> = %d\n", r.location.x, r.location.y, r.value);
-      break;
+
+    for (j = 0; j < counts[i]; j++, n++) {
+      if (s->sensor == READING_VIBRATION) {
+        print_spectrum(readings[n]);
+      } else if (sensor != NULL) {
+        memcpy(&r, readings[n], sizeof(struct locshort));
+#if SINK_STORE
+        sensors[batched] = s->sensor;
+        stored[batched] = r;
+        if (++batched == STORE_BATCH) {
+          store_readings(sensors, stored, batched);
+          batched = 0;
+        }
+#endif
+#if SINK_BINARY
+        frame_reading(s->sensor, &r);
+#else
+        printf("got: %s @ <%03d, %03d> = %d\n", sensor, r.location.x, r.location.y, r.value);
+#endif
+      }
     }
   }
+
+#if SINK_STORE
+  if (batched > 0) {
+    store_readings(sensors, stored, batched);
+  }
+#endif
+#if SINK_BINARY
+  if (framed > 0) {
+    write_frame();
+  }
+#endif
 }
 /*---------------------------------------------------------------------------*/
 PROCESS(sink_process, "Sink");
@@ -41,13 +165,21 @@ PROCESS_THREAD(sink_process, ev, data)
 
   PROCESS_BEGIN();
 
+#if SINK_STORE
+  if (!store_open()) {
+    printf("store: cannot open database, readings will not be kept\n");
+  }
+#endif
+
   /* initialize subscriber */
-  subscriber_start(&on_reading);
+  subscriber_start_batch(&on_readings);
 
   /* no special stuff here */
   s.soft.filter = DEVIATION;
   s.soft.arg.deviation = MIN_DEVIATION;
   s.hard.filter = NO_HARD_FILTER;
+  s.scope.radius = 0;
+  s.priority = SUBNET_PRIORITY_BULK;
   s.aggregator.aggregator = LOCATION_AVG;
   s.aggregator.arg.maxdist = 25;
 
@@ -63,6 +195,17 @@ PROCESS_THREAD(sink_process, ev, data)
   subscriber_subscribe(&s);
   printf("subscribed to pressure\n");
 
+#if SINK_VIBRATION
+  /* spectra are already small, and cannot be averaged */
+  s.interval = 30*CLOCK_SECOND;
+  s.sensor = READING_VIBRATION;
+  s.soft.filter = SPECTRAL_CHANGE;
+  s.soft.arg.spectral = MIN_SPECTRAL_CHANGE;
+  s.aggregator.aggregator = NO_AGGREGATION;
+  subscriber_subscribe(&s);
+  printf("subscribed to vibration\n");
+#endif
+
   PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
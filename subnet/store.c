@@ -0,0 +1,194 @@
+/**
+ * \file
+ *         Keeps readings delivered to a sink in an Antelope relation
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ */
+
+#include "store.h"
+#include "antelope.h"
+#include "relation.h"
+#include "storage.h"
+#include "dev/serial-line.h"
+#include <stdio.h>
+#include <string.h>
+
+#define DEBUG 0
+#if DEBUG
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/* attributes in the order they are stored in */
+enum {
+  STORE_TIME,
+  STORE_SENSOR,
+  STORE_X,
+  STORE_Y,
+  STORE_VALUE,
+  STORE_ATTRIBUTES
+};
+/*---------------------------------------------------------------------------*/
+/* the relation is kept loaded, so that storing a packet of readings does not
+ * have to open its files again */
+static relation_t *rel;
+/* added to clock_seconds() so that time keeps increasing across reboots, as
+ * the inline index needs */
+static long epoch;
+/*---------------------------------------------------------------------------*/
+PROCESS(store_query_process, "Reading store queries");
+/*---------------------------------------------------------------------------*/
+static bool create(void) {
+  static const char *const schema[] = {
+    "CREATE RELATION " STORE_RELATION ";",
+    "CREATE ATTRIBUTE time DOMAIN LONG IN " STORE_RELATION ";",
+    "CREATE ATTRIBUTE sensor DOMAIN INT IN " STORE_RELATION ";",
+    "CREATE ATTRIBUTE x DOMAIN INT IN " STORE_RELATION ";",
+    "CREATE ATTRIBUTE y DOMAIN INT IN " STORE_RELATION ";",
+    "CREATE ATTRIBUTE value DOMAIN LONG IN " STORE_RELATION ";",
+    "CREATE INDEX " STORE_RELATION ".time TYPE INLINE;",
+#if DB_FEATURE_COFFEE
+    /* the heap index reads its files before writing them, so they have to be
+     * reserved up front */
+    "CREATE INDEX " STORE_RELATION ".x TYPE MAXHEAP;",
+#endif
+  };
+  uint8_t i;
+
+  for (i = 0; i < sizeof(schema) / sizeof(schema[0]); i++) {
+    if (DB_ERROR(db_query(NULL, schema[i]))) {
+      PRINTF("store: %s failed\n", schema[i]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* the time of the last stored reading, or -1 if there is none */
+static long last_time(void) {
+  unsigned char row[rel->row_length];
+  attribute_value_t value;
+  tuple_id_t last = relation_cardinality(rel);
+
+  if (last == 0 || last == INVALID_TUPLE) {
+    return -1;
+  }
+
+  last--;
+  if (storage_get_row(rel, &last, row) != DB_OK ||
+      DB_ERROR(relation_get_value(rel, list_head(rel->attributes), row, &value))) {
+    return -1;
+  }
+
+  return VALUE_LONG(&value);
+}
+/*---------------------------------------------------------------------------*/
+bool store_open(void) {
+  long last;
+
+  db_init();
+  db_set_output_function(printf);
+
+  rel = relation_load(STORE_RELATION);
+  if (rel == NULL) {
+    PRINTF("store: creating relation\n");
+    if (!create()) {
+      db_query(NULL, "REMOVE RELATION " STORE_RELATION ";");
+      return false;
+    }
+    rel = relation_load(STORE_RELATION);
+    if (rel == NULL) {
+      return false;
+    }
+  }
+
+  last = last_time();
+  epoch = last < 0 ? 0 : last + 1 - (long)clock_seconds();
+  PRINTF("store: %lu readings kept, time starts at %ld\n",
+      (unsigned long)relation_cardinality(rel), epoch + (long)clock_seconds());
+
+  process_start(&store_query_process, NULL);
+  return true;
+}
+
+uint8_t store_readings(const enum reading_type sensors[], const struct locshort readings[], uint8_t n) {
+  attribute_value_t values[STORE_ATTRIBUTES];
+  uint8_t i;
+
+  if (rel == NULL) {
+    return 0;
+  }
+
+  values[STORE_TIME].domain = DOMAIN_LONG;
+  VALUE_LONG(&values[STORE_TIME]) = epoch + (long)clock_seconds();
+  values[STORE_SENSOR].domain = DOMAIN_INT;
+  values[STORE_X].domain = DOMAIN_INT;
+  values[STORE_Y].domain = DOMAIN_INT;
+  values[STORE_VALUE].domain = DOMAIN_LONG;
+
+  for (i = 0; i < n; i++) {
+    VALUE_INT(&values[STORE_SENSOR]) = sensors[i];
+    VALUE_INT(&values[STORE_X]) = readings[i].location.x;
+    VALUE_INT(&values[STORE_Y]) = readings[i].location.y;
+    VALUE_LONG(&values[STORE_VALUE]) = readings[i].value;
+
+    if (DB_ERROR(relation_insert(rel, values))) {
+      PRINTF("store: failed to store reading %d of %d\n", i, n);
+      break;
+    }
+  }
+
+  return i;
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(store_query_process, ev, data)
+{
+  static db_handle_t handle;
+  static tuple_id_t matching;
+  db_result_t result;
+
+  PROCESS_BEGIN();
+
+  for (;;) {
+    PROCESS_WAIT_EVENT_UNTIL(ev == serial_line_event_message && data != NULL);
+
+    result = db_query(&handle, (char *)data);
+    if (DB_ERROR(result)) {
+      printf("db: query error: %s\n", db_get_result_message(result));
+      db_free(&handle);
+      continue;
+    }
+
+    if (!db_processing(&handle)) {
+      printf("db: ok\n");
+      continue;
+    }
+
+    printf("db: ");
+    db_print_header(&handle);
+
+    /* readings keep arriving while the query runs */
+    matching = 0;
+    while (db_processing(&handle)) {
+      PROCESS_PAUSE();
+
+      result = db_process(&handle);
+      if (result == DB_GOT_ROW) {
+        matching++;
+        printf("db: ");
+        db_print_tuple(&handle);
+      } else if (result == DB_FINISHED) {
+        printf("db: %lu rows\n", (unsigned long)matching);
+        db_free(&handle);
+      } else if (DB_ERROR(result)) {
+        printf("db: processing error: %s\n", db_get_result_message(result));
+        db_free(&handle);
+      }
+    }
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
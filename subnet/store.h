@@ -0,0 +1,49 @@
+/**
+ * \file
+ *         Keeps readings delivered to a sink in an Antelope relation
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ *
+ * Readings are stored in the relation STORE_RELATION as
+ * (time, sensor, x, y, value), where time is in seconds and keeps counting
+ * across reboots. time has an inline index and, on Coffee, x has a max-heap
+ * index, so AQL queries over a recent time window or a strip of the
+ * deployment are answered without scanning the whole relation. Queries are read from the
+ * serial line, one per line, e.g.
+ *
+ *   SELECT x, y, value FROM readings WHERE time > 3600 AND sensor = 0;
+ *
+ * and the results are printed with a "db: " prefix.
+ */
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include "contiki.h"
+#include "subnet-config.h"
+#include <stdbool.h>
+
+#define STORE_RELATION "readings"
+
+/* most readings a caller needs to collect before calling store_readings */
+#define STORE_BATCH 16
+
+/**
+ * \brief Open the relation, creating it if it does not exist yet, and start
+ *        answering queries from the serial line
+ * \return True if readings can be stored
+ */
+bool store_open(void);
+
+/**
+ * \brief Store the readings delivered in a single packet
+ * \param sensors Sensor of each reading
+ * \param readings The readings
+ * \param n Number of readings
+ * \return Number of readings stored
+ *
+ * All readings are given the same time. Storing them together is much
+ * cheaper than running an INSERT query for each.
+ */
+uint8_t store_readings(const enum reading_type sensors[], const struct locshort readings[], uint8_t n);
+
+#endif /* __STORE_H__ */
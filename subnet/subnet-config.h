@@ -12,20 +12,35 @@ struct locshort {
 };
 typedef struct locshort humidity;
 typedef struct locshort pressure;
+
+/* features of a window of vibration samples (see lib/fft.h), published in
+ * place of the samples themselves */
+#define SPECTRUM_BANDS 4
+struct spectrum {
+  struct location location;
+  unsigned char peak;                  /* strongest frequency bin */
+  unsigned char bands[SPECTRUM_BANDS]; /* level of each band, from fft_level */
+};
+typedef struct spectrum vibration;
 /*---------------------------------------------------------------------------*/
 /* middleware types */
 enum reading_type {
   READING_HUMIDITY,
   READING_PRESSURE,
+  READING_VIBRATION,
 };
 
 enum soft_filter  {
   NO_SOFT_FILTER,
-  DEVIATION
+  DEVIATION,
+  SPECTRAL_CHANGE
 };
 
 union soft_arg {
   short deviation;
+  /* how much a band level has to change, or the peak move, for a spectrum
+   * to be published */
+  short spectral;
 };
 
 enum hard_filter {
@@ -37,6 +52,9 @@ union hard_arg {
   struct location loc;
 };
 
+/* how close a node has to be to pass the BE_CLOSE_TO filter */
+#define CLOSE_TO_DISTANCE 10
+
 enum aggregator_t {
   NO_AGGREGATION,
   LOCATION_AVG
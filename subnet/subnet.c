@@ -14,7 +14,15 @@
 #include "net/rime/subnet.h"
 #include "net/rime.h"
 #include "net/rime/disclose.h"
+#include "cfs/cfs.h"
+#include "sys/energest.h"
+#include "lib/random.h"
 #include <string.h>
+#if SUBNET_CHECKPOINT
+#if SUBNET_CHECKPOINT_COFFEE
+#include "cfs/cfs-coffee.h"
+#endif
+#endif
 
 static const struct packetbuf_attrlist attributes[] = {
     SUBNET_ATTRIBUTES
@@ -38,25 +46,97 @@ static const struct packetbuf_attrlist attributes[] = {
 #define SKIPBYTES(VAR, TYPE, BYTES) \
   /* note the cast to char* to be able to move in bytes */       \
   VAR = (TYPE)(((char*) VAR)+BYTES);
+
+#if SUBNET_COUNTERS
+#define COUNT(C, FIELD) ((C)->counters.FIELD++)
+#define COUNT_N(C, FIELD, N) ((C)->counters.FIELD += (N))
+#define COUNT_MAX(C, FIELD, V) \
+  if ((V) > (C)->counters.FIELD) (C)->counters.FIELD = (V);
+#else
+#define COUNT(C, FIELD)
+#define COUNT_N(C, FIELD, N)
+#define COUNT_MAX(C, FIELD, V)
+#endif
 /*---------------------------------------------------------------------------*/
 /* private functions */
 static short find_sinkid(struct subnet_conn *c, const rimeaddr_t *sink);
-static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route, const rimeaddr_t *prevto);
-static void broadcast(struct disclose_conn *c);
+static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route, const rimeaddr_t *prevto, const rimeaddr_t *first);
+static void broadcast(struct subnet_conn *c);
+static void transmit(struct subnet_conn *c, struct disclose_conn *via, const rimeaddr_t *to);
+static void count_traffic(struct subnet_conn *c, struct disclose_conn *via, bool sent);
 static bool is_known(struct subnet_conn *c, short sinkid, subid_t subid);
 static void notify_left(struct subnet_conn *c, const rimeaddr_t *sink);
 static void handle_leaving(struct subnet_conn *c, const rimeaddr_t *sink);
 static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const rimeaddr_t *from);
 static void handle_subscriptions(struct subnet_conn *c, const rimeaddr_t *sink, const rimeaddr_t *from);
 static bool inject_packetbuf(subid_t subid, dlen_t bytes, uint8_t *fragments, dlen_t *buflen, void *payload, void *buf);
-static void prepare_packetbuf(uint8_t type, const rimeaddr_t *sink, uint8_t hops);
+static void prepare_packetbuf(struct subnet_conn *c, uint8_t type, const rimeaddr_t *sink, uint8_t hops);
+static uint8_t sink_epoch(struct subnet_conn *c, const rimeaddr_t *sink);
+static bool check_epoch(struct subnet_conn *c, const rimeaddr_t *sink);
+static void new_epoch(struct subnet_conn *c);
+static void locate_packetbuf(struct subnet_conn *c);
+static const struct position *packet_position(void);
+static struct neighbor *find_neighbor(struct subnet_conn *c, const rimeaddr_t *addr);
+static uint8_t energy_level(void);
+static void hear_energy(struct subnet_conn *c, const rimeaddr_t *from);
+static uint16_t hop_metric(const struct sink_neighbor *hop);
+static bool hop_before(const struct sink_neighbor *a, const struct sink_neighbor *b);
+static bool is_first_hop(struct sink *route, const rimeaddr_t *from);
+struct batch;
+static void deliver(struct subnet_conn *c, short sinkid, subid_t subid, void *payload, struct batch *b);
+static void collect(struct batch *b, subid_t subid, void *payload);
+static void deliver_batch(struct subnet_conn *c, short sinkid, struct batch *b);
+static void checkpoint_sink(struct subnet_conn *c, short sinkid);
+static void restore(struct subnet_conn *c);
+static void publish(struct subnet_conn *c, short sinkid, struct sink *buf, uint8_t priority);
+static void solicit(struct subnet_conn *c, short sinkid);
+static void offer_route(void *ptr);
+static void hold_refresh(struct subnet_conn *c, short sinkid);
+static void send_refresh(void *ptr);
+static void enqueue(struct subnet_conn *c, struct disclose_conn *via, const rimeaddr_t *to, uint8_t priority, clock_time_t since);
+static void dequeue(struct subnet_conn *c, uint8_t i);
+static void record_latency(struct subnet_conn *c, struct subnet_queued *q);
+static short next_queued(struct subnet_conn *c, const rimeaddr_t *to);
+static short find_sent(struct subnet_conn *c, const rimeaddr_t *to);
+static void send_queued(struct subnet_conn *c, uint8_t i);
+static void flush(void *ptr);
 
 static void on_peer(struct disclose_conn *disclose, const rimeaddr_t *from);
 static void on_recv(struct disclose_conn *disclose, const rimeaddr_t *from);
+static void ask_peer(struct subnet_conn *c, const rimeaddr_t *sink, short sinkid, const rimeaddr_t *from);
+static bool relay_unknown(struct subnet_conn *c, const rimeaddr_t *sink, short sinkid, subid_t subid);
 static void on_hear(struct disclose_conn *disclose, const rimeaddr_t *from);
 static void on_sent(struct disclose_conn *disclose, int status);
 /*---------------------------------------------------------------------------*/
 /* private members */
+/**
+ * \brief Readings for this sink collected from a single packet
+ */
+#define SUBNET_MAX_READINGS (PACKETBUF_SIZE / sizeof(struct fragment))
+struct batch {
+  uint8_t n;
+  subid_t subids[SUBNET_MAX_READINGS];
+  void *readings[SUBNET_MAX_READINGS];
+};
+#if SUBNET_CHECKPOINT
+/**
+ * \brief On-flash copy of a single entry in the sink table
+ */
+struct sink_record {
+  uint8_t magic;
+  uint8_t revoked;
+  rimeaddr_t sink;
+  uint8_t epoch;
+  uint8_t advertised_cost;
+  uint8_t numhops;
+  struct {
+    rimeaddr_t addr;
+    uint8_t cost;
+  } nexthops[SUBNET_MAX_ALTERNATE_ROUTES];
+};
+#define SINK_RECORD_MAGIC 0x5b
+#endif
+
 static const struct disclose_callbacks subnet = {
   on_recv,
   on_hear,
@@ -80,15 +160,44 @@ void subnet_open(struct subnet_conn *c,
   channel_set_attributes(peerchannel, attributes);
   c->u = u;
   c->subid = 0;
+  c->myid = -1;
+  c->epoch = 0;
   c->numsinks = 0;
   c->writeout = -1;
+  c->urgentsink = -1;
+  c->urgent.fragments = 0;
+  c->urgent.buflen = 0;
+  memset(c->latency, 0, sizeof(c->latency));
+  c->located = false;
+  c->solicitsink = -1;
+  c->queued = 0;
+  c->macfull = false;
+  c->refreshed = NULL;
+  memset(&c->bursts, 0, sizeof(struct subnet_burst_stats));
+  c->relayed = 0;
+#if SUBNET_COUNTERS
+  memset(&c->counters, 0, sizeof(struct subnet_counters));
+#endif
+  restore(c);
 }
 
 void subnet_close(struct subnet_conn *c) {
-  prepare_packetbuf(SUBNET_PACKET_TYPE_LEAVING, &rimeaddr_node_addr, 0);
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_LEAVING, &rimeaddr_node_addr, 0);
 
   /* TODO: perhaps do this multiple times for good measure? */
-  broadcast(&c->pubsub);
+  broadcast(c);
+
+  /* nothing will report back on queued packets after this */
+  ctimer_stop(&c->flush);
+  ctimer_stop(&c->repair);
+  ctimer_stop(&c->refresh);
+  if (c->refreshed != NULL) {
+    queuebuf_free(c->refreshed);
+    c->refreshed = NULL;
+  }
+  while (c->queued > 0) {
+    dequeue(c, 0);
+  }
 
   disclose_close(&c->pubsub);
   disclose_close(&c->peer);
@@ -110,15 +219,125 @@ bool subnet_add_data(struct subnet_conn *c, short sinkid, subid_t subid, void *p
     s = &c->sinks[sinkid];
   }
 
+  if (s->fragments == 0) {
+    s->since = clock_time();
+  }
+
   bool n = inject_packetbuf(subid, bytes, &s->fragments, &s->buflen, payload, s->buf+s->buflen);
   if (!n) {
     PRINTF("subnet: packet is full\n");
+    COUNT(c, dropped);
+    return false;
+  }
+
+  COUNT(c, added);
+  COUNT_MAX(c, buffer_hwm, s->buflen);
+  return true;
+}
+
+bool subnet_add_urgent_data(struct subnet_conn *c, short sinkid, subid_t subid, void *payload, dlen_t bytes) {
+  struct sink *s = &c->urgent;
+  PRINTF("subnet: adding urgent data for %d:%d\n", sinkid, subid);
+
+  if (sinkid >= c->numsinks) {
+    PRINTF("subnet: invalid sink id\n");
     return false;
   }
 
+  /* there is only one urgent buffer, so send what is there for another sink */
+  if (s->fragments > 0 && c->urgentsink != sinkid) {
+    publish(c, c->urgentsink, s, SUBNET_PRIORITY_HIGH);
+  }
+
+  if (s->fragments == 0) {
+    c->urgentsink = sinkid;
+    s->since = clock_time();
+  }
+
+  if (!inject_packetbuf(subid, bytes, &s->fragments, &s->buflen, payload, s->buf+s->buflen)) {
+    PRINTF("subnet: urgent packet is full, sending it\n");
+    publish(c, sinkid, s, SUBNET_PRIORITY_HIGH);
+    s->since = clock_time();
+    if (!inject_packetbuf(subid, bytes, &s->fragments, &s->buflen, payload, s->buf+s->buflen)) {
+      COUNT(c, dropped);
+      return false;
+    }
+  }
+
+  COUNT(c, added);
+  COUNT_MAX(c, buffer_hwm, s->buflen);
+
+  /* the urgent buffer is published by flush */
+  ctimer_set(&c->flush, 0, flush, c);
   return true;
 }
 
+bool subnet_add_shared_data(struct subnet_conn *c, uint8_t targets, short sinkids[], subid_t subids[], void *payload, dlen_t bytes) {
+  const rimeaddr_t *hops[targets];
+  bool grouped[targets];
+  char buf[PACKETBUF_SIZE];
+  struct shared_header *h = (struct shared_header *) buf;
+  struct shared_target *t;
+  bool added = true;
+  uint8_t i, j;
+  /* targets a shared fragment has room for, both in buf and in a packet */
+  const short space = PACKETBUF_SIZE - sizeof(struct fragment) - sizeof(struct shared_header) - bytes;
+  const short room = space > 0 ? space / sizeof(struct shared_target) : 0;
+
+  PRINTF("subnet: adding shared data for %d targets\n", targets);
+
+  for (i = 0; i < targets; i++) {
+    grouped[i] = false;
+    hops[i] = NULL;
+    if (sinkids[i] >= 0 && sinkids[i] < c->numsinks) {
+      hops[i] = get_next_hop(c, &c->sinks[sinkids[i]], NULL, NULL);
+    }
+  }
+
+  for (i = 0; i < targets; i++) {
+    if (grouped[i]) continue;
+    grouped[i] = true;
+
+    h->targets = 1;
+    h->length = bytes;
+    t = (struct shared_target *) (buf + sizeof(struct shared_header) + bytes);
+
+    /* find later targets that are reached through the same next hop, as
+     * many as fit; the rest get a fragment of their own further on */
+    for (j = i + 1; j < targets && hops[i] != NULL && h->targets < room; j++) {
+      if (grouped[j] || hops[j] == NULL || !rimeaddr_cmp(hops[i], hops[j])) {
+        continue;
+      }
+
+      if (h->targets == 1) {
+        rimeaddr_copy(&t->sink, &c->sinks[sinkids[i]].sink);
+        t->subid = subids[i];
+        t++;
+      }
+
+      rimeaddr_copy(&t->sink, &c->sinks[sinkids[j]].sink);
+      t->subid = subids[j];
+      t++;
+      h->targets++;
+      grouped[j] = true;
+    }
+
+    if (h->targets == 1) {
+      /* route does not coincide with any other, so no need to share */
+      added = subnet_add_data(c, sinkids[i], subids[i], payload, bytes) && added;
+      continue;
+    }
+
+    PRINTF("subnet: sharing fragment between %d sinks via %d.%d\n",
+        h->targets, hops[i]->u8[0], hops[i]->u8[1]);
+    memcpy(h+1, payload, bytes);
+    COUNT_N(c, merged, h->targets - 1);
+    added = subnet_add_data(c, sinkids[i], SUBNET_SHARED_SUBID, buf, ((char *) t) - buf) && added;
+  }
+
+  return added;
+}
+
 void subnet_writeout(struct subnet_conn *c, short sinkid) {
   PRINTF("subnet: enabling writeout buffer\n");
   c->writeout = sinkid;
@@ -132,6 +351,20 @@ void subnet_writein(struct subnet_conn *c) {
   if (c->writeout == -1) return;
 
   s = &c->sinks[c->writeout];
+
+  /* relayed readings for subscriptions we do not know were not written out */
+  EACH_SINK_FRAGMENT(s,
+    if (frag->length > 0 && relay_unknown(c, &s->sink, c->writeout, subid) &&
+        !inject_packetbuf(subid, frag->length, &c->writesink.fragments, &c->writesink.buflen,
+                          payload, c->writesink.buf + c->writesink.buflen)) {
+      PRINTF("subnet: no room to keep relayed reading for %d\n", subid);
+      COUNT(c, dropped);
+    }
+  );
+
+  if (s->fragments == 0) {
+    s->since = c->writesink.since;
+  }
   s->fragments = c->writesink.fragments;
   s->buflen = c->writesink.buflen;
   memcpy(s->buf, c->writesink.buf, c->writesink.buflen);
@@ -146,50 +379,12 @@ void subnet_publish(struct subnet_conn *c, short sinkid) {
     return;
   }
 
-  struct sink *s = &c->sinks[sinkid];
-  const rimeaddr_t *nexthop = get_next_hop(c, s, NULL);
-
-  if (nexthop == NULL) {
-    PRINTF("subnet: no next hop known\n");
-
-    if (c->u->errpub != NULL) {
-      c->u->errpub(c);
-    }
-    return;
-  }
-
-  prepare_packetbuf(SUBNET_PACKET_TYPE_PUBLISH, &s->sink, s->advertised_cost);
-  packetbuf_set_attr(PACKETBUF_ATTR_EFRAGMENTS, s->fragments);
-  memcpy(packetbuf_dataptr(), s->buf, s->buflen);
-  packetbuf_set_datalen(s->buflen);
-
-#if DEBUG
-  PRINTF("subnet: publishing %d bytes to %d.%d via %d.%d\n",
-      s->buflen,
-      s->sink.u8[0], s->sink.u8[1],
-      nexthop->u8[0], nexthop->u8[1]
-      );
-
-  EACH_PACKET_FRAGMENT(
-    PRINTF("        fragment %d is %d bytes for %d...\n", fragi, frag->length, subid);
-  );
-#endif
-
-  /* store publish packet */
-  c->sentpacket = queuebuf_new_from_packetbuf();
-  PRINTF("subnet: publish buffered\n");
-
-  disclose_send(&c->pubsub, nexthop);
-
-  PRINTF("subnet: publish sent to NIC, resetting\n");
-
-  /* reset sink packetbuf */
-  s->buflen = 0;
-  s->fragments = 0;
+  publish(c, sinkid, &c->sinks[sinkid], SUBNET_PRIORITY_BULK);
 }
 
 subid_t subnet_subscribe(struct subnet_conn *c, void *payload, dlen_t bytes) {
   if (subnet_myid(c) == -1) {
+    new_epoch(c);
     PRINTF("subnet: injecting sink into sink table\n");
     update_routes(c, &rimeaddr_node_addr, &rimeaddr_null);
   }
@@ -201,7 +396,7 @@ subid_t subnet_subscribe(struct subnet_conn *c, void *payload, dlen_t bytes) {
 }
 
 void subnet_resubscribe(struct subnet_conn *c, subid_t subid, void *payload, dlen_t bytes) {
-  prepare_packetbuf(SUBNET_PACKET_TYPE_SUBSCRIBE, &rimeaddr_node_addr, 0);
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_SUBSCRIBE, &rimeaddr_node_addr, 0);
   inject_packetbuf(subid, bytes, NULL, NULL, payload, NULL);
 
   if (!is_known(c, subnet_myid(c), subid)) {
@@ -210,7 +405,10 @@ void subnet_resubscribe(struct subnet_conn *c, subid_t subid, void *payload, dle
     // handle_subscriptions will take care of the broadcast
   } else {
     PRINTF("subnet: re-broadcasting subscription %d\n", subid);
-    broadcast(&c->pubsub);
+    /* with the hop count the first flood had, so that no costs change */
+    packetbuf_set_attr(PACKETBUF_ATTR_HOPS, 1);
+    locate_packetbuf(c);
+    broadcast(c);
   }
 }
 
@@ -232,7 +430,7 @@ short subnet_packetlen(struct subnet_conn *c, short sinkid) {
 }
 
 void subnet_unsubscribe(struct subnet_conn *c, subid_t subid) {
-  prepare_packetbuf(SUBNET_PACKET_TYPE_UNSUBSCRIBE, &rimeaddr_node_addr, 0);
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_UNSUBSCRIBE, &rimeaddr_node_addr, 0);
   inject_packetbuf(subid, 0, NULL, NULL, NULL, NULL);
 
   if (is_known(c, subnet_myid(c), subid)) {
@@ -241,16 +439,44 @@ void subnet_unsubscribe(struct subnet_conn *c, subid_t subid) {
     // handle_subscriptions will take care of the broadcast
   } else {
     PRINTF("subnet: re-broadcasting unsubscription for %d\n", subid);
-    broadcast(&c->pubsub);
+    broadcast(c);
   }
 }
 
 short subnet_myid(struct subnet_conn *c) {
-  static short myid = -1;
-  if (myid == -1) {
-    myid = find_sinkid(c, &rimeaddr_node_addr);
+  if (c->myid == -1) {
+    c->myid = find_sinkid(c, &rimeaddr_node_addr);
+  }
+  return c->myid;
+}
+
+void subnet_locate(struct subnet_conn *c, const struct position *position) {
+  PRINTF("subnet: located at <%d, %d>\n", position->x, position->y);
+  c->position = *position;
+  c->located = true;
+}
+
+const struct position *subnet_position(struct subnet_conn *c) {
+  return c->located ? &c->position : NULL;
+}
+
+const struct subnet_burst_stats *subnet_burst_stats(struct subnet_conn *c) {
+  return &c->bursts;
+}
+
+const struct subnet_latency_stats *subnet_latency_stats(struct subnet_conn *c, uint8_t priority) {
+  if (priority >= SUBNET_PRIORITIES) {
+    return NULL;
   }
-  return myid;
+  return &c->latency[priority];
+}
+
+const struct subnet_counters *subnet_counters(struct subnet_conn *c) {
+#if SUBNET_COUNTERS
+  return &c->counters;
+#else
+  return NULL;
+#endif
 }
 
 struct fragment *next_fragment(struct fragment *frag, void **payload) {
@@ -263,6 +489,15 @@ struct fragment *next_fragment(struct fragment *frag, void **payload) {
   return next;
 }
 
+dlen_t shared_fragment_size(void *payload) {
+  struct shared_header *h = payload;
+  return sizeof(struct shared_header) + h->length + h->targets * sizeof(struct shared_target);
+}
+
+short subnet_sinkid(struct subnet_conn *c, const rimeaddr_t *sink) {
+  return find_sinkid(c, sink);
+}
+
 const struct sink *subnet_sink(struct subnet_conn *c, short sinkid) {
   return &c->sinks[sinkid];
 }
@@ -279,12 +514,82 @@ static short find_sinkid(struct subnet_conn *c, const rimeaddr_t *sink) {
   return -1;
 }
 
-static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route, const rimeaddr_t *prevto) {
+static struct neighbor *find_neighbor(struct subnet_conn *c, const rimeaddr_t *addr) {
+  short i;
+  for (i = 0; i < c->numneighbors; i++) {
+    if (rimeaddr_cmp(&c->neighbors[i].addr, addr)) {
+      return &c->neighbors[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* how much of its time this node has had the radio on since boot. Since all
+ * nodes start out with the same battery, this says how drained we are */
+static uint8_t energy_level(void) {
+  unsigned long all, radio, level;
+
+  energest_flush();
+  all = energest_type_time(ENERGEST_TYPE_CPU) + energest_type_time(ENERGEST_TYPE_LPM);
+  radio = energest_type_time(ENERGEST_TYPE_TRANSMIT) + energest_type_time(ENERGEST_TYPE_LISTEN);
+
+  /* also covers energest being disabled */
+  if (all < 1000) {
+    return 0;
+  }
+
+  level = radio / (all / 1000) / SUBNET_ENERGY_STEP;
+  return level > SUBNET_MAX_ENERGY ? SUBNET_MAX_ENERGY : level;
+}
+
+static void hear_energy(struct subnet_conn *c, const rimeaddr_t *from) {
+  struct neighbor *n = find_neighbor(c, from);
+  if (n != NULL) {
+    n->energy = packetbuf_attr(PACKETBUF_ATTR_ENERGY);
+  }
+}
+
+/* cost of sending through the given next hop in 1/16 hops, so that relays
+ * that have used a lot of energy are spared when there are alternatives */
+static uint16_t hop_metric(const struct sink_neighbor *hop) {
+  return (hop->cost << 4) + SUBNET_ENERGY_WEIGHT * hop->node->energy;
+}
+
+/* the order failover tries next hops in. Unlike hop_metric, this must not
+ * change while a packet is retried, so energy plays no part in it */
+static bool hop_before(const struct sink_neighbor *a, const struct sink_neighbor *b) {
+  if (a->cost != b->cost) return a->cost < b->cost;
+  return memcmp(&a->node->addr, &b->node->addr, sizeof(rimeaddr_t)) < 0;
+}
+
+/**
+ * Whether from is our first next hop to the sink in hop_before order, i.e.
+ * the one neighbour whose resubscriptions we pass on.
+ */
+static bool is_first_hop(struct sink *route, const rimeaddr_t *from) {
+  struct sink_neighbor *first = NULL;
+  int i;
+
+  for (i = 0; i < route->numhops; i++) {
+    if (first == NULL || hop_before(&route->nexthops[i], first)) {
+      first = &route->nexthops[i];
+    }
+  }
+  return first != NULL && rimeaddr_cmp(&first->node->addr, from);
+}
+
+/**
+ * Without prevto, returns the next hop with the lowest hop_metric. If sending
+ * through prevto failed, returns the hop after it in hop_before order, or the
+ * first in that order if prevto is the hop the packet was first sent
+ * through. first is never returned again, so every hop is tried once.
+ */
+static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route, const rimeaddr_t *prevto, const rimeaddr_t *first) {
   int i;
-  int previ = -1;
   int nexti = -1;
   struct sink_neighbor *n = NULL;
-  struct sink_neighbor *next;
+  struct sink_neighbor *next = NULL;
   struct sink_neighbor *this;
 
   if (route == NULL) {
@@ -297,44 +602,49 @@ static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route,
     return NULL;
   }
 
-  /* find neighbor pointer */
   if (prevto != NULL) {
+    /* find neighbor pointer, unless we're starting over after first */
+    if (first == NULL || !rimeaddr_cmp(prevto, first)) {
+      for (i = 0; i < route->numhops; i++) {
+        if (rimeaddr_cmp(&route->nexthops[i].node->addr, prevto)) {
+          PRINTF("subnet: found previous next hop neighbour entry\n");
+          n = &route->nexthops[i];
+          break;
+        }
+      }
+    }
+
     for (i = 0; i < route->numhops; i++) {
-      if (rimeaddr_cmp(&route->nexthops[i].node->addr, prevto)) {
-        PRINTF("subnet: found previous next hop neighbour entry\n");
-        previ = i;
-        n = &route->nexthops[i];
-        break;
+      this = &route->nexthops[i];
+      if (rimeaddr_cmp(&this->node->addr, prevto)) continue;
+      if (first != NULL && rimeaddr_cmp(&this->node->addr, first)) continue;
+      if (n != NULL && !hop_before(n, this)) continue;
+      if (next == NULL || hop_before(this, next)) {
+        next = this;
       }
     }
+
+    if (next == NULL) {
+      PRINTF("subnet: no next hop =(\n");
+      return NULL;
+    }
+
+    PRINTF("subnet: next hop to try is %d.%d\n", next->node->addr.u8[0], next->node->addr.u8[1]);
+    return &next->node->addr;
   }
 
   PRINTF("subnet: determining best next hop amongst:\n");
 
-  /* find next most expensive route after n */
-  next = n;
   for (i = 0; i < route->numhops; i++) {
     this = &route->nexthops[i];
 
-    PRINTF("        %d.%d (cost: %d, last_active: %d)\n"
+    PRINTF("        %d.%d (cost: %d, energy: %d, last_active: %d)\n"
         , this->node->addr.u8[0]
         , this->node->addr.u8[1]
         , this->cost
+        , this->node->energy
         , (int) this->node->last_active);
 
-    if (n != NULL) {
-      /* previous hop can't be next hop */
-      if (this == n) continue;
-
-      /* next hop can't be cheaper than previous hop (because then we'd already
-       * have tried it) */
-      if (this->cost < n->cost) continue;
-
-      /* nor can it be equally costly and before */
-      if (this->cost == n->cost && i < previ) continue;
-    }
-
-    /* any node that get's here is valid, so pick the best */
     /* if we don't have a best, then this is the best */
     if (next == NULL) {
       next = this;
@@ -343,12 +653,12 @@ static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route,
     }
 
     /* if this is closer, use it */
-    if (this->cost < next->cost) {
+    if (hop_metric(this) < hop_metric(next)) {
       next = this;
       nexti = i;
       continue;
     /* if it is further away, don't use it */
-    } else if (this->cost > next->cost) continue;
+    } else if (hop_metric(this) > hop_metric(next)) continue;
 
     /* if this is newer, use it */
     if (this->node->last_active < next->node->last_active) {
@@ -366,7 +676,7 @@ static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route,
     }
   }
 
-  if (next == n || next == NULL) {
+  if (next == NULL) {
     /* no next route found */
     PRINTF("subnet: no next hop =(\n");
     return NULL;
@@ -377,8 +687,30 @@ static const rimeaddr_t* get_next_hop(struct subnet_conn *c, struct sink *route,
   return &next->node->addr;
 }
 
-static void broadcast(struct disclose_conn *c) {
-  disclose_send(c, &rimeaddr_null);
+static void broadcast(struct subnet_conn *c) {
+  transmit(c, &c->pubsub, &rimeaddr_null);
+}
+
+static void transmit(struct subnet_conn *c, struct disclose_conn *via, const rimeaddr_t *to) {
+  /* set here since queued and forwarded packets may be old */
+  packetbuf_set_attr(PACKETBUF_ATTR_ENERGY, energy_level());
+  count_traffic(c, via, true);
+  disclose_send(via, to);
+}
+
+static void count_traffic(struct subnet_conn *c, struct disclose_conn *via, bool sent) {
+#if SUBNET_COUNTERS
+  uint8_t type = packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE);
+  struct subnet_traffic *t;
+
+  if (via == &c->peer && type != SUBNET_PACKET_TYPE_LEAVING) {
+    type += SUBNET_COUNT_REPLY;
+  }
+
+  t = sent ? &c->counters.sent[type] : &c->counters.received[type];
+  t->packets++;
+  t->bytes += packetbuf_datalen();
+#endif
 }
 
 /* because REVOKED subscriptions are still known */
@@ -389,8 +721,8 @@ static bool is_known(struct subnet_conn *c, short sinkid, subid_t subid) {
 
 static void notify_left(struct subnet_conn *c, const rimeaddr_t *sink) {
   /* this sink has been revoked, let neighbours know! */
-  prepare_packetbuf(SUBNET_PACKET_TYPE_LEAVING, sink, 0);
-  broadcast(&c->pubsub);
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_LEAVING, sink, 0);
+  broadcast(c);
 }
 
 static void handle_leaving(struct subnet_conn *c, const rimeaddr_t *sink) {
@@ -406,6 +738,7 @@ static void handle_leaving(struct subnet_conn *c, const rimeaddr_t *sink) {
   s->revoked = clock_seconds();
   s->numhops = 0;
   s->advertised_cost = 0;
+  checkpoint_sink(c, sinkid);
   notify_left(c, sink);
 }
 
@@ -418,6 +751,8 @@ static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const r
   struct sink_neighbor *replace;
   short cost = packetbuf_attr(PACKETBUF_ATTR_HOPS);
   int replacei = 0;
+  bool changed = false;
+  bool evicted = false;
 
   PRINTF("subnet: updating routing table\n");
 
@@ -452,18 +787,32 @@ static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const r
 
       memset(route, 0, sizeof(struct sink));
       rimeaddr_copy(&route->sink, sink);
-      if (rimeaddr_cmp(from, &rimeaddr_null)) {
+      /* not sink_epoch(), which would now find this zeroed entry */
+      route->epoch = rimeaddr_cmp(sink, &rimeaddr_node_addr) ? c->epoch : packetbuf_attr(PACKETBUF_ATTR_EEPOCH);
+      if (rimeaddr_cmp(from, &rimeaddr_null) || cost >= SUBNET_MAX_HOPS) {
         route->advertised_cost = 0;
       } else {
         route->advertised_cost = cost + 1;
       }
       PRINTF("subnet: advertised cost will be %d\n", route->advertised_cost);
+      changed = true;
     }
+  } else if (!rimeaddr_cmp(from, &rimeaddr_null) && !rimeaddr_cmp(sink, &rimeaddr_node_addr) &&
+             cost < SUBNET_MAX_HOPS &&
+             (route->advertised_cost == 0 || cost + 1 < route->advertised_cost)) {
+    /* routes to a restarted sink are rebuilt from scratch, and the first
+     * packet about a sink need not have come from our cheapest neighbour */
+    route->advertised_cost = cost + 1;
+    PRINTF("subnet: advertised cost will be %d\n", route->advertised_cost);
+    changed = true;
   }
 
   /* if we didn't hear this subscription from someone else, we're done */
   if (rimeaddr_cmp(from, &rimeaddr_null)) {
     PRINTF("subnet: we sent the packet, so no need to update neighbors\n");
+    if (changed) {
+      checkpoint_sink(c, route - c->sinks);
+    }
     return;
   }
 
@@ -486,6 +835,7 @@ static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const r
     if (c->numneighbors >= SUBNET_MAX_NEIGHBORS) {
       PRINTF("subnet: max neighbours limit hit\n");
       n = oldest;
+      evicted = true;
     } else {
       PRINTF("subnet: new neighbour node created for %d.%d\n", from->u8[0], from->u8[1]);
       n = &c->neighbors[c->numneighbors];
@@ -493,6 +843,8 @@ static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const r
     }
 
     rimeaddr_copy(&n->addr, from);
+    n->located = false;
+    n->energy = packetbuf_attr(PACKETBUF_ATTR_ENERGY);
   }
 
   n->last_active = clock_seconds();
@@ -500,7 +852,10 @@ static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const r
   /* find cheapest and oldest next hop towards sink */
   for (i = 0; i < route->numhops; i++) {
     if (rimeaddr_cmp(&route->nexthops[i].node->addr, from)) {
-      route->nexthops[i].cost = cost;
+      if (route->nexthops[i].cost != cost) {
+        route->nexthops[i].cost = cost;
+        changed = true;
+      }
       n = NULL;
     }
 
@@ -531,12 +886,43 @@ static void update_routes(struct subnet_conn *c, const rimeaddr_t *sink, const r
 
     replace->node = n;
     replace->cost = cost;
+    changed = true;
+  }
+
+  /* a next hop that is no longer cheaper than us could route back through
+   * us, so it has to go */
+  for (i = 0; i < route->numhops; ) {
+    if (route->nexthops[i].cost >= route->advertised_cost) {
+      PRINTF("subnet: %d.%d is no longer a next hop for %d.%d\n"
+          , route->nexthops[i].node->addr.u8[0]
+          , route->nexthops[i].node->addr.u8[1]
+          , sink->u8[0]
+          , sink->u8[1]);
+      route->numhops--;
+      route->nexthops[i] = route->nexthops[route->numhops];
+      changed = true;
+    } else {
+      i++;
+    }
+  }
+
+  if (evicted) {
+    /* routes through the evicted neighbour now go through the new one */
+    for (i = 0; i < c->numsinks; i++) {
+      checkpoint_sink(c, i);
+    }
+  } else if (changed) {
+    checkpoint_sink(c, route - c->sinks);
   }
 }
 
 static void handle_subscriptions(struct subnet_conn *c, const rimeaddr_t *sink, const rimeaddr_t *from) {
   bool subscribe = (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_SUBSCRIBE);
-  bool broadcasted = false;
+  bool changed = false;
+  bool forward = false;
+  bool refresh;
+  const struct position *frompos = NULL;
+  struct neighbor *n;
   short sinkid;
 
   if (c->u->exists == NULL) {
@@ -546,16 +932,69 @@ static void handle_subscriptions(struct subnet_conn *c, const rimeaddr_t *sink,
   update_routes(c, sink, from);
   sinkid = find_sinkid(c, sink);
 
+  /* The sink resubscribes now and then for nodes that missed the flood, e.g.
+   * because they booted later. Those are passed on away from the sink, by
+   * each node once: when they come from its first next hop. */
+  refresh = subscribe && sinkid != -1 && !rimeaddr_cmp(from, &rimeaddr_null) &&
+    is_first_hop(&c->sinks[sinkid], from);
+
+  /* remember where the sender is, or fall back to where it last said it was */
+  n = find_neighbor(c, from);
+  if (n != NULL) {
+    frompos = packet_position();
+    if (frompos != NULL) {
+      n->position = *frompos;
+      n->located = true;
+    } else if (n->located) {
+      frompos = &n->position;
+    }
+  }
+
   EACH_PACKET_FRAGMENT(
-    if (!is_known(c, sinkid, subid) == subscribe) {
-      if (!broadcasted) {
-        PRINTF("subnet: new subscription (%d) in packet, forwarding...\n", subid);
-        /* something changed, send new subscription to neighbours */
-        packetbuf_set_attr(PACKETBUF_ATTR_HOPS, packetbuf_attr(PACKETBUF_ATTR_HOPS)+1);
-        broadcast(&c->pubsub);
-        broadcasted = true;
+    if (!SUBNET_RESERVED_SUBID(subid) && (refresh || !is_known(c, sinkid, subid) == subscribe)) {
+      changed = changed || !is_known(c, sinkid, subid) == subscribe;
+      /* our own subscriptions and all unsubscriptions always go out */
+      if (!subscribe || rimeaddr_cmp(from, &rimeaddr_null) ||
+          c->u->forward == NULL || c->u->forward(c, sinkid, subid, payload, frompos)) {
+        forward = true;
       }
+    }
+  );
+
+  if (!changed && !refresh) {
+    /* a neighbour passed on what we hold back, ours would reach no one new */
+    if (subscribe && c->refreshed != NULL && sinkid == c->refreshsink) {
+      PRINTF("subnet: resubscription already passed on, dropping ours\n");
+      ctimer_stop(&c->refresh);
+      queuebuf_free(c->refreshed);
+      c->refreshed = NULL;
+    }
+    return;
+  }
+
+  if (forward && packetbuf_attr(PACKETBUF_ATTR_HOPS) + 1 >= SUBNET_MAX_HOPS) {
+    PRINTF("subnet: sink is too far away for our neighbours to route to, not forwarding\n");
+  } else if (forward) {
+    PRINTF("subnet: new or resent subscriptions in packet, forwarding...\n");
+    /* send subscriptions on to neighbours, with our cost if we know it */
+    if (refresh && c->sinks[sinkid].advertised_cost != 0) {
+      packetbuf_set_attr(PACKETBUF_ATTR_HOPS, c->sinks[sinkid].advertised_cost);
+    } else {
+      packetbuf_set_attr(PACKETBUF_ATTR_HOPS, packetbuf_attr(PACKETBUF_ATTR_HOPS)+1);
+    }
+    locate_packetbuf(c);
+    if (!changed) {
+      /* nothing in it is new to us, so nothing below to do either */
+      hold_refresh(c, sinkid);
+      return;
+    }
+    broadcast(c);
+  } else {
+    PRINTF("subnet: new subscriptions in packet are out of scope, not forwarding\n");
+  }
 
+  EACH_PACKET_FRAGMENT(
+    if (!SUBNET_RESERVED_SUBID(subid) && !is_known(c, sinkid, subid) == subscribe) {
       if (subscribe) {
         PRINTF("subnet: packet contained new subscription %d\n", subid);
         c->u->subscribe(c, sinkid, subid, payload);
@@ -574,8 +1013,37 @@ static void on_peer(struct disclose_conn *disclose, const rimeaddr_t *from) {
   struct subnet_conn *c = (struct subnet_conn *)(disclose-1);
   const rimeaddr_t *sink = packetbuf_addr(PACKETBUF_ADDR_ERECEIVER);
 
+  count_traffic(c, disclose, false);
+  hear_energy(c, from);
+  if (!check_epoch(c, sink)) {
+    return;
+  }
+
   if (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_ASK) {
     PRINTF("subnet: heard peer ask packet from %d.%d\n", from->u8[0], from->u8[1]);
+    if (rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &rimeaddr_null)) {
+      short sinkid = find_sinkid(c, sink);
+      struct sink *s;
+
+      PRINTF("subnet: %d.%d solicits a route cheaper than %d\n",
+          from->u8[0], from->u8[1], packetbuf_attr(PACKETBUF_ATTR_HOPS));
+
+      /* only a single offer is kept pending */
+      if (sinkid == -1 || c->solicitsink != -1) return;
+
+      s = &c->sinks[sinkid];
+      if (s->revoked != 0) return;
+      if (sinkid != c->myid && (s->numhops == 0 || s->advertised_cost == 0)) return;
+      if (s->advertised_cost >= packetbuf_attr(PACKETBUF_ATTR_HOPS)) return;
+
+      c->solicitsink = sinkid;
+      rimeaddr_copy(&c->solicitor, from);
+      ctimer_set(&c->repair,
+          SUBNET_SOLICIT_DELAY > 0 ? random_rand() % SUBNET_SOLICIT_DELAY : 0,
+          offer_route, c);
+      return;
+    }
+
     if (c->u->inform == NULL) {
       return;
     }
@@ -619,7 +1087,7 @@ static void on_peer(struct disclose_conn *disclose, const rimeaddr_t *from) {
         unknown[i] = *(revoked+i);
       }
 
-      prepare_packetbuf(SUBNET_PACKET_TYPE_REPLY, sink, s->advertised_cost);
+      prepare_packetbuf(c, SUBNET_PACKET_TYPE_REPLY, sink, s->advertised_cost);
 
       frag = packetbuf_dataptr();
       dlen_t sz = 0;
@@ -647,69 +1115,203 @@ static void on_peer(struct disclose_conn *disclose, const rimeaddr_t *from) {
     }
 
     /* packetbuf now holds info about subscription */
-    disclose_send(&c->peer, from);
+    enqueue(c, &c->peer, from, SUBNET_PRIORITY_BULK, clock_time());
 
   } else if (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_REPLY) {
+    short sinkid = find_sinkid(c, sink);
+    bool tous = rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &rimeaddr_node_addr);
+    struct sink *s;
+
     PRINTF("subnet: heard peer reply packet from %d.%d\n", from->u8[0], from->u8[1]);
+
+    if (c->solicitsink != -1 && c->solicitsink == sinkid &&
+        rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &c->solicitor) &&
+        packetbuf_attr(PACKETBUF_ATTR_HOPS) <= c->sinks[sinkid].advertised_cost) {
+      PRINTF("subnet: %d.%d was offered a route as good as ours already\n",
+          c->solicitor.u8[0], c->solicitor.u8[1]);
+      ctimer_stop(&c->repair);
+      c->solicitsink = -1;
+    }
+
     handle_subscriptions(c, sink, from);
+
+    if (tous && sinkid != -1) {
+      s = &c->sinks[sinkid];
+      /* data kept back when all routes failed can go out right away */
+      if (s->solicited != 0 && clock_time() - s->solicited < SUBNET_SOLICIT_INTERVAL &&
+          s->fragments > 0 && c->writeout != sinkid && get_next_hop(c, s, NULL, NULL) != NULL) {
+        PRINTF("subnet: route to %d.%d repaired, publishing\n", s->sink.u8[0], s->sink.u8[1]);
+        COUNT(c, repairs);
+        publish(c, sinkid, s, SUBNET_PRIORITY_BULK);
+      }
+    }
   } else if (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_LEAVING) {
     PRINTF("subnet: heard peer leaving packet from %d.%d\n", from->u8[0], from->u8[1]);
     handle_leaving(c, sink);
   }
 }
 
+/**
+ * Asks the node a publish came from about the subscriptions in it that we do
+ * not know, or know to be revoked. Only the next hop a publish was sent to can
+ * do this: other neighbours may not get unicasts at all, since the CC2420
+ * drops frames for other nodes whenever it acks in hardware.
+ */
+static void ask_peer(struct subnet_conn *c, const rimeaddr_t *sink, short sinkid, const rimeaddr_t *from) {
+  short fragments = packetbuf_attr(PACKETBUF_ATTR_EFRAGMENTS);
+  struct peer_packet p = { 0, 0 };
+  uint8_t epoch;
+  dlen_t written = sizeof(struct peer_packet);
+
+  subid_t revoked[fragments];
+  subid_t unknown[fragments];
+
+  if (c->u->exists == NULL) {
+    PRINTF("subnet: no exists function in callback, not asking\n");
+    return;
+  }
+
+  EACH_PACKET_FRAGMENT(
+    if (subid == SUBNET_SHARED_SUBID) {
+      /* shared fragments name their subscriptions in the payload */
+    } else if (sinkid == -1) {
+      unknown[p.unknown++] = subid;
+    } else {
+      switch (c->u->exists(c, sinkid, subid)) {
+      case REVOKED:
+        revoked[p.revoked++] = subid;
+        break;
+      case UNKNOWN:
+        unknown[p.unknown++] = subid;
+        break;
+      case KNOWN:
+        break;
+      }
+    }
+  );
+
+  PRINTF("subnet: packet contains %d unknown and %d revoked subscriptions\n",
+      p.unknown,
+      p.revoked);
+
+  if (p.unknown == 0 && p.revoked == 0) {
+    return;
+  }
+
+  /* base attrs and length struct, for the epoch we just heard */
+  epoch = packetbuf_attr(PACKETBUF_ATTR_EEPOCH);
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_ASK, sink, 0);
+  packetbuf_set_attr(PACKETBUF_ATTR_EEPOCH, epoch);
+  memcpy(packetbuf_dataptr(), &p, sizeof(struct peer_packet));
+
+  /* write revoked */
+  memcpy(packetbuf_dataptr() + written, revoked, p.revoked * sizeof(subid_t));
+  written += p.revoked * sizeof(subid_t);
+
+  /* write unknown */
+  memcpy(packetbuf_dataptr() + written, unknown, p.unknown * sizeof(subid_t));
+  packetbuf_set_datalen(written + p.unknown * sizeof(subid_t));
+
+  enqueue(c, &c->peer, from, SUBNET_PRIORITY_BULK, clock_time());
+}
+
+/**
+ * Whether readings for subid must be relayed without handing them to the
+ * application, because we are not the sink and have not learned the
+ * subscription yet.
+ */
+static bool relay_unknown(struct subnet_conn *c, const rimeaddr_t *sink, short sinkid, subid_t subid) {
+  return subid != SUBNET_SHARED_SUBID
+    && c->u->exists != NULL
+    && !rimeaddr_cmp(sink, &rimeaddr_node_addr)
+    && c->u->exists(c, sinkid, subid) == UNKNOWN;
+}
+
 /**
  * This is called when a downstream node sends a publish message to us as next
- * hop to forward towards the sink, so forward. Subscription must be known to us
- * here since otherwise we wouldn't be next hop.
+ * hop to forward towards the sink, so forward. If we do not know some of the
+ * subscriptions in it (e.g. after a restart), the sender is asked about them
+ * and their readings are relayed unchanged in the meantime.
  */
 static void on_recv(struct disclose_conn *disclose, const rimeaddr_t *from) {
   struct subnet_conn *c = (struct subnet_conn *)disclose;
   const rimeaddr_t *sink = packetbuf_addr(PACKETBUF_ADDR_ERECEIVER);
   short sinkid;
-  struct sink *s;
   char buf[PACKETBUF_SIZE];
+  short nfrags;
+  struct batch b;
+  struct batch *batch = NULL;
 
   PRINTF("subnet: got publish packet from downstream node %d.%d\n", from->u8[0], from->u8[1]);
-  if (c->u->ondata == NULL) {
+  count_traffic(c, disclose, false);
+  hear_energy(c, from);
+  if (c->u->ondata == NULL || !check_epoch(c, sink)) {
     return;
   }
 
   sinkid = find_sinkid(c, sink);
-  if (sinkid == -1) return;
-
-  s = &c->sinks[sinkid];
-  if (s->revoked != 0) {
+  if (sinkid != -1 && c->sinks[sinkid].revoked != 0) {
     notify_left(c, sink);
     return;
   }
 
-  PRINTF("subnet: incoming packet has %d fragments\n", packetbuf_attr(PACKETBUF_ATTR_EFRAGMENTS));
-
-  // use a buffer to allow ondata to use the packetbuf (e.g. decide to send)
+  // readings and fragment count are read from buf from here on
   memcpy(buf, packetbuf_dataptr(), packetbuf_datalen());
+  nfrags = packetbuf_attr(PACKETBUF_ATTR_EFRAGMENTS);
+  ask_peer(c, sink, sinkid, from);
+  if (sinkid == -1) return;
+
+  PRINTF("subnet: incoming packet has %d fragments\n", nfrags);
+
+  if (!rimeaddr_cmp(sink, &rimeaddr_node_addr)) {
+    c->relayed++;
+  }
+
+  // readings for us are handed over all at once if possible
+  if (c->u->onbatch != NULL && rimeaddr_cmp(sink, &rimeaddr_node_addr)) {
+    b.n = 0;
+    batch = &b;
+  }
+
+  // a buffer allows ondata to use the packetbuf (e.g. decide to send)
   EACH_FRAGMENT(
-    packetbuf_attr(PACKETBUF_ATTR_EFRAGMENTS),
+    nfrags,
     buf,
-    if (frag->length > 0) {
+    if (frag->length > 0 && relay_unknown(c, sink, sinkid, subid)) {
+      /* we cannot tell how to aggregate these yet, so pass them on as they are */
+      PRINTF("        fragment %d is %d bytes for unknown %d, relaying\n", fragi, frag->length, subid);
+      if (c->u->onrelay != NULL) {
+        c->u->onrelay(c, sinkid, subid, payload, frag->length);
+      }
+    } else if (frag->length > 0) {
       PRINTF("        fragment %d is %d bytes for %d...\n", fragi, frag->length, subid);
-      c->u->ondata(c, sinkid, subid, payload);
+      deliver(c, sinkid, subid, payload, batch);
     } else {
       PRINTF("        fragment %d is empty - ignoring\n", fragi);
     }
   );
+
+  if (batch != NULL && batch->n > 0) {
+    deliver_batch(c, sinkid, batch);
+  }
 }
 
 /**
- * Called when a neighbouring node sends a publish that is not destined for us,
- * or if we hear a subscribe packet from another node.
- * If it is a publish and the subscription is unknown, ask peer for it.
- * If it is a subscribe and the subscription is unknown, add subscription.
+ * Called when we hear a subscribe, unsubscribe or leaving packet from another
+ * node. If it is a subscribe and the subscription is unknown, add
+ * subscription. Publishes for other nodes are not relied upon, since they are
+ * link-layer unicasts that the radio may not pass on (see disclose.h).
  */
 static void on_hear(struct disclose_conn *disclose, const rimeaddr_t *from) {
   struct subnet_conn *c = (struct subnet_conn *)disclose;
   const rimeaddr_t *sink = packetbuf_addr(PACKETBUF_ADDR_ERECEIVER);
 
+  count_traffic(c, disclose, false);
+  hear_energy(c, from);
+  if (!check_epoch(c, sink)) {
+    return;
+  }
+
   if (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_SUBSCRIBE) {
     PRINTF("subnet: heard subscribe packet from %d.%d\n", from->u8[0], from->u8[1]);
     handle_subscriptions(c, sink, from);
@@ -719,76 +1321,8 @@ static void on_hear(struct disclose_conn *disclose, const rimeaddr_t *from) {
   } else if (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_UNSUBSCRIBE) {
     PRINTF("subnet: heard unsubscribe packet from %d.%d\n", from->u8[0], from->u8[1]);
     handle_subscriptions(c, sink, from);
-  } else if (packetbuf_attr(PACKETBUF_ATTR_EPACKET_TYPE) == SUBNET_PACKET_TYPE_PUBLISH) {
-
-    PRINTF("subnet: heard publish packet from %d.%d\n", from->u8[0], from->u8[1]);
-    if (c->u->exists == NULL) {
-      PRINTF("subnet: no exists function in callback, ignoring...\n");
-      return;
-    }
-
-    {
-      /* ask peer for clarification */
-      short fragments = packetbuf_attr(PACKETBUF_ATTR_EFRAGMENTS);
-      struct peer_packet p = { 0, 0 };
-      dlen_t written = sizeof(struct peer_packet);
-
-      subid_t revoked[fragments];
-      subid_t unknown[fragments];
-
-      short sinkid = find_sinkid(c, sink);
-      if (sinkid != -1) {
-        if (c->sinks[sinkid].revoked != 0) {
-          PRINTF("subnet: sink in publish packet has left, notifying...\n");
-          notify_left(c, sink);
-          return;
-        }
-      }
-
-      EACH_PACKET_FRAGMENT(
-        if (sinkid == -1) {
-          unknown[p.unknown++] = subid;
-          continue;
-        }
-
-        switch (c->u->exists(c, sinkid, subid)) {
-        case REVOKED:
-          revoked[p.revoked++] = subid;
-          break;
-        case UNKNOWN:
-          unknown[p.unknown++] = subid;
-          break;
-        case KNOWN:
-          break;
-        }
-      );
-
-      PRINTF("subnet: packet contains %d unknown and %d revoked subscriptions\n",
-          p.unknown,
-          p.revoked);
-
-      if (p.unknown == 0 && p.revoked == 0) {
-        return;
-      }
-
-      /* base attrs and length struct */
-      prepare_packetbuf(SUBNET_PACKET_TYPE_ASK, sink, 0);
-      memcpy(packetbuf_dataptr(), &p, sizeof(struct peer_packet));
-
-      /* write revoked */
-      memcpy(packetbuf_dataptr() + written, revoked, p.revoked * sizeof(subid_t));
-      written += p.revoked * sizeof(subid_t);
-
-      /* write unknown */
-      memcpy(packetbuf_dataptr() + written, unknown, p.unknown * sizeof(subid_t));
-      packetbuf_set_datalen(written + p.unknown * sizeof(subid_t));
-
-      /* send and restore */
-      /* TODO: Avoid congestion if all neighbours also send ask */
-      disclose_send(&c->peer, from);
-    }
-  }
-}
+  }
+}
 
 /**
  * Called if a forwarding/sending succeeded. Should result in an upstream
@@ -801,36 +1335,65 @@ static void on_sent(struct disclose_conn *disclose, int status) {
   const rimeaddr_t *nexthop;
   short sinkid = find_sinkid(c, sink);
   struct sink *s = &c->sinks[sinkid];
+  struct subnet_queued q;
+  short i;
 
   if (!rimeaddr_cmp(prevto, &rimeaddr_null)) {
+    i = find_sent(c, prevto);
+
+    if (status == MAC_TX_ERR && i != -1) {
+      PRINTF("subnet: no room in MAC layer for packet to %d.%d, retrying later\n",
+          prevto->u8[0], prevto->u8[1]);
+      c->queue[i].sent = false;
+      c->macfull = true;
+      ctimer_set(&c->flush, SUBNET_RETRY_DELAY, flush, c);
+      return;
+    }
+
     if (status != MAC_TX_OK) {
-      nexthop = get_next_hop(c, s, prevto);
+      nexthop = get_next_hop(c, s, prevto, i != -1 ? &c->queue[i].first : NULL);
       PRINTF("subnet: send to %d.%d via %d.%d failed\n",
           sink->u8[0], sink->u8[1],
           prevto->u8[0], prevto->u8[1]);
 
+      if (i == -1) {
+        PRINTF("subnet: failed packet was not queued, dropping it\n");
+        COUNT_N(c, dropped, packetbuf_attr(PACKETBUF_ATTR_EFRAGMENTS));
+
+        if (c->u->errpub != NULL) {
+          c->u->errpub(c);
+        }
+
+        return;
+      }
+
       if (nexthop == NULL) {
         PRINTF("subnet: no next hop to try, adding fragments back\n");
 
         {
           char buf[PACKETBUF_SIZE];
+          uint8_t count = queuebuf_attr(c->queue[i].packet, PACKETBUF_ATTR_EFRAGMENTS);
           uint8_t back = 0;
           // use a buffer to allow ondata to use the packetbuf (e.g. decide to send)
-          memcpy(buf, queuebuf_dataptr(c->sentpacket), queuebuf_datalen(c->sentpacket));
-          PRINTF("subnet: sent packet was %d bytes\n", queuebuf_datalen(c->sentpacket));
+          memcpy(buf, queuebuf_dataptr(c->queue[i].packet), queuebuf_datalen(c->queue[i].packet));
+          PRINTF("subnet: sent packet was %d bytes\n", queuebuf_datalen(c->queue[i].packet));
+
+          /* ondata may queue new packets */
+          dequeue(c, i);
 
           EACH_FRAGMENT(
-            queuebuf_attr(c->sentpacket, PACKETBUF_ATTR_EFRAGMENTS),
+            count,
             buf,
             if (frag->length > 0) {
               PRINTF("        fragment %d is %d bytes for %d...\n", fragi, frag->length, subid);
-              c->u->ondata(c, sinkid, subid, payload);
+              deliver(c, sinkid, subid, payload, NULL);
               back++;
             } else {
               PRINTF("        fragment %d is empty - ignoring\n", fragi);
             }
           );
 
+          COUNT_N(c, resurrections, back);
 #if DEBUG
           if (back == 1) {
             PRINTF("subnet: resurrected %u non-empty fragment\n", back);
@@ -840,10 +1403,7 @@ static void on_sent(struct disclose_conn *disclose, int status) {
 #endif
         }
 
-        if (c->sentpacket != NULL) {
-          queuebuf_free(c->sentpacket);
-          c->sentpacket = NULL;
-        }
+        solicit(c, sinkid);
 
         if (c->u->errpub != NULL) {
           c->u->errpub(c);
@@ -855,16 +1415,25 @@ static void on_sent(struct disclose_conn *disclose, int status) {
       PRINTF("subnet: trying %d.%d instead\n",
           nexthop->u8[0], nexthop->u8[1]);
 
-      queuebuf_to_packetbuf(c->sentpacket);
-      disclose_send(&c->pubsub, nexthop);
+      /* move to the back of the queue, behind any other packets that are
+       * already on their way to the new next hop */
+      q = c->queue[i];
+      rimeaddr_copy(&q.to, nexthop);
+      c->queue[i].packet = NULL;
+      dequeue(c, i);
+      c->queue[c->queued++] = q;
+
+      queuebuf_to_packetbuf(q.packet);
+      COUNT(c, failovers);
+      transmit(c, &c->pubsub, nexthop);
       return;
     }
 
     PRINTF("subnet: packet sent\n");
 
-    if (c->sentpacket != NULL) {
-      queuebuf_free(c->sentpacket);
-      c->sentpacket = NULL;
+    if (i != -1) {
+      record_latency(c, &c->queue[i]);
+      dequeue(c, i);
     }
   } else {
     if (status == MAC_TX_OK) {
@@ -875,7 +1444,528 @@ static void on_sent(struct disclose_conn *disclose, int status) {
   }
 }
 
-static void prepare_packetbuf(uint8_t type, const rimeaddr_t *sink, uint8_t hops) {
+/**
+ * Sends the data in the given buffer as a publish to the given sink, and
+ * empties the buffer
+ */
+static void publish(struct subnet_conn *c, short sinkid, struct sink *buf, uint8_t priority) {
+  struct sink *s = &c->sinks[sinkid];
+  const rimeaddr_t *nexthop = get_next_hop(c, s, NULL, NULL);
+
+  if (nexthop == NULL) {
+    PRINTF("subnet: no next hop known\n");
+    solicit(c, sinkid);
+
+    /* bulk data is kept for the next attempt, but urgent data would be stale
+     * by the time a route shows up */
+    if (priority > SUBNET_PRIORITY_BULK) {
+      COUNT_N(c, dropped, buf->fragments);
+      buf->buflen = 0;
+      buf->fragments = 0;
+    }
+
+    if (c->u->errpub != NULL) {
+      c->u->errpub(c);
+    }
+    return;
+  }
+
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_PUBLISH, &s->sink, s->advertised_cost);
+  packetbuf_set_attr(PACKETBUF_ATTR_EFRAGMENTS, buf->fragments);
+  memcpy(packetbuf_dataptr(), buf->buf, buf->buflen);
+  packetbuf_set_datalen(buf->buflen);
+
+#if DEBUG
+  PRINTF("subnet: publishing %d bytes with priority %d to %d.%d via %d.%d\n",
+      buf->buflen,
+      priority,
+      s->sink.u8[0], s->sink.u8[1],
+      nexthop->u8[0], nexthop->u8[1]
+      );
+
+  EACH_PACKET_FRAGMENT(
+    PRINTF("        fragment %d is %d bytes for %d...\n", fragi, frag->length, subid);
+  );
+#endif
+
+  /* publish is kept in the queue until the next hop has acknowledged it */
+  enqueue(c, &c->pubsub, nexthop, priority, buf->fragments > 0 ? buf->since : clock_time());
+
+  PRINTF("subnet: publish queued, resetting\n");
+
+  /* reset sink packetbuf */
+  buf->buflen = 0;
+  buf->fragments = 0;
+}
+
+/**
+ * Asks neighbors for a route to the given sink that is cheaper than the one we
+ * advertise. Only those that have one answer, so the request does not spread
+ * beyond a single hop
+ */
+static void solicit(struct subnet_conn *c, short sinkid) {
+  struct sink *s = &c->sinks[sinkid];
+  struct peer_packet p = {0, 0};
+
+  /* nothing can be offered for a route we have not worked out yet */
+  if (s->revoked != 0 || s->advertised_cost == 0) {
+    return;
+  }
+
+  if (s->solicited != 0 && clock_time() - s->solicited < SUBNET_SOLICIT_INTERVAL) {
+    PRINTF("subnet: route to %d.%d was solicited recently\n", s->sink.u8[0], s->sink.u8[1]);
+    return;
+  }
+
+  PRINTF("subnet: soliciting route to %d.%d cheaper than %d\n",
+      s->sink.u8[0], s->sink.u8[1], s->advertised_cost);
+  s->solicited = clock_time();
+  COUNT(c, solicits);
+
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_ASK, &s->sink, s->advertised_cost);
+  memcpy(packetbuf_dataptr(), &p, sizeof(struct peer_packet));
+  packetbuf_set_datalen(sizeof(struct peer_packet));
+  transmit(c, &c->peer, &rimeaddr_null);
+}
+
+/**
+ * Answers a route solicitation with an empty reply, which the solicitor takes
+ * as a route advertisement like any other
+ */
+static void offer_route(void *ptr) {
+  struct subnet_conn *c = (struct subnet_conn *)ptr;
+  short sinkid = c->solicitsink;
+  struct sink *s;
+
+  c->solicitsink = -1;
+  if (sinkid == -1) return;
+
+  /* the route may have gone away while we waited */
+  s = &c->sinks[sinkid];
+  if (s->revoked != 0 || (sinkid != c->myid && s->numhops == 0)) return;
+
+  PRINTF("subnet: offering route to %d.%d at cost %d to %d.%d\n",
+      s->sink.u8[0], s->sink.u8[1], s->advertised_cost,
+      c->solicitor.u8[0], c->solicitor.u8[1]);
+  prepare_packetbuf(c, SUBNET_PACKET_TYPE_REPLY, &s->sink, s->advertised_cost);
+  enqueue(c, &c->peer, &c->solicitor, SUBNET_PRIORITY_BULK, clock_time());
+}
+
+/**
+ * Holds back a resubscription we pass on for a random time, since all nodes
+ * that have the sender as first hop get it at the same time. It is dropped if
+ * a neighbour passes it on first. Only one is held, so one that is still
+ * waiting is sent right away.
+ */
+static void hold_refresh(struct subnet_conn *c, short sinkid) {
+  struct queuebuf *q = queuebuf_new_from_packetbuf();
+
+  if (q == NULL) {
+    broadcast(c);
+    return;
+  }
+
+  send_refresh(c);
+  c->refreshed = q;
+  c->refreshsink = sinkid;
+  ctimer_set(&c->refresh,
+      SUBNET_REFRESH_DELAY > 0 ? random_rand() % SUBNET_REFRESH_DELAY : 0,
+      send_refresh, c);
+}
+
+static void send_refresh(void *ptr) {
+  struct subnet_conn *c = (struct subnet_conn *)ptr;
+
+  if (c->refreshed == NULL) return;
+
+  queuebuf_to_packetbuf(c->refreshed);
+  queuebuf_free(c->refreshed);
+  c->refreshed = NULL;
+  broadcast(c);
+}
+
+/**
+ * Packets are kept in order of priority. Within a priority class, new packets
+ * go behind the ones already queued so that the next hop receives them in the
+ * order they were published. Packets that have already been handed to the MAC
+ * layer are never passed, as the MAC reports on them in order.
+ */
+static void enqueue(struct subnet_conn *c, struct disclose_conn *via, const rimeaddr_t *to, uint8_t priority, clock_time_t since) {
+  struct subnet_queued *q;
+  uint8_t i, at;
+
+  if (c->queued == SUBNET_MAX_QUEUED) {
+    PRINTF("subnet: transmit queue full, sending to %d.%d right away\n", to->u8[0], to->u8[1]);
+    COUNT(c, flushes[SUBNET_FLUSH_FULL]);
+    transmit(c, via, to);
+    return;
+  }
+
+  for (at = c->queued; at > 0; at--) {
+    q = &c->queue[at-1];
+    if (q->sent || q->priority >= priority) break;
+  }
+
+  q = &c->queue[c->queued];
+  q->packet = queuebuf_new_from_packetbuf();
+  if (q->packet == NULL) {
+    PRINTF("subnet: no queuebuf, sending to %d.%d right away\n", to->u8[0], to->u8[1]);
+    COUNT(c, flushes[SUBNET_FLUSH_NOBUF]);
+    transmit(c, via, to);
+    return;
+  }
+
+  q->via = via;
+  rimeaddr_copy(&q->to, to);
+  rimeaddr_copy(&q->first, to);
+  q->sent = false;
+  q->priority = priority;
+  q->since = since;
+  c->queued++;
+  COUNT_MAX(c, queue_hwm, c->queued);
+
+  if (at != c->queued - 1) {
+    PRINTF("subnet: priority %d packet goes ahead of %d queued packets\n", priority, c->queued - 1 - at);
+    {
+      struct subnet_queued n = *q;
+      for (i = c->queued - 1; i > at; i--) {
+        c->queue[i] = c->queue[i-1];
+      }
+      c->queue[at] = n;
+    }
+  }
+
+  if (priority > SUBNET_PRIORITY_BULK) {
+    ctimer_set(&c->flush, 0, flush, c);
+  } else if (ctimer_expired(&c->flush)) {
+    ctimer_set(&c->flush, SUBNET_BURST_DELAY, flush, c);
+  }
+}
+
+static void record_latency(struct subnet_conn *c, struct subnet_queued *q) {
+  struct subnet_latency_stats *l;
+  clock_time_t held;
+
+  if (q->via != &c->pubsub) {
+    return;
+  }
+
+  l = &c->latency[q->priority];
+  held = clock_time() - q->since;
+  l->packets++;
+  l->total += held;
+  if (held > l->worst) {
+    l->worst = held;
+  }
+}
+
+static void dequeue(struct subnet_conn *c, uint8_t i) {
+  if (c->queue[i].packet != NULL) {
+    queuebuf_free(c->queue[i].packet);
+  }
+
+  c->queued--;
+  for (; i < c->queued; i++) {
+    c->queue[i] = c->queue[i+1];
+  }
+}
+
+/* first packet not yet handed to the MAC layer, optionally for a given hop */
+static short next_queued(struct subnet_conn *c, const rimeaddr_t *to) {
+  uint8_t i;
+  for (i = 0; i < c->queued; i++) {
+    if (!c->queue[i].sent && (to == NULL || rimeaddr_cmp(&c->queue[i].to, to))) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* the MAC layer reports on packets for a next hop in the order they were
+ * sent, which is also the order they appear in the queue */
+static short find_sent(struct subnet_conn *c, const rimeaddr_t *to) {
+  uint8_t i;
+  for (i = 0; i < c->queued; i++) {
+    if (c->queue[i].sent && rimeaddr_cmp(&c->queue[i].to, to)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void send_queued(struct subnet_conn *c, uint8_t i) {
+  struct disclose_conn *via = c->queue[i].via;
+  rimeaddr_t to;
+
+  rimeaddr_copy(&to, &c->queue[i].to);
+  queuebuf_to_packetbuf(c->queue[i].packet);
+
+  if (via == &c->pubsub) {
+    /* kept until we know whether it arrived */
+    c->queue[i].sent = true;
+  } else {
+    dequeue(c, i);
+  }
+
+  transmit(c, via, &to);
+}
+
+/**
+ * Publishes any urgent data, and hands all queued packets to the MAC layer,
+ * grouped by next hop. Packets
+ * for the same neighbor end up in the same MAC queue at the same time, so the
+ * RDC sends them as a single burst.
+ *
+ * The queue is searched again after every send since the MAC layer may report
+ * back (and so change the queue) before transmit returns. A send that fails
+ * right away can put its readings back into a new packet, so only as many
+ * packets as were queued on entry are sent; the rest go out with the next
+ * flush. Once the MAC layer has refused a packet, the rest would be refused
+ * too, so the pass ends there and is retried after SUBNET_RETRY_DELAY.
+ */
+static void flush(void *ptr) {
+  struct subnet_conn *c = (struct subnet_conn *)ptr;
+  rimeaddr_t to;
+  uint8_t budget;
+  uint8_t n;
+  short i;
+
+  if (c->urgent.fragments > 0) {
+    publish(c, c->urgentsink, &c->urgent, SUBNET_PRIORITY_HIGH);
+  }
+
+#if SUBNET_COUNTERS
+  /* queue is sorted by priority, so the first packet tells why we're here */
+  i = next_queued(c, NULL);
+  if (i != -1) {
+    COUNT(c, flushes[c->queue[i].priority > SUBNET_PRIORITY_BULK ? SUBNET_FLUSH_URGENT : SUBNET_FLUSH_TIMER]);
+  }
+#endif
+
+  c->macfull = false;
+  budget = c->queued;
+  while (budget > 0 && !c->macfull && (i = next_queued(c, NULL)) != -1) {
+    rimeaddr_copy(&to, &c->queue[i].to);
+    n = 0;
+    do {
+      send_queued(c, i);
+      n++;
+      budget--;
+    } while (budget > 0 && !c->macfull && (i = next_queued(c, &to)) != -1);
+
+    PRINTF("subnet: sent burst of %d packets to %d.%d\n", n, to.u8[0], to.u8[1]);
+    c->bursts.bursts++;
+    c->bursts.packets += n;
+    if (n > c->bursts.longest) {
+      c->bursts.longest = n;
+    }
+  }
+}
+
+static void deliver(struct subnet_conn *c, short sinkid, subid_t subid, void *payload, struct batch *b) {
+  struct shared_header *h = payload;
+  struct shared_target *t;
+  void *data = h+1;
+  uint8_t i, n = 0;
+
+  if (subid != SUBNET_SHARED_SUBID) {
+    if (b != NULL) {
+      collect(b, subid, payload);
+    } else {
+      c->u->ondata(c, sinkid, subid, payload);
+    }
+    return;
+  }
+
+  t = (struct shared_target *) (((char *) data) + h->length);
+
+  {
+    short sinkids[h->targets];
+    subid_t subids[h->targets];
+
+    for (i = 0; i < h->targets; i++, t++) {
+      sinkid = find_sinkid(c, &t->sink);
+      if (sinkid == -1 || c->sinks[sinkid].revoked != 0) {
+        PRINTF("subnet: dropping shared target %d.%d:%d - sink unknown or left\n",
+            t->sink.u8[0], t->sink.u8[1], t->subid);
+        continue;
+      }
+
+      if (b != NULL && rimeaddr_cmp(&t->sink, &rimeaddr_node_addr)) {
+        collect(b, t->subid, data);
+        continue;
+      }
+
+      if (rimeaddr_cmp(&t->sink, &rimeaddr_node_addr) || c->u->onshared == NULL) {
+        c->u->ondata(c, sinkid, t->subid, data);
+        continue;
+      }
+
+      sinkids[n] = sinkid;
+      subids[n] = t->subid;
+      n++;
+    }
+
+    if (n > 0) {
+      PRINTF("subnet: passing on shared fragment for %d targets\n", n);
+      c->u->onshared(c, n, sinkids, subids, data, h->length);
+    }
+  }
+}
+
+static void collect(struct batch *b, subid_t subid, void *payload) {
+  if (b->n == SUBNET_MAX_READINGS) {
+    PRINTF("subnet: too many readings in packet, dropping reading for %d\n", subid);
+    return;
+  }
+
+  b->subids[b->n] = subid;
+  b->readings[b->n] = payload;
+  b->n++;
+}
+
+/* groups readings by subid, keeping the order in which they arrived */
+static void deliver_batch(struct subnet_conn *c, short sinkid, struct batch *b) {
+  subid_t subids[SUBNET_MAX_READINGS];
+  uint8_t counts[SUBNET_MAX_READINGS];
+  void *readings[SUBNET_MAX_READINGS];
+  uint8_t groups = 0, n = 0;
+  uint8_t i, j;
+
+  for (i = 0; i < b->n; i++) {
+    if (b->readings[i] == NULL) {
+      /* already part of an earlier group */
+      continue;
+    }
+
+    subids[groups] = b->subids[i];
+    counts[groups] = 0;
+    for (j = i; j < b->n; j++) {
+      if (b->readings[j] != NULL && b->subids[j] == subids[groups]) {
+        readings[n++] = b->readings[j];
+        b->readings[j] = NULL;
+        counts[groups]++;
+      }
+    }
+    groups++;
+  }
+
+  PRINTF("subnet: delivering %d readings for %d subscriptions\n", n, groups);
+  c->u->onbatch(c, sinkid, groups, subids, counts, readings);
+}
+
+static void checkpoint_sink(struct subnet_conn *c, short sinkid) {
+#if SUBNET_CHECKPOINT
+  struct sink *s = &c->sinks[sinkid];
+  struct sink_record r, stored;
+  uint8_t i;
+
+  if (c->checkpoint < 0) return;
+
+  /* unused entries are written out empty */
+  memset(&r, 0, sizeof(struct sink_record));
+  if (sinkid < c->numsinks) {
+    r.magic = SINK_RECORD_MAGIC;
+    r.revoked = s->revoked != 0;
+    r.epoch = s->epoch;
+    rimeaddr_copy(&r.sink, &s->sink);
+    r.advertised_cost = s->advertised_cost;
+    r.numhops = s->numhops;
+    for (i = 0; i < s->numhops; i++) {
+      rimeaddr_copy(&r.nexthops[i].addr, &s->nexthops[i].node->addr);
+      r.nexthops[i].cost = s->nexthops[i].cost;
+    }
+  }
+
+  /* only the record for this sink is rewritten, and only if it changed, so
+   * that flash is not worn by writing the same record again */
+  cfs_seek(c->checkpoint, sinkid * sizeof(struct sink_record), CFS_SEEK_SET);
+  if (cfs_read(c->checkpoint, &stored, sizeof(struct sink_record)) == sizeof(struct sink_record) &&
+      memcmp(&stored, &r, sizeof(struct sink_record)) == 0) {
+    return;
+  }
+
+  cfs_seek(c->checkpoint, sinkid * sizeof(struct sink_record), CFS_SEEK_SET);
+  if (cfs_write(c->checkpoint, &r, sizeof(struct sink_record)) != sizeof(struct sink_record)) {
+    PRINTF("subnet: failed to checkpoint sink %d\n", sinkid);
+  }
+#endif
+}
+
+static void restore(struct subnet_conn *c) {
+#if SUBNET_CHECKPOINT
+  struct sink_record r;
+  struct sink *s;
+  struct neighbor *n;
+  short i, j;
+  int fd;
+
+  c->numneighbors = 0;
+  c->checkpoint = -1;
+
+  fd = cfs_open(SUBNET_CHECKPOINT_FILE, CFS_READ);
+  if (fd >= 0) {
+    while (c->numsinks < SUBNET_MAX_SINKS &&
+           cfs_read(fd, &r, sizeof(struct sink_record)) == sizeof(struct sink_record)) {
+      /* our own routes are rebuilt when we subscribe again */
+      if (r.magic != SINK_RECORD_MAGIC || rimeaddr_cmp(&r.sink, &rimeaddr_node_addr)) {
+        continue;
+      }
+
+      s = &c->sinks[c->numsinks];
+      memset(s, 0, sizeof(struct sink));
+      rimeaddr_copy(&s->sink, &r.sink);
+      s->epoch = r.epoch;
+      s->advertised_cost = r.advertised_cost;
+
+      /* we can't know how long we were down, so a sink that had left is
+       * considered to have left just now */
+      if (r.revoked) {
+        s->revoked = clock_seconds() > 0 ? clock_seconds() : 1;
+        r.numhops = 0;
+      }
+
+      for (i = 0; i < r.numhops && i < SUBNET_MAX_ALTERNATE_ROUTES; i++) {
+        n = find_neighbor(c, &r.nexthops[i].addr);
+        if (n == NULL) {
+          if (c->numneighbors >= SUBNET_MAX_NEIGHBORS) continue;
+          n = &c->neighbors[c->numneighbors++];
+          rimeaddr_copy(&n->addr, &r.nexthops[i].addr);
+          n->located = false;
+          n->energy = 0;
+        }
+        n->last_active = clock_seconds();
+
+        j = s->numhops++;
+        s->nexthops[j].node = n;
+        s->nexthops[j].cost = r.nexthops[i].cost;
+      }
+
+      PRINTF("subnet: restored sink %d.%d with %d next hops\n",
+          s->sink.u8[0], s->sink.u8[1], s->numhops);
+      c->numsinks++;
+    }
+    cfs_close(fd);
+  }
+
+#if SUBNET_CHECKPOINT_COFFEE
+  cfs_coffee_reserve(SUBNET_CHECKPOINT_FILE, SUBNET_MAX_SINKS * sizeof(struct sink_record));
+#endif
+  c->checkpoint = cfs_open(SUBNET_CHECKPOINT_FILE, CFS_READ | CFS_WRITE);
+  if (c->checkpoint < 0) {
+    PRINTF("subnet: cannot open checkpoint file, not checkpointing\n");
+    return;
+  }
+
+  /* write back the records that moved because others were skipped, or that
+   * changed because the sink had left */
+  for (i = 0; i < SUBNET_MAX_SINKS; i++) {
+    checkpoint_sink(c, i);
+  }
+#endif
+}
+
+static void prepare_packetbuf(struct subnet_conn *c, uint8_t type, const rimeaddr_t *sink, uint8_t hops) {
   PRINTF("subnet: preparing packet for %d.%d\n", sink->u8[0], sink->u8[1]);
 
   packetbuf_clear();
@@ -883,6 +1973,129 @@ static void prepare_packetbuf(uint8_t type, const rimeaddr_t *sink, uint8_t hops
   packetbuf_set_attr(PACKETBUF_ATTR_EFRAGMENTS, 0);
   packetbuf_set_addr(PACKETBUF_ADDR_ERECEIVER, sink);
   packetbuf_set_attr(PACKETBUF_ATTR_HOPS, hops);
+  packetbuf_set_attr(PACKETBUF_ATTR_EEPOCH, sink_epoch(c, sink));
+}
+
+static uint8_t sink_epoch(struct subnet_conn *c, const rimeaddr_t *sink) {
+  short sinkid;
+
+  if (rimeaddr_cmp(sink, &rimeaddr_node_addr)) {
+    return c->epoch;
+  }
+
+  sinkid = find_sinkid(c, sink);
+  if (sinkid == -1) {
+    /* sinks are only ever added from packets about them */
+    return packetbuf_attr(PACKETBUF_ATTR_EEPOCH);
+  }
+
+  return c->sinks[sinkid].epoch;
+}
+
+/* returns false if the packet is from an old incarnation of its sink */
+static bool check_epoch(struct subnet_conn *c, const rimeaddr_t *sink) {
+  uint8_t epoch = packetbuf_attr(PACKETBUF_ATTR_EEPOCH);
+  short sinkid;
+  struct sink *s;
+
+  if (rimeaddr_cmp(sink, &rimeaddr_node_addr)) {
+    /* nobody knows our epoch better than we do */
+    return epoch == c->epoch;
+  }
+
+  sinkid = find_sinkid(c, sink);
+  if (sinkid == -1) return true;
+
+  s = &c->sinks[sinkid];
+  if (epoch == s->epoch) return true;
+
+  /* epochs wrap around, so compare using serial number arithmetic */
+  if ((int8_t)(epoch - s->epoch) < 0) {
+    PRINTF("subnet: dropping packet for old epoch %d of %d.%d (now %d)\n",
+        epoch, sink->u8[0], sink->u8[1], s->epoch);
+    return false;
+  }
+
+  PRINTF("subnet: sink %d.%d restarted (epoch %d -> %d), dropping old state\n",
+      sink->u8[0], sink->u8[1], s->epoch, epoch);
+
+  if (c->u->sink_reset != NULL) {
+    c->u->sink_reset(c, sinkid);
+  }
+
+  /* keep the sink id, but nothing else. Routes are rebuilt by the flood */
+  s->epoch = epoch;
+  s->revoked = 0;
+  s->numhops = 0;
+  s->advertised_cost = 0;
+  COUNT_N(c, dropped, s->fragments);
+  s->fragments = 0;
+  s->buflen = 0;
+  if (c->writeout == sinkid) {
+    c->writesink.fragments = 0;
+    c->writesink.buflen = 0;
+  }
+  if (c->urgentsink == sinkid) {
+    COUNT_N(c, dropped, c->urgent.fragments);
+    c->urgent.fragments = 0;
+    c->urgent.buflen = 0;
+  }
+  checkpoint_sink(c, sinkid);
+
+  return true;
+}
+
+static void new_epoch(struct subnet_conn *c) {
+  uint8_t epoch = 0;
+  int fd;
+
+  fd = cfs_open(SUBNET_EPOCH_FILE, CFS_READ);
+  if (fd >= 0) {
+    cfs_read(fd, &epoch, sizeof(epoch));
+    cfs_close(fd);
+  }
+
+  epoch++;
+  fd = cfs_open(SUBNET_EPOCH_FILE, CFS_WRITE);
+  if (fd >= 0) {
+    cfs_write(fd, &epoch, sizeof(epoch));
+    cfs_close(fd);
+  } else {
+    PRINTF("subnet: cannot store epoch, a restart may not be noticed\n");
+  }
+
+  PRINTF("subnet: starting sink epoch %d\n", epoch);
+  c->epoch = epoch;
+}
+
+static const struct position *packet_position(void) {
+  const struct position *p = NULL;
+
+  EACH_PACKET_FRAGMENT(
+    if (subid == SUBNET_POSITION_SUBID && frag->length == sizeof(struct position)) {
+      p = payload;
+    }
+  );
+
+  return p;
+}
+
+static void locate_packetbuf(struct subnet_conn *c) {
+  struct position *p;
+
+  if (!c->located) return;
+
+  /* overwrite the position of whoever sent this before us */
+  p = (struct position *) packet_position();
+  if (p != NULL) {
+    *p = c->position;
+    return;
+  }
+
+  if (!inject_packetbuf(SUBNET_POSITION_SUBID, sizeof(struct position), NULL, NULL,
+                        &c->position, ((char *) packetbuf_dataptr()) + packetbuf_datalen())) {
+    PRINTF("subnet: no room for position in packet\n");
+  }
 }
 
 static bool inject_packetbuf(subid_t subid, dlen_t bytes, uint8_t *fragments, dlen_t *buflen, void *payload, void *buf) {
@@ -20,6 +20,7 @@
 
 #include "net/rime/disclose.h"
 #include "net/rime/rimeaddr.h"
+#include "sys/ctimer.h"
 #include <stdbool.h>
 
 #ifdef SUBNET_CONF_MAX_SINKS
@@ -40,6 +41,89 @@
 #define SUBNET_MAX_ALTERNATE_ROUTES 3
 #endif
 
+#ifdef SUBNET_CONF_MAX_QUEUED
+#define SUBNET_MAX_QUEUED SUBNET_CONF_MAX_QUEUED
+#else
+#define SUBNET_MAX_QUEUED 4
+#endif
+
+/* how long unicasts are held back so that more packets for the same next hop
+ * can join them in a single RDC burst. 0 means until the current event has
+ * been handled */
+#ifdef SUBNET_CONF_BURST_DELAY
+#define SUBNET_BURST_DELAY SUBNET_CONF_BURST_DELAY
+#else
+#define SUBNET_BURST_DELAY 0
+#endif
+
+/* how long to wait before retrying a queued unicast that the MAC layer had no
+ * room for. Such packets never left the node, so no other route is tried */
+#ifdef SUBNET_CONF_RETRY_DELAY
+#define SUBNET_RETRY_DELAY SUBNET_CONF_RETRY_DELAY
+#else
+#define SUBNET_RETRY_DELAY (CLOCK_SECOND/8)
+#endif
+
+/* when every next hop to a sink has failed, neighbors are asked for a cheaper
+ * route with a single broadcast. Those that have one answer after a random
+ * delay of up to this long, so that they do not all answer at once */
+#ifdef SUBNET_CONF_SOLICIT_DELAY
+#define SUBNET_SOLICIT_DELAY SUBNET_CONF_SOLICIT_DELAY
+#else
+#define SUBNET_SOLICIT_DELAY (CLOCK_SECOND/16)
+#endif
+
+/* resubscriptions that a node passes on are sent after a random delay of up
+ * to this long, so that the nodes it reaches do not all send at once */
+#ifdef SUBNET_CONF_REFRESH_DELAY
+#define SUBNET_REFRESH_DELAY SUBNET_CONF_REFRESH_DELAY
+#else
+#define SUBNET_REFRESH_DELAY (CLOCK_SECOND/4)
+#endif
+
+/* shortest time between two route solicitations for the same sink */
+#ifdef SUBNET_CONF_SOLICIT_INTERVAL
+#define SUBNET_SOLICIT_INTERVAL SUBNET_CONF_SOLICIT_INTERVAL
+#else
+#define SUBNET_SOLICIT_INTERVAL (CLOCK_SECOND*4)
+#endif
+
+/* every packet carries how much of its time the sending node has had its
+ * radio on since boot (per energest), in steps of this many per mille. The
+ * 4-bit level saturates at 15 */
+#ifdef SUBNET_CONF_ENERGY_STEP
+#define SUBNET_ENERGY_STEP SUBNET_CONF_ENERGY_STEP
+#else
+#define SUBNET_ENERGY_STEP 10
+#endif
+#define SUBNET_MAX_ENERGY 15
+
+/* how much a next hop's energy level adds to its cost, in 1/16 hops per
+ * level. At the default, a relay at the top level counts as almost two
+ * extra hops. Only the first next hop tried is chosen this way; failover
+ * goes by cost. 0 makes route choice ignore energy */
+#ifdef SUBNET_CONF_ENERGY_WEIGHT
+#define SUBNET_ENERGY_WEIGHT SUBNET_CONF_ENERGY_WEIGHT
+#else
+#define SUBNET_ENERGY_WEIGHT 2
+#endif
+
+/* whether traffic and buffering counters are kept (see subnet_counters).
+ * They take about 200 bytes of RAM between subnet and pubsub, so they are
+ * only on in the simulator and when built with make COUNTERS=1 */
+#ifdef SUBNET_CONF_COUNTERS
+#define SUBNET_COUNTERS SUBNET_CONF_COUNTERS
+#else
+#define SUBNET_COUNTERS 0
+#endif
+
+/* priority classes for published data. Data above SUBNET_PRIORITY_BULK is
+ * sent as soon as the current event has been handled, and ahead of any bulk
+ * packets still waiting in the transmit queue */
+#define SUBNET_PRIORITY_BULK 0
+#define SUBNET_PRIORITY_HIGH 1
+#define SUBNET_PRIORITIES 2
+
 #define SUBNET_PACKET_TYPE_SUBSCRIBE 0
 #define SUBNET_PACKET_TYPE_REPLY 0
 #define SUBNET_PACKET_TYPE_PUBLISH 1
@@ -47,19 +131,52 @@
 #define SUBNET_PACKET_TYPE_UNSUBSCRIBE 2
 #define SUBNET_PACKET_TYPE_INVALIDATE SUBNET_PACKET_TYPE_UNSUBSCRIBE
 #define SUBNET_PACKET_TYPE_LEAVING 3
+/* an ASK that is broadcast with no subscriptions in it is a route
+ * solicitation, and is answered by an empty REPLY */
+
+/* the largest cost that fits in the 4-bit HOPS header field. Chameleon does
+ * not mask values that are too large for their field, so nodes further than
+ * this from a sink cannot route to it, and its floods stop there */
+#define SUBNET_MAX_HOPS 15
 
 #define SUBNET_ATTRIBUTES  { PACKETBUF_ATTR_EPACKET_TYPE, 2*PACKETBUF_ATTR_BIT }, \
                            { PACKETBUF_ATTR_EFRAGMENTS,   8*PACKETBUF_ATTR_BIT }, \
                            { PACKETBUF_ATTR_HOPS,         4*PACKETBUF_ATTR_BIT }, \
+                           { PACKETBUF_ATTR_EEPOCH,       8*PACKETBUF_ATTR_BIT }, \
+                           { PACKETBUF_ATTR_ENERGY,       4*PACKETBUF_ATTR_BIT }, \
                            { PACKETBUF_ADDR_ERECEIVER,      PACKETBUF_ADDRSIZE }, \
                              DISCLOSE_ATTRIBUTES
 
+/* whether routing state should be kept in CFS across reboots */
+#ifdef SUBNET_CONF_CHECKPOINT
+#define SUBNET_CHECKPOINT SUBNET_CONF_CHECKPOINT
+#else
+#define SUBNET_CHECKPOINT 0
+#endif
+
+/* whether the CFS backend is Coffee, so that files can be reserved up front */
+#ifdef SUBNET_CONF_CHECKPOINT_COFFEE
+#define SUBNET_CHECKPOINT_COFFEE SUBNET_CONF_CHECKPOINT_COFFEE
+#else
+#define SUBNET_CHECKPOINT_COFFEE 1
+#endif
+
+#define SUBNET_CHECKPOINT_FILE "subnet"
+#define SUBNET_EPOCH_FILE "subnet.epoch"
+
 #ifdef SUBNET_CONF_REVOKE_PERIOD
 #define SUBNET_REVOKE_PERIOD SUBNET_CONF_REVOKE_PERIOD
 #else
 #define SUBNET_REVOKE_PERIOD 600
 #endif
 
+/* fragments with this subid carry one reading for several (sink, subid) pairs */
+#define SUBNET_SHARED_SUBID 0xff
+/* fragments with this subid carry the position of the node that sent them */
+#define SUBNET_POSITION_SUBID 0xfe
+/* reserved subids never refer to a subscription */
+#define SUBNET_RESERVED_SUBID(subid) ((subid) >= SUBNET_POSITION_SUBID)
+
 
 typedef uint8_t subid_t;
 typedef uint8_t dlen_t;
@@ -81,12 +198,42 @@ struct fragment {
   dlen_t length;
 };
 
+/**
+ * \brief Header for fragments shared between several sinks
+ *
+ * The header is followed by length bytes of data and then by targets
+ * shared_target entries. Data comes first to keep it aligned.
+ */
+struct shared_header {
+  uint8_t targets;
+  dlen_t length;
+};
+
+/**
+ * \brief A single destination of a shared fragment
+ */
+struct shared_target {
+  rimeaddr_t sink;
+  subid_t subid;
+};
+
+/**
+ * \brief Physical position of a node
+ */
+struct position {
+  short x;
+  short y;
+};
+
 /**
  * \brief Information about a single neighbor
  */
 struct neighbor {
   rimeaddr_t addr;
   clock_time_t last_active; /* last time this next hop was heard from */
+  uint8_t energy;           /* energy level it last announced */
+  bool located;             /* whether position is known */
+  struct position position; /* last position this neighbor announced */
 };
 
 /**
@@ -102,6 +249,7 @@ struct sink_neighbor {
  */
 struct sink {
   rimeaddr_t sink;
+  uint8_t epoch; /* incarnation of the sink the rest of this state is for */
   uint8_t advertised_cost; /* what cost we've advertised this route as */
   uint8_t numhops;
   struct sink_neighbor nexthops[SUBNET_MAX_ALTERNATE_ROUTES];
@@ -109,11 +257,106 @@ struct sink {
   uint8_t fragments;
   dlen_t buflen;
   char buf[PACKETBUF_SIZE];
+  clock_time_t since; /* when the first fragment was added to buf */
+  clock_time_t solicited; /* when neighbors were last asked for a route */
 
   clock_time_t revoked;
 };
 /*---------------------------------------------------------------------------*/
 /* public structs */
+/**
+ * \brief A unicast waiting to be handed to the MAC layer, or for the MAC
+ *        layer to report on it
+ */
+struct subnet_queued {
+  struct queuebuf *packet;
+  struct disclose_conn *via;
+  rimeaddr_t to;
+  rimeaddr_t first;   /* next hop the packet was first sent through */
+  bool sent;
+  uint8_t priority;
+  clock_time_t since; /* when the oldest data in packet was added */
+};
+
+/**
+ * \brief How well unicasts have been coalesced into RDC bursts
+ *
+ * Every burst costs the receiver a single wake-up, so packets - bursts is the
+ * number of wake-ups saved.
+ */
+struct subnet_burst_stats {
+  unsigned long bursts;  /* groups of packets handed to the MAC together */
+  unsigned long packets; /* packets sent in those groups */
+  uint8_t longest;       /* most packets sent in a single burst */
+};
+
+/**
+ * \brief Packet types as they are counted in subnet_counters
+ *
+ * Types on the peer channel come after those on the pub/sub channel, except
+ * for LEAVING which is the same on both.
+ */
+enum subnet_counted_type {
+  SUBNET_COUNT_SUBSCRIBE,
+  SUBNET_COUNT_PUBLISH,
+  SUBNET_COUNT_UNSUBSCRIBE,
+  SUBNET_COUNT_LEAVING,
+  SUBNET_COUNT_REPLY,
+  SUBNET_COUNT_ASK,
+  SUBNET_COUNT_INVALIDATE,
+  SUBNET_COUNTED_TYPES
+};
+
+/**
+ * \brief Why queued packets were handed to the MAC layer
+ */
+enum subnet_flush_reason {
+  SUBNET_FLUSH_TIMER,   /* burst delay passed */
+  SUBNET_FLUSH_URGENT,  /* high priority data was queued */
+  SUBNET_FLUSH_FULL,    /* transmit queue was full, so sent right away */
+  SUBNET_FLUSH_NOBUF,   /* no queuebuf to hold the packet, so sent right away */
+  SUBNET_FLUSH_REASONS
+};
+
+struct subnet_traffic {
+  unsigned long packets;
+  unsigned long bytes;   /* payload only, excluding headers */
+};
+
+/**
+ * \brief Counters for everything subnet does
+ *
+ * Packets are counted when they are handed to disclose, so MAC layer
+ * retransmissions are not included.
+ */
+struct subnet_counters {
+  struct subnet_traffic sent[SUBNET_COUNTED_TYPES];
+  struct subnet_traffic received[SUBNET_COUNTED_TYPES];
+  unsigned long added;         /* fragments added to publish buffers */
+  unsigned long merged;        /* fragment copies saved by sharing */
+  unsigned long dropped;       /* fragments that were lost */
+  unsigned long failovers;     /* publishes rerouted to another next hop */
+  unsigned long resurrections; /* fragments put back after all hops failed */
+  unsigned long solicits;      /* routes asked for after all hops failed */
+  unsigned long repairs;       /* publishes resumed when a route was offered */
+  unsigned long flushes[SUBNET_FLUSH_REASONS];
+  dlen_t buffer_hwm;           /* most bytes held in a publish buffer */
+  uint8_t queue_hwm;           /* most packets in the transmit queue */
+};
+
+/**
+ * \brief How long published data of one priority class is held by this node
+ *
+ * Measured from when the first fragment of a packet was added until the next
+ * hop acknowledged the packet. Summing these along a route gives the delivery
+ * latency to the sink, minus the time spent on the air.
+ */
+struct subnet_latency_stats {
+  unsigned long packets;  /* packets acknowledged by the next hop */
+  unsigned long total;    /* sum of their latencies, in clock ticks */
+  clock_time_t worst;     /* highest latency seen */
+};
+
 /**
  * \brief Subnet connection state
  */
@@ -122,6 +365,8 @@ struct subnet_conn {
   struct disclose_conn peer;       /* connection for P2P subscription info */
   const struct subnet_callbacks *u; /* callbacks */
   subid_t subid;                        /* last sent subscription id */
+  short myid;                       /* our own sink id, -1 if not a sink */
+  uint8_t epoch;                    /* our incarnation as a sink */
 
   uint8_t numsinks;                   /* number of routes (i.e. sinks) known */
   struct sink sinks[SUBNET_MAX_SINKS];
@@ -129,11 +374,39 @@ struct subnet_conn {
   uint8_t numneighbors;               /* number of neighbors known */
   struct neighbor neighbors[SUBNET_MAX_NEIGHBORS];
 
-  struct queuebuf *sentpacket;      /* store a publish message until it has been
-                                       sent to the next hop */
+  uint8_t queued;                   /* unicasts in queue */
+  struct subnet_queued queue[SUBNET_MAX_QUEUED]; /* unicasts waiting to be sent,
+                                       and publishes waiting to be
+                                       acknowledged by the next hop */
+  struct ctimer flush;              /* sends queued unicasts */
+  bool macfull;                     /* MAC layer had no room, flush later */
+  struct subnet_burst_stats bursts;
+  unsigned long relayed;            /* publish packets received for other sinks */
+#if SUBNET_COUNTERS
+  struct subnet_counters counters;
+#endif
 
   short writeout;
   struct sink writesink;
+
+  short urgentsink;                 /* sink the urgent buffer is for */
+  struct sink urgent;               /* high priority data waiting for flush */
+  struct subnet_latency_stats latency[SUBNET_PRIORITIES];
+
+  bool located;                     /* whether position is known */
+  struct position position;         /* this node's position */
+
+  struct ctimer repair;             /* offers a neighbor our route */
+  short solicitsink;                /* sink the offer is for, -1 if none */
+  rimeaddr_t solicitor;             /* neighbor the offer is for */
+
+  struct ctimer refresh;            /* passes on a resubscription */
+  struct queuebuf *refreshed;       /* the resubscription, NULL if none */
+  short refreshsink;                /* sink the resubscription is from */
+
+#if SUBNET_CHECKPOINT
+  int checkpoint;                   /* CFS file holding the sink table */
+#endif
 };
 
 enum existance {
@@ -174,6 +447,37 @@ struct subnet_callbacks {
    * all subscriptions to this sink. Note that this sinkid may be reused in the
    * future! */
   void (* sink_left)(struct subnet_conn *c, short sinkid);
+
+  /* called when a fragment shared by several (sink, subid) pairs is received
+   * and has to be forwarded further. Entries for this node's own sink are
+   * passed to ondata instead. If NULL, ondata is called once for each pair.
+   * Note that data MUST be copied if it is to be reused later. */
+  void (* onshared)(struct subnet_conn *c, uint8_t targets, short sinkids[], subid_t subids[], void *data, dlen_t bytes);
+
+  /* called before a new subscription heard from a neighbor is rebroadcast.
+   * from is the position of that neighbor, or NULL if it is not known. Should
+   * return false if the subscription need not spread any further from this
+   * node. If NULL, all subscriptions are rebroadcast */
+  bool (* forward)(struct subnet_conn *c, short sinkid, subid_t subid, void *data, const struct position *from);
+
+  /* called when a sink is heard with a newer epoch, meaning it has restarted.
+   * Should forget (not revoke!) all subscriptions to this sink, since the sink
+   * will reuse their subids */
+  void (* sink_reset)(struct subnet_conn *c, short sinkid);
+
+  /* if not NULL, called instead of ondata with all the readings in a packet
+   * that has reached its sink, grouped by subscription. The readings for
+   * subids[0] are the first counts[0] entries of readings, followed by those
+   * for subids[1] and so on. All pointers are into a single buffer that is
+   * only valid until the function returns */
+  void (* onbatch)(struct subnet_conn *c, short sinkid, uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]);
+
+  /* called with a reading to forward for a subscription this node does not
+   * know yet, so cannot aggregate. Should add it unchanged with
+   * subnet_add_data; it is kept across a writeout until the subscription is
+   * known. If NULL, such readings are dropped. Note that data MUST be copied
+   * if it is to be reused later. */
+  void (* onrelay)(struct subnet_conn *c, short sinkid, subid_t subid, void *data, dlen_t bytes);
 };
 /*---------------------------------------------------------------------------*/
 /* public functions */
@@ -183,6 +487,9 @@ struct subnet_callbacks {
  * \param subchannel Channel on which to communicate pub/sub messages
  * \param peerchannel Channel for P2P communication for subscription info
  * \param u User callbacks
+ *
+ * If SUBNET_CHECKPOINT is set, routes to other sinks stored by an earlier boot
+ * are restored here, and every later change to the sink table is written back.
  */
 void subnet_open(struct subnet_conn *c,
                  uint16_t subchannel,
@@ -210,6 +517,38 @@ void subnet_close(struct subnet_conn *c);
  */
 bool subnet_add_data(struct subnet_conn *c, short sinkid, subid_t subid, void *payload, dlen_t bytes);
 
+/**
+ * \brief Add high priority data for a subscription
+ * \param c Connection state
+ * \param sinkid Sink to send data to
+ * \param subid Subscription data is being added for
+ * \param payload Data
+ * \param bytes Number of bytes of data being added
+ * \return True if data was added, false if it could not be
+ *
+ * The data bypasses the sink's buffer and is published once the current event
+ * has been handled, together with any other high priority data added for the
+ * same sink in the meantime. The packet is queued ahead of bulk packets.
+ */
+bool subnet_add_urgent_data(struct subnet_conn *c, short sinkid, subid_t subid, void *payload, dlen_t bytes);
+
+/**
+ * \brief Add data that is destined for several subscriptions
+ * \param c Connection state
+ * \param targets Number of (sink, subid) pairs in sinkids and subids
+ * \param sinkids Sinks to send data to
+ * \param subids Subscription data is being added for in each sink
+ * \param payload Data
+ * \param bytes Number of bytes of data being added
+ * \return True if data was added for all pairs, false otherwise
+ *
+ * Pairs whose sinks currently share a next hop are written as a single shared
+ * fragment into the buffer of the first of those sinks, so that the data only
+ * crosses the common part of the paths once. The fragment is split again at
+ * the hop where the routes diverge.
+ */
+bool subnet_add_shared_data(struct subnet_conn *c, uint8_t targets, short sinkids[], subid_t subids[], void *payload, dlen_t bytes);
+
 /**
  * \brief Send publishe data packet
  * \param c Connection state
@@ -223,6 +562,11 @@ void subnet_publish(struct subnet_conn *c, short sinkid);
  * \param payload Where to read the subscription data from
  * \param bytes Size of the subscription data
  * \return The subscription id of the new subscription
+ *
+ * The first subscription makes this node a sink, and starts a new epoch for
+ * it that is stored in SUBNET_EPOCH_FILE. Other nodes replace all state they
+ * hold for this sink when they see the new epoch, so subids from an earlier
+ * run can be reused right away.
  */
 subid_t subnet_subscribe(struct subnet_conn *c, void *payload, dlen_t bytes);
 
@@ -260,6 +604,44 @@ void subnet_unsubscribe(struct subnet_conn *c, subid_t subid);
  */
 short subnet_myid(struct subnet_conn *c);
 
+/**
+ * \brief Set the physical position of this node
+ * \param c Connection state
+ * \param position This node's position
+ *
+ * Once set, the position is included in all subscriptions this node
+ * broadcasts so that neighbors can limit where subscriptions are flooded.
+ */
+void subnet_locate(struct subnet_conn *c, const struct position *position);
+
+/**
+ * \brief Get the physical position of this node
+ * \param c Connection state
+ * \return This node's position or NULL if it is not known
+ */
+const struct position *subnet_position(struct subnet_conn *c);
+
+/**
+ * \brief Get statistics on how unicasts have been sent in bursts
+ * \param c Connection state
+ */
+const struct subnet_burst_stats *subnet_burst_stats(struct subnet_conn *c);
+
+/**
+ * \brief Get statistics on how long published data is held by this node
+ * \param c Connection state
+ * \param priority Priority class to get statistics for
+ * \return Statistics for the class, or NULL if there is no such class
+ */
+const struct subnet_latency_stats *subnet_latency_stats(struct subnet_conn *c, uint8_t priority);
+
+/**
+ * \brief Get the counters for this connection
+ * \param c Connection state
+ * \return The counters, or NULL if SUBNET_COUNTERS is not set
+ */
+const struct subnet_counters *subnet_counters(struct subnet_conn *c);
+
 /**
  * \brief Redirect all writes to the given sink to a spare buffer
  * \param c Connection state
@@ -285,6 +667,21 @@ void subnet_writein(struct subnet_conn *c);
  */
 struct fragment *next_fragment(struct fragment *frag, void **payload);
 
+/**
+ * \brief Get the total size of the payload of a shared fragment
+ * \param payload Pointer to the shared fragment's payload
+ * \return Number of bytes the shared fragment's payload occupies
+ */
+dlen_t shared_fragment_size(void *payload);
+
+/**
+ * \brief Find the sink id of the given sink
+ * \param c Connection state
+ * \param sink Address of the sink
+ * \return The sink's id or -1 if it is not known
+ */
+short subnet_sinkid(struct subnet_conn *c, const rimeaddr_t *sink);
+
 /**
  * \brief Get a pointer to the real sink struct for the given sink
  * \param c Connection state
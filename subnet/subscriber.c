@@ -21,15 +21,20 @@
 /*---------------------------------------------------------------------------*/
 /* private functions */
 static void on_ondata(short sink, subid_t subid, void *data);
+static void on_onbatch(short sink, uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]);
+static bool check_active(short sink, subid_t subid);
 /*---------------------------------------------------------------------------*/
 /* private members */
 static struct pubsub_callbacks callbacks = {
   NULL,
   on_ondata,
   NULL,
-  NULL
+  NULL,
+  NULL,
+  on_onbatch
 };
 static void (*on_reading)(subid_t subid, void *data);
+static void (*on_readings)(uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]);
 static struct ctimer resubscribe[PUBSUB_MAX_SUBSCRIPTIONS];
 static subid_t is[PUBSUB_MAX_SUBSCRIPTIONS];
 static void on_resubscribe(void *subidp);
@@ -38,6 +43,18 @@ static void on_resubscribe(void *subidp);
 void subscriber_start(void (*cb)(subid_t subid, void *data)) {
   subid_t i;
   on_reading = cb;
+  on_readings = NULL;
+  pubsub_init(&callbacks);
+
+  for (i = 0; i < PUBSUB_MAX_SUBSCRIPTIONS; i++) {
+    is[i] = i;
+  }
+}
+
+void subscriber_start_batch(void (*cb)(uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[])) {
+  subid_t i;
+  on_reading = NULL;
+  on_readings = cb;
   pubsub_init(&callbacks);
 
   for (i = 0; i < PUBSUB_MAX_SUBSCRIPTIONS; i++) {
@@ -93,22 +110,56 @@ static void repeatunsubscribe(void *subidp) {
   PRINTF("subscriber: rebroadcasting unsubscription for %d\n", subid);
   pubsub_unsubscribe(subid);
 }
+static bool check_active(short sink, subid_t subid) {
+  struct esubscription *s = find_subscription(sink, subid);
+  if (!is_active(s)) {
+    PRINTF("subscriber: subscription was revoked, preparing to send revocation");
+    ctimer_set(&resubscribe[subid], CLOCK_SECOND, &repeatunsubscribe, &is[subid]);
+    return false;
+  }
+  return true;
+}
 static void on_ondata(short sink, subid_t subid, void *data) {
-  struct esubscription *s;
-
   PRINTF("subscriber: got data for %d:%d\n", sink, subid);
-  if (sink == pubsub_myid()) {
-    s = find_subscription(sink, subid);
-    if (!is_active(s)) {
-      PRINTF("subscriber: subscription was revoked, preparing to send revocation");
-      ctimer_set(&resubscribe[subid], CLOCK_SECOND, &repeatunsubscribe, &is[subid]);
+  if (sink == pubsub_myid() && check_active(sink, subid)) {
+    PRINTF("subscriber: oh, it's for us!\n");
+    if (on_reading != NULL) {
+      on_reading(subid, data);
+    }
+  }
+}
+static void on_onbatch(short sink, uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]) {
+  uint8_t i, j, kept = 0, in = 0, out = 0;
+
+  PRINTF("subscriber: got %d groups of data for %d\n", groups, sink);
+  if (sink != pubsub_myid()) {
+    return;
+  }
+
+  /* drop groups for inactive subscriptions, checking each subid only once */
+  for (i = 0; i < groups; i++) {
+    if (!check_active(sink, subids[i])) {
+      in += counts[i];
+    } else if (on_readings == NULL) {
+      for (j = 0; j < counts[i]; j++) {
+        if (on_reading != NULL) {
+          on_reading(subids[i], readings[in]);
+        }
+        in++;
+      }
     } else {
-      PRINTF("subscriber: oh, it's for us!\n");
-      if (on_reading != NULL) {
-        on_reading(subid, data);
+      subids[kept] = subids[i];
+      counts[kept] = counts[i];
+      for (j = 0; j < counts[i]; j++) {
+        readings[out++] = readings[in++];
       }
+      kept++;
     }
   }
+
+  if (kept > 0) {
+    on_readings(kept, subids, counts, readings);
+  }
 }
 /*---------------------------------------------------------------------------*/
 /** @} */
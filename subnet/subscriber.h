@@ -25,6 +25,16 @@
  */
 void subscriber_start(void (*on_reading)(subid_t subid, void *data));
 
+/**
+ * \brief Starts the pubsub network connection, handing over readings a packet
+ *        at a time
+ * \param on_readings Called once for each received packet with its readings
+ *        grouped by subscription. The readings for subids[i] are counts[i]
+ *        consecutive entries in readings, starting after those of the previous
+ *        groups. Readings for inactive subscriptions are left out.
+ */
+void subscriber_start_batch(void (*on_readings)(uint8_t groups, subid_t subids[], uint8_t counts[], void *readings[]));
+
 /**
  * \brief Starts a subscription with the given parameters
  * \return Subscription id of the new subscription
@@ -30,6 +30,9 @@ static void on_reading(subid_t subid, void *data) {
       printf("got: pressure @ <%03d, %03d> = %d\n", r.location.x, r.location.y, r.value);
       break;
     }
+    default:
+      /* not subscribed to */
+      break;
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -60,11 +63,21 @@ PROCESS_THREAD(van_process, ev, data)
 
   /* initialize subscriber */
   subscriber_start(&on_reading);
+  {
+    struct position p = { l.x, l.y };
+    pubsub_locate(&p);
+  }
 
   /* no special stuff here */
   s.soft.filter = NO_SOFT_FILTER;
   s.hard.filter = BE_CLOSE_TO;
   s.hard.arg.loc = l;
+  /* only nodes close to us will ever publish, so don't flood further */
+  s.scope.center.x = l.x;
+  s.scope.center.y = l.y;
+  s.scope.radius = CLOSE_TO_DISTANCE;
+  /* the van is gone if readings are held back */
+  s.priority = SUBNET_PRIORITY_HIGH;
   s.aggregator.aggregator = NO_AGGREGATION;
 
   /* subscribe to humidity */
@@ -0,0 +1,245 @@
+/**
+ * \file
+ *         Decodes the binary reading frames written by a subnet sink
+ * \author
+ *         Jon Gjengset <jon@tsp.io>
+ *
+ * Reads SLIP frames (see subnet/sink-frame.h) from a serial device, a file or
+ * standard input, and writes every reading in them as a CSV line on standard
+ * output. With -c, readings are instead appended to one file per column in the
+ * given directory, as arrays of host byte order integers: sensor (uint8_t),
+ * x, y (int16_t) and value (uint16_t). Frames with a bad CRC are dropped.
+ * Totals are printed on standard error on end of input or interrupt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <err.h>
+
+#include "lib/crc16.h"
+#include "sink-frame.h"
+
+#define SLIP_END     0300
+#define SLIP_ESC     0333
+#define SLIP_ESC_END 0334
+#define SLIP_ESC_ESC 0335
+
+/* larger than any frame the sink writes, so anything that fills it is noise */
+#define MAX_FRAME 256
+
+/* these have to match enum reading_type in subnet/subnet-config.h */
+static const char *sensors[] = { "humidity", "pressure" };
+#define SENSORS (sizeof(sensors) / sizeof(sensors[0]))
+
+enum column {
+  COLUMN_SENSOR,
+  COLUMN_X,
+  COLUMN_Y,
+  COLUMN_VALUE,
+  COLUMNS
+};
+static const char *column_names[COLUMNS] = { "sensor", "x", "y", "value" };
+static FILE *columns[COLUMNS];
+
+static struct {
+  unsigned long frames;
+  unsigned long readings;
+  unsigned long corrupt;
+  unsigned long lost;
+  unsigned long other;
+} totals;
+
+static volatile sig_atomic_t stop;
+/*---------------------------------------------------------------------------*/
+static void on_signal(int sig) {
+  stop = 1;
+}
+
+static speed_t baudrate(int baud) {
+  switch (baud) {
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+  }
+  errx(1, "unsupported baud rate %d", baud);
+}
+
+static void stty_raw(int fd, speed_t speed) {
+  struct termios tty;
+
+  if (tcgetattr(fd, &tty) == -1) err(1, "tcgetattr");
+  cfmakeraw(&tty);
+  tty.c_cc[VTIME] = 0;
+  tty.c_cc[VMIN] = 1;
+  tty.c_cflag &= ~CRTSCTS;
+  tty.c_cflag |= CLOCAL;
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+  if (tcsetattr(fd, TCSAFLUSH, &tty) == -1) err(1, "tcsetattr");
+}
+
+static uint16_t get_short(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static void open_columns(const char *dir) {
+  char path[1024];
+  int i;
+
+  for (i = 0; i < COLUMNS; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, column_names[i]);
+    columns[i] = fopen(path, "ab");
+    if (columns[i] == NULL) err(1, "%s", path);
+  }
+}
+
+static void write_reading(uint8_t sensor, int16_t x, int16_t y, uint16_t value) {
+  if (columns[0] != NULL) {
+    fwrite(&sensor, sizeof(sensor), 1, columns[COLUMN_SENSOR]);
+    fwrite(&x, sizeof(x), 1, columns[COLUMN_X]);
+    fwrite(&y, sizeof(y), 1, columns[COLUMN_Y]);
+    fwrite(&value, sizeof(value), 1, columns[COLUMN_VALUE]);
+  } else if (sensor < SENSORS) {
+    printf("%s,%d,%d,%u\n", sensors[sensor], x, y, value);
+  } else {
+    printf("%u,%d,%d,%u\n", sensor, x, y, value);
+  }
+}
+
+static void handle_frame(const uint8_t *f, int len) {
+  static int expected = -1;
+  uint8_t n;
+  int i;
+
+  if (len == 0) {
+    return;
+  }
+
+  if (f[0] != SINK_FRAME_TYPE || len < SINK_FRAME_SIZE(0)) {
+    totals.other++;
+    return;
+  }
+
+  n = f[2];
+  if (len != SINK_FRAME_SIZE(n) ||
+      crc16_data(f, len - SINK_FRAME_CRC, 0) != get_short(f + len - SINK_FRAME_CRC)) {
+    totals.corrupt++;
+    return;
+  }
+
+  if (expected != -1) {
+    totals.lost += (uint8_t)(f[1] - expected);
+  }
+  expected = (uint8_t)(f[1] + 1);
+
+  totals.frames++;
+  totals.readings += n;
+
+  f += SINK_FRAME_HEADER;
+  for (i = 0; i < n; i++, f += SINK_FRAME_READING) {
+    write_reading(f[0], get_short(f + 1), get_short(f + 3), get_short(f + 5));
+  }
+}
+/*---------------------------------------------------------------------------*/
+int main(int argc, char **argv) {
+  static uint8_t in[4096];
+  static char out[1 << 16];
+  uint8_t frame[MAX_FRAME];
+  int framelen = 0;
+  int escaped = 0;
+  int overflow = 0;
+  const char *dir = NULL;
+  int baud = 115200;
+  int fd = STDIN_FILENO;
+  struct sigaction sa;
+  ssize_t got;
+  ssize_t i;
+  int c;
+
+  while ((c = getopt(argc, argv, "B:c:")) != -1) {
+    switch (c) {
+    case 'B':
+      baud = atoi(optarg);
+      break;
+    case 'c':
+      dir = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-B baudrate] [-c directory] [device-or-file]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind < argc && strcmp(argv[optind], "-") != 0) {
+    fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+    if (fd == -1) err(1, "%s", argv[optind]);
+  }
+  if (isatty(fd)) {
+    stty_raw(fd, baudrate(baud));
+  }
+
+  if (dir != NULL) {
+    open_columns(dir);
+  } else {
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+    printf("sensor,x,y,value\n");
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  while (!stop && (got = read(fd, in, sizeof(in))) > 0) {
+    for (i = 0; i < got; i++) {
+      c = in[i];
+
+      if (c == SLIP_END) {
+        if (!overflow) {
+          handle_frame(frame, framelen);
+        }
+        framelen = 0;
+        escaped = 0;
+        overflow = 0;
+        continue;
+      }
+
+      if (escaped) {
+        escaped = 0;
+        if (c == SLIP_ESC_END) {
+          c = SLIP_END;
+        } else if (c == SLIP_ESC_ESC) {
+          c = SLIP_ESC;
+        }
+      } else if (c == SLIP_ESC) {
+        escaped = 1;
+        continue;
+      }
+
+      if (framelen == MAX_FRAME) {
+        overflow = 1;
+      } else {
+        frame[framelen++] = c;
+      }
+    }
+  }
+
+  fflush(stdout);
+  for (c = 0; c < COLUMNS; c++) {
+    if (columns[c] != NULL) fclose(columns[c]);
+  }
+
+  fprintf(stderr, "frames: %lu\nreadings: %lu\ncorrupt: %lu\nlost: %lu\nother: %lu\n",
+      totals.frames, totals.readings, totals.corrupt, totals.lost, totals.other);
+
+  return 0;
+}